@@ -634,7 +634,6 @@ static int ftw_copy_file(const struct FTW *entp,
     off_t wtotal;
     int ch, checkch, from_fd = 0, rcount, rval, to_fd = 0;
     char *bufp;
-    char *p;
 
     if ((from_fd = open(spath, O_RDONLY, 0)) == -1) {
         SLOG("%s: %s", spath, strerror(errno));
@@ -693,21 +692,38 @@ static int ftw_copy_file(const struct FTW *entp,
 
     rval = 0;
 
+    if (buf == NULL) {
+        /*
+         * Note that buf and bufsize are static. If
+         * malloc() fails, it will fail at the start
+         * and not copy only some files.
+         */
+        if (sysconf(_SC_PHYS_PAGES) >
+            PHYSPAGES_THRESHOLD)
+            bufsize = MIN(BUFSIZE_MAX, MAXPHYS * 8);
+        else
+            bufsize = BUFSIZE_SMALL;
+        buf = malloc(bufsize);
+        if (buf == NULL)
+            ERROR("Not enough memory");
+    }
+
     /*
-     * Mmap and write if less than 8M (the limit is so we don't totally
-     * trash memory on big files.  This is really a minor hack, but it
-     * wins some CPU back.
-     * Some filesystems, such as smbnetfs, don't support mmap,
-     * so this is a best-effort attempt.
+     * Let the filesystem reflink or copy the data if it can, holes in
+     * sparse files are preserved.
      */
+    if (S_ISREG(sp->st_mode)) {
+        if (copy_fd_range(from_fd, 0, to_fd, 0, buf, bufsize) != 0) {
+            SLOG("%s: %s", to.p_path, strerror(errno));
+            rval = 1;
+        }
+        goto copied;
+    }
 
-    if (S_ISREG(sp->st_mode) && sp->st_size > 0 &&
-        sp->st_size <= 8 * 1024 * 1024 &&
-        (p = mmap(NULL, (size_t)sp->st_size, PROT_READ,
-                  MAP_SHARED, from_fd, (off_t)0)) != MAP_FAILED) {
-        wtotal = 0;
-        for (bufp = p, wresid = sp->st_size; ;
-             bufp += wcount, wresid -= (size_t)wcount) {
+    wtotal = 0;
+    while ((rcount = read(from_fd, buf, bufsize)) > 0) {
+        for (bufp = buf, wresid = rcount; ;
+             bufp += wcount, wresid -= wcount) {
             wcount = write(to_fd, bufp, wresid);
             if (wcount <= 0)
                 break;
@@ -718,52 +734,15 @@ static int ftw_copy_file(const struct FTW *entp,
         if (wcount != (ssize_t)wresid) {
             SLOG("%s: %s", to.p_path, strerror(errno));
             rval = 1;
+            break;
         }
-        /* Some systems don't unmap on close(2). */
-        if (munmap(p, sp->st_size) < 0) {
-            SLOG("%s: %s", spath, strerror(errno));
-            rval = 1;
-        }
-    } else {
-        if (buf == NULL) {
-            /*
-             * Note that buf and bufsize are static. If
-             * malloc() fails, it will fail at the start
-             * and not copy only some files.
-             */
-            if (sysconf(_SC_PHYS_PAGES) >
-                PHYSPAGES_THRESHOLD)
-                bufsize = MIN(BUFSIZE_MAX, MAXPHYS * 8);
-            else
-                bufsize = BUFSIZE_SMALL;
-            buf = malloc(bufsize);
-            if (buf == NULL)
-                ERROR("Not enough memory");
-
-        }
-        wtotal = 0;
-        while ((rcount = read(from_fd, buf, bufsize)) > 0) {
-            for (bufp = buf, wresid = rcount; ;
-                 bufp += wcount, wresid -= wcount) {
-                wcount = write(to_fd, bufp, wresid);
-                if (wcount <= 0)
-                    break;
-                wtotal += wcount;
-                if (wcount >= (ssize_t)wresid)
-                    break;
-            }
-            if (wcount != (ssize_t)wresid) {
-                SLOG("%s: %s", to.p_path, strerror(errno));
-                rval = 1;
-                break;
-            }
-        }
-        if (rcount < 0) {
-            SLOG("%s: %s", spath, strerror(errno));
-            rval = 1;
-        }
+    }
+    if (rcount < 0) {
+        SLOG("%s: %s", spath, strerror(errno));
+        rval = 1;
     }
 
+copied:
     /*
      * Don't remove the target even after an error.  The target might
      * not be a regular file, or its attributes might be important,
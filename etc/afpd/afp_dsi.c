@@ -31,6 +31,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <atalk/adouble.h>
 #include <atalk/logger.h>
 #include <atalk/dsi.h>
 #include <atalk/compat.h>
@@ -107,6 +108,9 @@ static void afp_dsi_close(AFPObj *obj)
     LOG(log_note, logtype_afpd, "AFP statistics: %.2f KB read, %.2f KB written",
         dsi->read_count/1024.0, dsi->write_count/1024.0);
     log_dircache_stat();
+#ifdef WITH_RECVFILE
+    ad_recvfile_stat();
+#endif
 
     dsi_close(dsi);
 }
@@ -127,6 +131,7 @@ static void afp_dsi_die(int sig)
 
     if (dsi->flags & DSI_DISCONNECTED) {
         LOG(log_note, logtype_afpd, "Disconnected session terminating");
+        fork_write_sync();
         exit(0);
     }
 
@@ -469,6 +474,9 @@ void afp_over_dsi(AFPObj *obj)
     if (dircache_init(obj->options.dircachesize) != 0)
         afp_dsi_die(EXITERR_SYS);
 
+    if (ad_cache_init(obj->options.adcachesize) != 0)
+        afp_dsi_die(EXITERR_SYS);
+
     /* set TCP snd/rcv buf */
     if (obj->options.tcp_rcvbuf) {
         if (setsockopt(dsi->socket,
@@ -593,6 +601,9 @@ void afp_over_dsi(AFPObj *obj)
             break;
 
         case DSIFUNC_CMD:
+            /* FPWrite data may still be written in the background */
+            fork_write_sync();
+
 #ifdef AFS
             if ( writtenfork ) {
                 if ( flushfork( writtenfork ) < 0 ) {
@@ -706,6 +717,7 @@ void afp_over_dsi(AFPObj *obj)
         pending_request(dsi);
 
         fce_pending_events(obj);
+        sl_index_flush(obj);
     }
 
     /* error */
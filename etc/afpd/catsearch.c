@@ -25,6 +25,8 @@
  * is not built into cnidscheme:cdb.
  */
 
+#define USE_LIST
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif /* HAVE_CONFIG_H */
@@ -52,6 +54,7 @@
 #include <atalk/unicode.h>
 #include <atalk/globals.h>
 #include <atalk/netatalk_conf.h>
+#include <atalk/list.h>
 
 #include "desktop.h"
 #include "directory.h"
@@ -60,6 +63,7 @@
 #include "volume.h"
 #include "filedir.h"
 #include "fork.h"
+#include "catsearch_prefetch.h"
 
 
 struct finderinfo {
@@ -118,62 +122,177 @@ struct dsitem {
  
 
 #define DS_BSIZE 128
-static int save_cidx = -1; /* Saved index of currently scanned directory. */
-static struct dsitem *dstack = NULL; /* Directory stack data... */
-static int dssize = 0;  	     /* Directory stack (allocated) size... */
-static int dsidx = 0;   	     /* First free item index... */
 static struct scrit c1, c2;          /* search criteria */
 
-/* Clears directory stack. */
-static void clearstack(void) 
+/*
+ * Catsearch cursors
+ *
+ * All state of a search is kept in a cursor, so that a session can run several
+ * searches concurrently and every continuation request resumes exactly where the
+ * search stopped. The client gets the ID of the cursor in catpos[1] and the position
+ * in catpos[0], a continuation must present both.
+ * Cursors are kept in a LRU list, if there are more than CATSEARCH_MAX_CURSORS or
+ * they use more than CATSEARCH_MAX_CURSOR_MEM bytes, the least recently used ones
+ * are freed. A client continuing a freed search gets AFPERR_CATCHNG and starts over.
+ */
+#define CATSEARCH_MAX_CURSORS    16
+#define CATSEARCH_MAX_CURSOR_MEM (1024 * 1024)
+
+/* Values of cs_db */
+#define CS_FS          0        /* filesystem search */
+#define CS_DB_NAME     1        /* CNID db search by name, cnid_find() */
+#define CS_DB_SUBSTR   2        /* CNID db search for a name part, cnid_find_substr() */
+#define CS_DB_MTIME    3        /* CNID db search by modification date, cnid_find_mtime() */
+
+struct cs_cursor {
+    struct list_head cs_list;    /* LRU list, most recently used first */
+    uint32_t       cs_id;        /* Cursor ID, catpos[1] */
+    uint32_t       cs_pos;       /* Position we've stopped at, catpos[0] */
+    uint16_t       cs_vid;       /* Volume we are searching on */
+    int            cs_db;        /* CNID db search ? CS_FS or one of CS_DB_* */
+    /* filesystem search */
+    int            cs_save_cidx; /* Saved index of currently scanned directory. */
+    struct dsitem  *cs_dstack;   /* Directory stack data... */
+    int            cs_dssize;    /* Directory stack (allocated) size... */
+    int            cs_dsidx;     /* First free item index... */
+    DIR            *cs_dirpos;   /* UNIX structure describing currently opened directory. */
+    /* CNID db search */
+    char           *cs_resbuf;   /* CNIDs found by the cnid_find*() functions */
+    int            cs_num_matches;
+    uint32_t       cs_base;      /* Position of the first CNID in cs_resbuf */
+    cnid_t         cs_next;      /* Where a streaming search continues, CNID_INVALID when done */
+    time_t         cs_mtime;     /* Where cnid_find_mtime() continues */
+};
+
+static ATALK_LIST_HEAD(cursors);
+static int num_cursors;
+static uint32_t last_cursor_id;
+
+static size_t cursor_size(const struct cs_cursor *cur)
 {
-	save_cidx = -1;
-	while (dsidx > 0) {
-		dsidx--;
-	}
+    size_t size = sizeof(struct cs_cursor) + cur->cs_dssize * sizeof(struct dsitem);
+
+    if (cur->cs_resbuf)
+        size += DBD_MAX_SRCH_RSLTS * sizeof(cnid_t);
+    return size;
+}
+
+static void cursor_free(struct cs_cursor *cur)
+{
+    list_del(&cur->cs_list);
+    num_cursors--;
+    if (cur->cs_dirpos)
+        closedir(cur->cs_dirpos);
+    free(cur->cs_dstack);
+    free(cur->cs_resbuf);
+    free(cur);
+}
+
+/* Free least recently used cursors, but not cur */
+static void cursor_expire(const struct cs_cursor *cur)
+{
+    struct list_head *p, *prev;
+    struct cs_cursor *c;
+    size_t mem = 0;
+
+    list_for_each(p, &cursors)
+        mem += cursor_size(list_entry(p, struct cs_cursor, cs_list));
+
+    for (p = cursors.prev; p != &cursors; p = prev) {
+        prev = p->prev;
+        if (num_cursors <= CATSEARCH_MAX_CURSORS && mem <= CATSEARCH_MAX_CURSOR_MEM)
+            break;
+        c = list_entry(p, struct cs_cursor, cs_list);
+        if (c == cur)
+            continue;
+        LOG(log_debug, logtype_afpd, "catsearch: expiring cursor %u", c->cs_id);
+        mem -= cursor_size(c);
+        cursor_free(c);
+    }
+}
+
+static struct cs_cursor *cursor_new(const struct vol *vol, int db)
+{
+    struct cs_cursor *cur;
+
+    if ((cur = calloc(1, sizeof(struct cs_cursor))) == NULL)
+        return NULL;
+    if (db && (cur->cs_resbuf = malloc(DBD_MAX_SRCH_RSLTS * sizeof(cnid_t))) == NULL) {
+        free(cur);
+        return NULL;
+    }
+    if (++last_cursor_id == 0)
+        last_cursor_id = 1;
+    cur->cs_id = last_cursor_id;
+    cur->cs_vid = vol->v_vid;
+    cur->cs_db = db;
+    cur->cs_save_cidx = -1;
+
+    list_add(&cur->cs_list, &cursors);
+    num_cursors++;
+    cursor_expire(cur);
+    return cur;
+}
+
+/* Find the cursor for a continuation request and make it the most recently used */
+static struct cs_cursor *cursor_lookup(const struct vol *vol, int db, const uint32_t *catpos)
+{
+    struct list_head *p;
+    struct cs_cursor *cur;
+
+    list_for_each(p, &cursors) {
+        cur = list_entry(p, struct cs_cursor, cs_list);
+        if (cur->cs_id != catpos[1])
+            continue;
+        if (cur->cs_pos != catpos[0] || cur->cs_vid != vol->v_vid)
+            return NULL;
+        /* Date searches fall back to the filesystem while the index is incomplete */
+        if (cur->cs_db != db && !(db == CS_DB_MTIME && cur->cs_db == CS_FS))
+            return NULL;
+        list_del(&cur->cs_list);
+        list_add(&cur->cs_list, &cursors);
+        return cur;
+    }
+    return NULL;
 }
 
 /* Puts new item onto directory stack. */
-static int addstack(char *uname, struct dir *dir, int pidx)
+static int addstack(struct cs_cursor *cur, struct dir *dir)
 {
 	struct dsitem *ds;
     struct dsitem *tmpds = NULL;
 
 	/* check if we have some space on stack... */
-	if (dsidx >= dssize) {
-		dssize += DS_BSIZE;
-		tmpds = realloc(dstack, dssize * sizeof(struct dsitem));	
-		if (tmpds == NULL) {
-            clearstack();
-            free(dstack);
+	if (cur->cs_dsidx >= cur->cs_dssize) {
+		tmpds = realloc(cur->cs_dstack, (cur->cs_dssize + DS_BSIZE) * sizeof(struct dsitem));
+		if (tmpds == NULL)
 			return -1;
-        }
-        dstack = tmpds;
+        cur->cs_dstack = tmpds;
+		cur->cs_dssize += DS_BSIZE;
 	}
 
-	/* Put new element. Allocate and copy lname and path. */
-	ds = dstack + dsidx++;
+	/* Put new element. */
+	ds = cur->cs_dstack + cur->cs_dsidx++;
 	ds->ds_did = dir->d_did;
 	ds->ds_checked = 0;
 	return 0;
 }
 
 /* Removes checked items from top of directory stack. Returns index of the first unchecked elements or -1. */
-static int reducestack(void)
+static int reducestack(struct cs_cursor *cur)
 {
 	int r;
-	if (save_cidx != -1) {
-		r = save_cidx;
-		save_cidx = -1;
+	if (cur->cs_save_cidx != -1) {
+		r = cur->cs_save_cidx;
+		cur->cs_save_cidx = -1;
 		return r;
 	}
 
-	while (dsidx > 0) {
-		if (dstack[dsidx-1].ds_checked) {
-			dsidx--;
-//			free(dstack[dsidx].path);
-		} else
-			return dsidx - 1;
+	while (cur->cs_dsidx > 0) {
+		if (cur->cs_dstack[cur->cs_dsidx-1].ds_checked)
+			cur->cs_dsidx--;
+		else
+			return cur->cs_dsidx - 1;
 	} 
 	return -1;
 } 
@@ -200,7 +319,7 @@ static struct adouble *adl_lkup(struct vol *vol, struct path *path, struct adoub
 		adp = &ad;
 	} 
 
-    if ( ad_metadata( path->u_name, ((isdir) ? ADFLAGS_DIR : 0), adp) < 0 ) {
+    if ( ad_metadata_st( path->u_name, ((isdir) ? ADFLAGS_DIR : 0), adp, &path->st) < 0 ) {
         adp = NULL; /* FIXME without resource fork adl_lkup will be call again */
     }
     
@@ -471,8 +590,9 @@ static int rslt_add (const AFPObj *obj, struct vol *vol, struct path *path, char
  *
  * @param vol       (r)  volume we are searching on ...
  * @param dir       (rw) directory we are starting from ...
+ * @param cur       (rw) cursor of this search
  * @param rmatches  (r)  maximum number of matches we can return
- * @param pos       (r)  position we've stopped recently
+ * @param pos       (rw) position we've stopped recently
  * @param rbuf      (w)  output buffer
  * @param nrecs     (w)  number of matches
  * @param rsize     (w)  length of data written to output buffer
@@ -482,6 +602,7 @@ static int rslt_add (const AFPObj *obj, struct vol *vol, struct path *path, char
 static int catsearch(const AFPObj *obj,
                      struct vol *vol,
                      struct dir *dir,  
+                     struct cs_cursor *cur,
                      int rmatches,
                      uint32_t *pos,
                      char *rbuf,
@@ -489,15 +610,12 @@ static int catsearch(const AFPObj *obj,
                      int *rsize,
                      int ext)
 {
-    static uint32_t cur_pos;    /* Saved position index (ID) - used to remember "position" across FPCatSearch calls */
-    static DIR *dirpos; 		 /* UNIX structure describing currently opened directory. */
     struct dir *currentdir;      /* struct dir of current directory */
 	int cidx, r;
 	struct dirent *entry;
 	int result = AFP_OK;
 	int ccr;
     struct path path;
-	char *vpath = vol->v_path;
 	char *rrbuf = rbuf;
     time_t start_time;
     int num_rounds = NUM_ROUNDS;
@@ -505,27 +623,19 @@ static int catsearch(const AFPObj *obj,
     int error;
     int unlen;
 
-	if (*pos != 0 && *pos != cur_pos) {
-		result = AFPERR_CATCHNG;
-		goto catsearch_end;
-	}
-
 	/* FIXME: Category "offspring count ! */
 
 
 	/* We need to initialize all mandatory structures/variables and change working directory appropriate... */
 	if (*pos == 0) {
-		clearstack();
-		if (dirpos != NULL) {
-			closedir(dirpos);
-			dirpos = NULL;
-		} 
-		
-		if (addstack(vpath, dir, -1) == -1) {
+		if (addstack(cur, dir) == -1) {
 			result = AFPERR_MISC;
 			goto catsearch_end;
 		}
 		/* FIXME: Sometimes DID is given by client ! (correct this one above !) */
+
+		if (obj->options.catsearch_threads > 0)
+			catsearch_prefetch_start(cfrombstr(dir->d_fullpath), obj->options.catsearch_threads);
 	}
 
 	/* Save current path */
@@ -537,8 +647,8 @@ static int catsearch(const AFPObj *obj,
 	/* So we are beginning... */
     start_time = time(NULL);
 
-	while ((cidx = reducestack()) != -1) {
-        if ((currentdir = dirlookup(vol, dstack[cidx].ds_did)) == NULL) {
+	while ((cidx = reducestack(cur)) != -1) {
+        if ((currentdir = dirlookup(vol, cur->cs_dstack[cidx].ds_did)) == NULL) {
             result = AFPERR_MISC;
             goto catsearch_end;
         }
@@ -546,16 +656,17 @@ static int catsearch(const AFPObj *obj,
 
 		error = movecwd(vol, currentdir);
 
-		if (!error && dirpos == NULL)
-			dirpos = opendir(".");
+		if (!error && cur->cs_dirpos == NULL)
+			cur->cs_dirpos = opendir(".");
 
-		if (dirpos == NULL)
-			dirpos = opendir(cfrombstr(currentdir->d_fullpath));
+		if (cur->cs_dirpos == NULL)
+			cur->cs_dirpos = opendir(cfrombstr(currentdir->d_fullpath));
 
-		if (error || dirpos == NULL) {
+		if (error || cur->cs_dirpos == NULL) {
 			switch (errno) {
 			case EACCES:
-				dstack[cidx].ds_checked = 1;
+				cur->cs_dstack[cidx].ds_checked = 1;
+				catsearch_prefetch_advance();
 				continue;
 			case EMFILE:
 			case ENFILE:
@@ -571,7 +682,7 @@ static int catsearch(const AFPObj *obj,
 		}
 
 		
-		while ((entry = readdir(dirpos)) != NULL) {
+		while ((entry = readdir(cur->cs_dirpos)) != NULL) {
 			(*pos)++;
 
 			if (!check_dirent(vol, entry->d_name))
@@ -620,7 +731,7 @@ static int catsearch(const AFPObj *obj,
                 }
                 path.m_name = cfrombstr(path.d_dir->d_m_name);
                 	
-				if (addstack(path.u_name, path.d_dir, cidx) == -1) {
+				if (addstack(cur, path.d_dir) == -1) {
 					result = AFPERR_MISC;
 					goto catsearch_end;
 				} 
@@ -659,9 +770,10 @@ static int catsearch(const AFPObj *obj,
 			    num_rounds = NUM_ROUNDS;
 			}
 		} /* while ((entry=readdir(dirpos)) != NULL) */
-		closedir(dirpos);
-		dirpos = NULL;
-		dstack[cidx].ds_checked = 1;
+		closedir(cur->cs_dirpos);
+		cur->cs_dirpos = NULL;
+		cur->cs_dstack[cidx].ds_checked = 1;
+		catsearch_prefetch_advance();
 	} /* while (current_idx = reducestack()) != -1) */
 
 	/* We have finished traversing our tree. Return EOF here. */
@@ -669,11 +781,13 @@ static int catsearch(const AFPObj *obj,
 	goto catsearch_end;
 
 catsearch_pause:
-	cur_pos = *pos; 
-	save_cidx = cidx;
+	cur->cs_pos = *pos;
+	cur->cs_save_cidx = cidx;
 
 catsearch_end: /* Exiting catsearch: error condition */
 	*rsize = rrbuf - rbuf;
+	if (result != AFP_OK)
+		catsearch_prefetch_stop();
     if (cwd != -1) {
         if ((fchdir(cwd)) != 0) {
             LOG(log_debug, logtype_afpd, "error chdiring back: %s", strerror(errno));        
@@ -683,6 +797,9 @@ catsearch_end: /* Exiting catsearch: error condition */
 	return result;
 } /* catsearch() */
 
+/* Maximum number of batches without matches catsearch_db() fetches per request */
+#define CATSEARCH_DB_MAX_EMPTY 10
+
 /*!
  * This function performs a CNID db search
  *
@@ -690,9 +807,10 @@ catsearch_end: /* Exiting catsearch: error condition */
  *
  * @param vol       (r)  volume we are searching on ...
  * @param dir       (rw) directory we are starting from ...
- * @param uname     (r)  UNIX name of object to search
+ * @param uname     (r)  UNIX name of object to search, NULL for a date search
+ * @param cur       (rw) cursor of this search
  * @param rmatches  (r)  maximum number of matches we can return
- * @param pos       (r)  position we've stopped recently
+ * @param pos       (rw) position we've stopped recently
  * @param rbuf      (w)  output buffer
  * @param nrecs     (w)  number of matches
  * @param rsize     (w)  length of data written to output buffer
@@ -702,6 +820,7 @@ static int catsearch_db(const AFPObj *obj,
                         struct vol *vol,
                         struct dir *dir,  
                         const char *uname,
+                        struct cs_cursor *cur,
                         int rmatches,
                         uint32_t *pos,
                         char *rbuf,
@@ -709,10 +828,9 @@ static int catsearch_db(const AFPObj *obj,
                         int *rsize,
                         int ext)
 {
-    static char resbuf[DBD_MAX_SRCH_RSLTS * sizeof(cnid_t)];
-    static uint32_t cur_pos;
-    static int num_matches;
+    uint32_t cur_pos = *pos;
     int ccr ,r;
+    int empty_batches = 0;
 	int result = AFP_OK;
     struct path path;
 	char *rrbuf = rbuf;
@@ -720,14 +838,9 @@ static int catsearch_db(const AFPObj *obj,
     uint16_t flags = CONV_TOLOWER;
 
     LOG(log_debug, logtype_afpd, "catsearch_db(req pos: %u): {pos: %u, name: %s}",
-        *pos, cur_pos, uname);
-        
-	if (*pos != 0 && *pos != cur_pos) {
-		result = AFPERR_CATCHNG;
-		goto catsearch_end;
-	}
+        *pos, cur->cs_pos, uname ? uname : "");
 
-    if (cur_pos == 0 || *pos == 0) {
+    if ((*pos == 0 && cur->cs_db == CS_DB_NAME) || cur->cs_db == CS_DB_SUBSTR) {
         if (convert_charset(vol->v_volcharset,
                             vol->v_volcharset,
                             vol->v_maccharset,
@@ -742,28 +855,86 @@ static int catsearch_db(const AFPObj *obj,
         }
 
         LOG(log_debug, logtype_afpd, "catsearch_db: %s", buffer);
+    }
 
+    if (*pos == 0 && cur->cs_db == CS_DB_MTIME)
+        cur->cs_mtime = c1.mdate;
+
+    if (*pos == 0 && cur->cs_db == CS_DB_NAME) {
         AFP_CNID_START("cnid_find");
-        num_matches = cnid_find(vol->v_cdb,
-                                buffer,
-                                strlen(uname),
-                                resbuf,
-                                sizeof(resbuf));
+        cur->cs_num_matches = cnid_find(vol->v_cdb,
+                                        buffer,
+                                        strlen(buffer),
+                                        cur->cs_resbuf,
+                                        DBD_MAX_SRCH_RSLTS * sizeof(cnid_t));
         AFP_CNID_DONE();
-        if (num_matches == -1) {
+        if (cur->cs_num_matches == -1) {
             result = AFPERR_MISC;
             goto catsearch_end;
         }
     }
-	
-	while (cur_pos < num_matches) {
+
+	for (;;) {
         char *name;
         cnid_t cnid, did;
         char resolvebuf[12 + MAXPATHLEN + 1];
         struct dir *dir;
 
+        if (cur_pos - cur->cs_base >= cur->cs_num_matches) {
+            /*
+             * Buffer exhausted, streaming searches fetch the next batch of matches.
+             * cs_next is CNID_INVALID before the first and after the last batch.
+             */
+            if (cur->cs_db == CS_DB_NAME || (cur_pos > 0 && cur->cs_next == CNID_INVALID))
+                break;
+            if (cur->cs_db == CS_DB_SUBSTR) {
+                AFP_CNID_START("cnid_find_substr");
+                cur->cs_num_matches = cnid_find_substr(vol->v_cdb,
+                                                       buffer,
+                                                       strlen(buffer),
+                                                       &cur->cs_next,
+                                                       cur->cs_resbuf,
+                                                       DBD_MAX_SRCH_RSLTS * sizeof(cnid_t));
+                AFP_CNID_DONE();
+            } else {
+                AFP_CNID_START("cnid_find_mtime");
+                cur->cs_num_matches = cnid_find_mtime(vol->v_cdb,
+                                                      &cur->cs_mtime,
+                                                      c2.mdate,
+                                                      &cur->cs_next,
+                                                      cur->cs_resbuf,
+                                                      DBD_MAX_SRCH_RSLTS * sizeof(cnid_t));
+                AFP_CNID_DONE();
+            }
+            if (cur->cs_num_matches == -1) {
+                if (cur_pos == 0 && cur->cs_db == CS_DB_MTIME && errno == CNID_ERR_INDEX) {
+                    /* The index doesn't know all files yet, continue as a filesystem search */
+                    LOG(log_debug, logtype_afpd, "catsearch_db: modification date index incomplete");
+                    free(cur->cs_resbuf);
+                    cur->cs_resbuf = NULL;
+                    cur->cs_db = CS_FS;
+                    return catsearch(obj, vol, dir, cur, rmatches, pos, rbuf, nrecs, rsize, ext);
+                }
+                result = AFPERR_MISC;
+                goto catsearch_end;
+            }
+            cur->cs_base = cur_pos;
+            if (cur->cs_num_matches == 0 && cur->cs_next == CNID_INVALID)
+                break;
+            if (cur->cs_num_matches == 0 && ++empty_batches >= CATSEARCH_DB_MAX_EMPTY) {
+                /*
+                 * Reply without matches and let the client continue, so that a search
+                 * that finds nothing in a big index doesn't block the session.
+                 * Position 0 would start a new search, so step over it.
+                 */
+                cur->cs_base = ++cur_pos;
+                goto catsearch_pause;
+            }
+            continue;
+        }
+
         /* Next CNID to process from buffer */
-        memcpy(&cnid, resbuf + cur_pos * sizeof(cnid_t), sizeof(cnid_t));
+        memcpy(&cnid, cur->cs_resbuf + (cur_pos - cur->cs_base) * sizeof(cnid_t), sizeof(cnid_t));
         did = cnid;
 
         AFP_CNID_START("cnid_resolve");
@@ -816,24 +987,22 @@ static int catsearch_db(const AFPObj *obj,
                 goto catsearch_end;
             } 
             *nrecs += r;
-            /* Number of matches limit */
-            if (--rmatches == 0) 
-                goto catsearch_pause;
-            /* Block size limit */
-            if (rrbuf - rbuf >= 448)
+            /* Number of matches limit, block size limit. Resume with the next CNID. */
+            if (--rmatches == 0 || rrbuf - rbuf >= 448) {
+                cur_pos++;
                 goto catsearch_pause;
+            }
         }
     next:
         cur_pos++;
-    } /* while */
+    } /* for */
 
 	/* finished */
 	result = AFPERR_EOF;
-    cur_pos = 0;
 	goto catsearch_end;
 
 catsearch_pause:
-    *pos = cur_pos;
+    *pos = cur->cs_pos = cur_pos;
 
 catsearch_end: /* Exiting catsearch: error condition */
 	*rsize = rrbuf - rbuf;
@@ -858,7 +1027,9 @@ static int catsearch_afp(AFPObj *obj _U_, char *ibuf, size_t ibuflen,
     uint16_t	namelen;
     uint16_t	flags;
     char  	    tmppath[256];
-    char        *uname;
+    char        *uname = NULL;
+    struct cs_cursor *cur;
+    int         searchdb;
 
     *rbuflen = 0;
 
@@ -1046,15 +1217,39 @@ static int catsearch_afp(AFPObj *obj _U_, char *ibuf, size_t ibuflen,
     
     /* Call search */
     *rbuflen = 24;
-    if ((c1.rbitmap & (1 << FILPBIT_PDINFO))
-        && !(c1.rbitmap & (1<<CATPBIT_PARTIAL))
-        && (strcmp(vol->v_cnidscheme, "dbd") == 0)
-        && (vol->v_flags & AFPVOL_SEARCHDB))
-        /* we've got a name and it's a dbd volume, so search CNID database */
-        ret = catsearch_db(obj, vol, vol->v_root, uname, rmatches, &catpos[0], rbuf+24, &nrecs, &rsize, ext);
+    searchdb = CS_FS;
+    if ((strcmp(vol->v_cnidscheme, "dbd") == 0) && (vol->v_flags & AFPVOL_SEARCHDB)) {
+        if (c1.rbitmap & (1 << FILPBIT_PDINFO))
+            searchdb = (c1.rbitmap & (1 << CATPBIT_PARTIAL)) ? CS_DB_SUBSTR : CS_DB_NAME;
+        else if (c1.rbitmap & (1 << FILPBIT_MDATE))
+            searchdb = CS_DB_MTIME;
+    }
+
+    if (catpos[0] == 0)
+        cur = cursor_new(vol, searchdb);
     else
+        cur = cursor_lookup(vol, searchdb, catpos);
+
+    if (cur == NULL) {
+        rsize = 0;
+        ret = catpos[0] == 0 ? AFPERR_MISC : AFPERR_CATCHNG;
+    } else if (cur->cs_db) {
+        /* we've got a name and it's a dbd volume, so search CNID database */
+        ret = catsearch_db(obj, vol, vol->v_root, uname, cur, rmatches, &catpos[0], rbuf+24, &nrecs, &rsize, ext);
+    } else {
         /* perform a slow filesystem tree search */
-        ret = catsearch(obj, vol, vol->v_root, rmatches, &catpos[0], rbuf+24, &nrecs, &rsize, ext);
+        ret = catsearch(obj, vol, vol->v_root, cur, rmatches, &catpos[0], rbuf+24, &nrecs, &rsize, ext);
+    }
+
+    if (cur) {
+        if (ret == AFP_OK) {
+            /* paused, the client will continue the search with this cursor */
+            catpos[1] = cur->cs_id;
+            cursor_expire(cur);
+        } else {
+            cursor_free(cur);
+        }
+    }
 
     memcpy(rbuf, catpos, sizeof(catpos));
     rbuf += sizeof(catpos);
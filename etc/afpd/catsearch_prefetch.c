@@ -0,0 +1,388 @@
+/*
+  Copyright (c) 2026 Netatalk Team
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+*/
+
+/*
+ * Catsearch prefetch
+ * ==================
+ *
+ * catsearch() walks the volume depth-first in the afpd main thread. Nearly
+ * everything it calls (dircache, CNID, chdir based path handling, the static
+ * buffers of utompath() and friends) is not thread-safe, so the traversal itself
+ * must stay single-threaded. What we can do in parallel is the filesystem I/O
+ * that the traversal is going to block on: a small pool of worker threads walks
+ * the tree ahead of catsearch(), doing readdir() and lstat() on every entry, so
+ * that by the time catsearch() gets there, dentries and inodes are in the kernel
+ * caches.
+ *
+ * The pool is a work-stealing one: every worker has its own deque of directories
+ * to scan. A worker pushes subdirectories it finds to the tail of its own deque
+ * and pops from there, so it walks depth-first just like catsearch() does. An
+ * idle worker steals from the head of another workers deque, ie takes the
+ * shallowest, and thus largest, pending subtree.
+ *
+ * The workers must not run arbitrarily far ahead of catsearch(), otherwise they
+ * would just churn the caches on large volumes. They may scan at most
+ * CATSEARCH_PREFETCH_WINDOW directories more than catsearch() has finished.
+ *
+ * The workers only ever see pathnames, never any afpd data structure. Restarting
+ * or stopping a prefetch bumps a generation counter, workers discard any work
+ * from an older generation.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <atalk/logger.h>
+
+#include "catsearch_prefetch.h"
+
+struct pf_deque {
+    pthread_mutex_t lock;
+    char            **items;
+    size_t          head;       /* steal end */
+    size_t          tail;       /* owner end */
+    size_t          size;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             nthreads;
+    pthread_t       *threads;
+    struct pf_deque *deques;
+    unsigned int    generation; /* bumped on restart and stop */
+    unsigned long   queued;     /* number of directories in all deques */
+    long            window;     /* number of directories we may still scan */
+} pf = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+/********************************************************
+ * Deques
+ ********************************************************/
+
+static int deque_push(struct pf_deque *dq, char *path)
+{
+    char **tmp;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->size) {
+        if (dq->head > 0) {
+            memmove(dq->items, dq->items + dq->head, (dq->tail - dq->head) * sizeof(char *));
+            dq->tail -= dq->head;
+            dq->head = 0;
+        } else {
+            if ((tmp = realloc(dq->items, (dq->size + 64) * sizeof(char *))) == NULL) {
+                pthread_mutex_unlock(&dq->lock);
+                return -1;
+            }
+            dq->items = tmp;
+            dq->size += 64;
+        }
+    }
+    dq->items[dq->tail++] = path;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+/* Take from our own deque */
+static char *deque_pop(struct pf_deque *dq)
+{
+    char *path = NULL;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail > dq->head) {
+        path = dq->items[--dq->tail];
+        if (dq->tail == dq->head)
+            dq->head = dq->tail = 0;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return path;
+}
+
+/* Take from another workers deque */
+static char *deque_steal(struct pf_deque *dq)
+{
+    char *path = NULL;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail > dq->head) {
+        path = dq->items[dq->head++];
+        if (dq->tail == dq->head)
+            dq->head = dq->tail = 0;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return path;
+}
+
+static void deque_clear(struct pf_deque *dq)
+{
+    pthread_mutex_lock(&dq->lock);
+    while (dq->tail > dq->head)
+        free(dq->items[--dq->tail]);
+    dq->head = dq->tail = 0;
+    pthread_mutex_unlock(&dq->lock);
+}
+
+/********************************************************
+ * Workers
+ ********************************************************/
+
+static unsigned int pf_generation(void)
+{
+    unsigned int gen;
+
+    pthread_mutex_lock(&pf.lock);
+    gen = pf.generation;
+    pthread_mutex_unlock(&pf.lock);
+    return gen;
+}
+
+/*!
+ * Queue a directory for scanning in deque of worker idx
+ *
+ * @returns 0 on success, -1 if the prefetch has been restarted or stopped
+ */
+static int pf_push(int idx, const char *path, unsigned int gen)
+{
+    char *p;
+    int ret = -1;
+
+    if ((p = strdup(path)) == NULL)
+        return -1;
+
+    pthread_mutex_lock(&pf.lock);
+    if (gen == pf.generation && deque_push(&pf.deques[idx], p) == 0) {
+        pf.queued++;
+        pthread_cond_signal(&pf.cond);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&pf.lock);
+
+    if (ret != 0)
+        free(p);
+    return ret;
+}
+
+/* Take a directory, our own deque first, then steal from the others */
+static char *pf_take(int idx)
+{
+    char *path;
+    int i;
+
+    if ((path = deque_pop(&pf.deques[idx])))
+        return path;
+
+    for (i = 1; i < pf.nthreads; i++) {
+        if ((path = deque_steal(&pf.deques[(idx + i) % pf.nthreads])))
+            return path;
+    }
+    return NULL;
+}
+
+/* These are never searched by catsearch(), cf VETO_STR in catsearch.c */
+static int pf_skipdir(const char *name)
+{
+    return (strcmp(name, ".AppleDouble") == 0
+            || strcmp(name, ".AppleDB") == 0
+            || strcmp(name, ".AppleDesktop") == 0);
+}
+
+static void pf_scandir(int idx, const char *path, unsigned int gen)
+{
+    char subpath[MAXPATHLEN + 1];
+    struct stat st;
+    struct dirent *de;
+    DIR *dp;
+
+    if ((dp = opendir(path)) == NULL)
+        return;
+
+    while ((de = readdir(dp)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        if (snprintf(subpath, sizeof(subpath), "%s/%s", path, de->d_name) >= sizeof(subpath))
+            continue;
+        if (lstat(subpath, &st) != 0)
+            continue;
+        if (!S_ISDIR(st.st_mode) || pf_skipdir(de->d_name))
+            continue;
+        if (pf_push(idx, subpath, gen) != 0)
+            break;
+    }
+
+    closedir(dp);
+}
+
+static void *pf_worker(void *arg)
+{
+    int idx = (int)(intptr_t)arg;
+    unsigned int gen;
+    char *path;
+
+    for (;;) {
+        pthread_mutex_lock(&pf.lock);
+        while (pf.queued == 0 || pf.window <= 0)
+            pthread_cond_wait(&pf.cond, &pf.lock);
+        /* Reserve one of the queued directories */
+        pf.queued--;
+        pf.window--;
+        gen = pf.generation;
+        pthread_mutex_unlock(&pf.lock);
+
+        /*
+         * The directory we reserved is in one of the deques, unless the prefetch
+         * has been restarted or stopped in the meantime
+         */
+        while ((path = pf_take(idx)) == NULL) {
+            if (gen != pf_generation())
+                break;
+            sched_yield();
+        }
+        if (path == NULL)
+            continue;
+
+        pf_scandir(idx, path, gen);
+        free(path);
+    }
+
+    return NULL;
+}
+
+static int pf_init(int nthreads)
+{
+    sigset_t sigs, oldsigs;
+    int i;
+
+    if ((pf.deques = calloc(nthreads, sizeof(struct pf_deque))) == NULL)
+        return -1;
+    if ((pf.threads = calloc(nthreads, sizeof(pthread_t))) == NULL) {
+        free(pf.deques);
+        pf.deques = NULL;
+        return -1;
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_mutex_init(&pf.deques[i].lock, NULL);
+
+    /* The workers must not receive any of our signals */
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+
+    for (i = 0; i < nthreads; i++) {
+        /* Workers look at pf.nthreads when stealing, so it must be valid before they start */
+        pf.nthreads = i + 1;
+        if (pthread_create(&pf.threads[i], NULL, pf_worker, (void *)(intptr_t)i) != 0) {
+            LOG(log_error, logtype_afpd, "catsearch_prefetch: pthread_create: %s", strerror(errno));
+            pf.nthreads = i;
+            break;
+        }
+        pthread_detach(pf.threads[i]);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+    LOG(log_debug, logtype_afpd, "catsearch_prefetch: started %d threads", pf.nthreads);
+    return pf.nthreads > 0 ? 0 : -1;
+}
+
+/********************************************************
+ * Interface
+ ********************************************************/
+
+/*!
+ * @brief Start prefetching the tree below path
+ *
+ * The worker threads are started on first use and then kept around for the
+ * lifetime of the process. Any running prefetch is discarded.
+ *
+ * @param path      (r) absolute path of the directory catsearch() starts at
+ * @param nthreads  (r) number of worker threads to start on first use
+ *
+ * @returns 0 on success, -1 on error
+ */
+int catsearch_prefetch_start(const char *path, int nthreads)
+{
+    char *p;
+
+    if (pf.nthreads == 0 && pf_init(nthreads) != 0)
+        return -1;
+
+    catsearch_prefetch_stop();
+
+    if ((p = strdup(path)) == NULL)
+        return -1;
+
+    pthread_mutex_lock(&pf.lock);
+    if (deque_push(&pf.deques[0], p) != 0) {
+        pthread_mutex_unlock(&pf.lock);
+        free(p);
+        return -1;
+    }
+    pf.queued = 1;
+    pf.window = CATSEARCH_PREFETCH_WINDOW;
+    pthread_cond_broadcast(&pf.cond);
+    pthread_mutex_unlock(&pf.lock);
+
+    return 0;
+}
+
+/*!
+ * @brief catsearch() has finished a directory, let the workers scan one more
+ */
+void catsearch_prefetch_advance(void)
+{
+    if (pf.nthreads == 0)
+        return;
+
+    pthread_mutex_lock(&pf.lock);
+    if (pf.window < CATSEARCH_PREFETCH_WINDOW) {
+        pf.window++;
+        pthread_cond_signal(&pf.cond);
+    }
+    pthread_mutex_unlock(&pf.lock);
+}
+
+/*!
+ * @brief Discard all pending prefetch work, the workers go idle
+ */
+void catsearch_prefetch_stop(void)
+{
+    int i;
+
+    if (pf.nthreads == 0)
+        return;
+
+    pthread_mutex_lock(&pf.lock);
+    pf.generation++;
+    pf.queued = 0;
+    pf.window = 0;
+    for (i = 0; i < pf.nthreads; i++)
+        deque_clear(&pf.deques[i]);
+    pthread_mutex_unlock(&pf.lock);
+}
@@ -0,0 +1,25 @@
+/*
+   Copyright (c) 2026 Netatalk Team
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+ */
+
+#ifndef AFPD_CATSEARCH_PREFETCH_H
+#define AFPD_CATSEARCH_PREFETCH_H
+
+/* Number of directories the prefetch threads may scan ahead of catsearch() */
+#define CATSEARCH_PREFETCH_WINDOW 512
+
+extern int  catsearch_prefetch_start(const char *path, int nthreads);
+extern void catsearch_prefetch_advance(void);
+extern void catsearch_prefetch_stop(void);
+
+#endif /* AFPD_CATSEARCH_PREFETCH_H */
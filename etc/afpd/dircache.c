@@ -86,6 +86,22 @@
  * Using ctime leads to cache eviction in case 2) where it wouldn't be necessary, because
  * the dir itself (name, CNID, ...) hasn't changed, but there's no other way.
  *
+ * Negative entries
+ * ================
+ *
+ * Clients constantly probe for names that don't exist (.DS_Store, Icon\r, .localized,
+ * ...). In order to answer these without stating the name every time, misses from
+ * cname() are stored in a separate hashtable keyed by DID/name. As we don't have
+ * a CNID for a missing object, we (ab)use struct dir as the entry: d_pdid and d_u_name
+ * form the key, dcache_ctime and dcache_ino hold the parent directories st_ctime and
+ * st_ino at the time the miss was recorded. Any modification of the parent directory
+ * changes its ctime which invalidates all negative entries below it.
+ * The parent directory ctime is taken from the parents struct dir, which has been
+ * validated against a fresh stat by the dircache lookup that found it. The volume root
+ * isn't validated by dirlookup(), so for entries below it we stat it.
+ * Misses are not cached if the parent directory has been modified in the current
+ * second, because a subsequent modification in the same second would go unnoticed.
+ *
  * Indexes
  * =======
  *
@@ -122,6 +138,10 @@ static struct dircache_stat {
     unsigned long long removed;
     unsigned long long expunged;
     unsigned long long evicted;
+    unsigned long long neg_lookups;
+    unsigned long long neg_hits;
+    unsigned long long neg_added;
+    unsigned long long neg_expunged;
 } dircache_stat;
 
 /* FNV 1a */
@@ -228,6 +248,48 @@ static int hash_comp_didname(const void *k1, const void *k2)
               && (bstrcmp(key1->d_u_name, key2->d_u_name) == 0) );
 }
 
+/*******************************************************
+ * negative entries (another hashtable and LRU queue) */
+
+static hash_t       *negcache;
+static q_t          *negcache_queue;
+static unsigned int negcache_maxsize;
+
+static void negcache_free(struct dir *neg)
+{
+    bdestroy(neg->d_u_name);
+    free(neg);
+}
+
+static void negcache_remove(struct dir *neg)
+{
+    hnode_t *hn;
+
+    dequeue(neg->qidx_node->prev);
+    if ((hn = hash_lookup(negcache, neg)))
+        hash_delete_free(negcache, hn);
+    negcache_free(neg);
+}
+
+/*!
+ * @brief Get st_ctime and st_ino of a directory for negative entry validation
+ */
+static int negcache_dirstat(const struct vol *vol, const struct dir *dir, time_t *ctime, ino_t *ino)
+{
+    struct stat st;
+
+    if (dir->d_did == DIRDID_ROOT) {
+        if (ostat(cfrombstr(dir->d_fullpath), &st, vol_syml_opt(vol)) != 0)
+            return -1;
+        *ctime = st.st_ctime;
+        *ino = st.st_ino;
+    } else {
+        *ctime = dir->dcache_ctime;
+        *ino = dir->dcache_ino;
+    }
+    return 0;
+}
+
 /***************************
  * queue index on dircache */
 
@@ -422,6 +484,128 @@ struct dir *dircache_search_by_name(const struct vol *vol,
     return cdir;
 }
 
+/*!
+ * @brief Search the negative entries via did/name
+ *
+ * Stale entries, ie the parent directory has been modified since the entry was
+ * added, are expunged.
+ *
+ * @param vol      (r) volume
+ * @param dir      (r) parent directory, must have been validated by a dircache lookup
+ * @param name     (r) name (server side encoding)
+ * @param len      (r) strlen of name
+ *
+ * @returns 1 if name is known not to exist in dir, else 0
+ */
+int dircache_search_negative(const struct vol *vol,
+                             const struct dir *dir,
+                             char *name,
+                             int len)
+{
+    struct dir *neg;
+    struct dir key;
+    hnode_t *hn;
+    time_t ctime;
+    ino_t ino;
+    static_bstring uname = {-1, len, (unsigned char *)name};
+
+    AFP_ASSERT(vol);
+    AFP_ASSERT(dir);
+    AFP_ASSERT(name);
+
+    if (dir->d_did == DIRDID_ROOT_PARENT)
+        return 0;
+
+    dircache_stat.neg_lookups++;
+    key.d_vid = vol->v_vid;
+    key.d_pdid = dir->d_did;
+    key.d_u_name = &uname;
+
+    if ((hn = hash_lookup(negcache, &key)) == NULL)
+        return 0;
+    neg = hnode_get(hn);
+
+    if (negcache_dirstat(vol, dir, &ctime, &ino) != 0
+        || neg->dcache_ctime != ctime
+        || neg->dcache_ino != ino) {
+        LOG(log_debug, logtype_afpd, "dircache(did:%u,\"%s\"): {negative entry modified}",
+            ntohl(dir->d_did), name);
+        negcache_remove(neg);
+        dircache_stat.neg_expunged++;
+        return 0;
+    }
+
+    LOG(log_debug, logtype_afpd, "dircache(did:%u,\"%s\"): {negative entry found in cache}",
+        ntohl(dir->d_did), name);
+    dircache_stat.neg_hits++;
+    return 1;
+}
+
+/*!
+ * @brief Add a negative entry for a name that doesn't exist in dir
+ *
+ * @param vol      (r) volume
+ * @param dir      (r) parent directory, must have been validated by a dircache lookup
+ * @param name     (r) name (server side encoding)
+ * @param len      (r) strlen of name
+ */
+void dircache_add_negative(const struct vol *vol,
+                           const struct dir *dir,
+                           char *name,
+                           int len)
+{
+    struct dir *neg;
+    hnode_t *hn;
+    time_t ctime;
+    ino_t ino;
+
+    AFP_ASSERT(vol);
+    AFP_ASSERT(dir);
+    AFP_ASSERT(name);
+
+    if (dir->d_did == DIRDID_ROOT_PARENT)
+        return;
+    if (negcache_dirstat(vol, dir, &ctime, &ino) != 0)
+        return;
+    /* Modifications in the same second wouldn't change the ctime */
+    if (ctime >= time(NULL))
+        return;
+
+    if ((neg = calloc(1, sizeof(struct dir))) == NULL)
+        return;
+    if ((neg->d_u_name = blk2bstr(name, len)) == NULL) {
+        free(neg);
+        return;
+    }
+    neg->d_vid = vol->v_vid;
+    neg->d_pdid = dir->d_did;
+    neg->d_did = CNID_INVALID;
+    neg->dcache_ctime = ctime;
+    neg->dcache_ino = ino;
+
+    if ((hn = hash_lookup(negcache, neg))) {
+        negcache_remove(hnode_get(hn));
+        dircache_stat.neg_expunged++;
+    }
+
+    if (hash_count(negcache) >= negcache_maxsize)
+        negcache_remove(negcache_queue->next->data);
+
+    if (hash_alloc_insert(negcache, neg, neg) == 0) {
+        negcache_free(neg);
+        return;
+    }
+    if ((neg->qidx_node = enqueue(negcache_queue, neg)) == NULL) {
+        hash_delete_free(negcache, hash_lookup(negcache, neg));
+        negcache_free(neg);
+        return;
+    }
+
+    dircache_stat.neg_added++;
+    LOG(log_debug, logtype_afpd, "dircache(did:%u,\"%s\"): {negative entry added}",
+        ntohl(dir->d_did), name);
+}
+
 /*!
  * @brief create struct dir from struct path
  *
@@ -468,6 +652,11 @@ int dircache_add(const struct vol *vol,
         dir_remove(vol, hnode_get(hn));
         dircache_stat.expunged++;
     }
+    if ((hn = hash_lookup(negcache, &key))) {
+        /* Found a negative entry with the same DID/name, delete it */
+        negcache_remove(hnode_get(hn));
+        dircache_stat.neg_expunged++;
+    }
 
     /* Add it to the main dircache */
     if (hash_alloc_insert(dircache, dir, dir) == 0) {
@@ -588,6 +777,13 @@ int dircache_init(int reqsize)
     if ((invalid_dircache_entries = queue_init()) == NULL)
         return -1;
 
+    /* Initialize negative entries hashtable and its LRU queue */
+    negcache_maxsize = dircache_maxsize / 4;
+    if ((negcache = hash_create(negcache_maxsize, hash_comp_didname, hash_didname)) == NULL)
+        return -1;
+    if ((negcache_queue = queue_init()) == NULL)
+        return -1;
+
     /* As long as directory.c hasn't got its own initializer call, we do it for it */
     rootParent.d_did = DIRDID_ROOT_PARENT;
     rootParent.d_fullpath = bfromcstr("ROOT_PARENT");
@@ -604,7 +800,8 @@ int dircache_init(int reqsize)
 void log_dircache_stat(void)
 {
     LOG(log_info, logtype_afpd, "dircache statistics: "
-        "entries: %lu, lookups: %llu, hits: %llu, misses: %llu, added: %llu, removed: %llu, expunged: %llu, evicted: %llu",
+        "entries: %lu, lookups: %llu, hits: %llu, misses: %llu, added: %llu, removed: %llu, expunged: %llu, evicted: %llu, "
+        "negative entries: %lu, lookups: %llu, hits: %llu, added: %llu, expunged: %llu",
         queue_count,
         dircache_stat.lookups,
         dircache_stat.hits,
@@ -612,7 +809,12 @@ void log_dircache_stat(void)
         dircache_stat.added,
         dircache_stat.removed,
         dircache_stat.expunged,
-        dircache_stat.evicted);
+        dircache_stat.evicted,
+        hash_count(negcache),
+        dircache_stat.neg_lookups,
+        dircache_stat.neg_hits,
+        dircache_stat.neg_added,
+        dircache_stat.neg_expunged);
 }
 
 /*!
@@ -672,6 +874,20 @@ void dircache_dump(void)
                 cfrombstr(dir->d_fullpath));
     }
 
+    fprintf(dump, "\nNegative entries:\n");
+    fprintf(dump, "       VID     DID NAME\n");
+    fprintf(dump, "====================================================================\n");
+    hash_scan_begin(&hs, negcache);
+    i = 1;
+    while ((hn = hash_scan_next(&hs))) {
+        dir = hnode_get(hn);
+        fprintf(dump, "%05u: %3u  %6u %s\n",
+                i++,
+                ntohs(dir->d_vid),
+                ntohl(dir->d_pdid),
+                cfrombstr(dir->d_u_name));
+    }
+
     fprintf(dump, "\nLRU Queue:\n");
     fprintf(dump, "       VID     DID    CNID STAT PATH\n");
     fprintf(dump, "====================================================================\n");
@@ -1057,7 +1057,7 @@ int dir_modify(const struct vol *vol,
  * 6.   cnode name -> copy it to path.m_name
  * 7. Get unix name from mac name
  * 8. Special handling of request with did 1
- * 9. stat the cnode name
+ * 9. stat the cnode name, unless the dircache has a negative entry for it
  * 10. If it's not there, it's probably an afp_createfile|dir,
  *     return with curdir = dir parent, struct path = dirname
  * 11. If it's there and it's a file, it must should be the last element of the requested
@@ -1082,6 +1082,7 @@ struct path *cname(struct vol *vol, struct dir *dir, char **cpath)
     uint16_t   len16;
     int         size = 0;
     int         toUTF8 = 0;
+    int         unamelen;
 
     LOG(log_maxdebug, logtype_afpd, "cname('%s'): {start}", cfrombstr(dir->d_fullpath));
 
@@ -1202,7 +1203,15 @@ struct path *cname(struct vol *vol, struct dir *dir, char **cpath)
              *   and thus call continue which should terminate the while loop because
              *   len = 0. Ok?
              */
-            if (of_stat(vol, &ret) != 0) { /* 9 */
+            unamelen = strlen(ret.u_name);
+            if (dircache_search_negative(vol, dir, ret.u_name, unamelen)) { /* 9 */
+                ret.st_valid = 1;
+                ret.st_errno = errno = ENOENT;
+            } else if (of_stat(vol, &ret) != 0 && ret.st_errno == ENOENT) {
+                dircache_add_negative(vol, dir, ret.u_name, unamelen);
+            }
+
+            if (ret.st_errno != 0) {
                 /*
                  * ret.u_name doesn't exist, might be afp_createfile|dir
                  * that means it should have been the last part
@@ -1250,7 +1259,6 @@ struct path *cname(struct vol *vol, struct dir *dir, char **cpath)
             }
 
             /* Search the cache */
-            int unamelen = strlen(ret.u_name);
             cdir = dircache_search_by_name(vol, dir, ret.u_name, unamelen); /* 14 */
             if (cdir == NULL) {
                 /* Not in cache, create one */
@@ -1442,7 +1450,8 @@ int getdirparams(const AFPObj *obj,
                    (1 << DIRPBIT_FINFO)))) {
 
         ad_init(&ad, vol);
-        if ( !ad_metadata( upath, ADFLAGS_DIR, &ad) ) {
+        if ( !ad_metadata_st( upath, ADFLAGS_DIR, &ad,
+                              (s_path->st_valid && !s_path->st_errno) ? st : NULL) ) {
             isad = 1;
             if (ad.ad_mdp->adf_flags & O_CREAT) {
                 /* We just created it */
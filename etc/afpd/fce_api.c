@@ -56,6 +56,7 @@
 #include <atalk/unix.h>
 #include <atalk/fce_api.h>
 #include <atalk/globals.h>
+#include <atalk/spotlight.h>
 
 #include "fork.h"
 #include "file.h"
@@ -511,6 +512,8 @@ int fce_register(const AFPObj *obj, fce_ev_t event, const char *path, const char
     AFP_ASSERT(event >= FCE_FIRST_EVENT && event <= FCE_LAST_EVENT);
     AFP_ASSERT(path);
 
+    sl_index_event(obj, event, path);
+
     LOG(log_debug, logtype_fce, "register_fce(path: %s, event: %s)",
         path, fce_event_names[event]);
 
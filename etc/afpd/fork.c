@@ -12,6 +12,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <sys/param.h>
 #include <sys/socket.h>
 #include <inttypes.h>
@@ -29,11 +31,17 @@
 #include <atalk/ea.h>
 
 #include "fork.h"
+#include "fork_readpipe.h"
+#include "fork_writepipe.h"
 #include "file.h"
 #include "directory.h"
 #include "desktop.h"
 #include "volume.h"
 
+#ifndef HAVE_FDATASYNC
+#define fdatasync fsync
+#endif
+
 #ifdef AFS
 struct ofork *writtenfork;
 #endif
@@ -505,6 +513,31 @@ openfork_err:
     return ret;
 }
 
+/*
+ * Grow the data fork by allocating the space instead of leaving a hole, so the
+ * data written later ends up contiguous.
+ *
+ * Returns 0 if the fork has been grown, -1 if the caller has to truncate it.
+ */
+static int grow_fork(struct ofork *ofork, off_t from, off_t to)
+{
+#ifdef HAVE_FALLOCATE
+    int fd = ad_data_fileno(ofork->of_ad);
+
+    if (!(ofork->of_vol->v_flags & AFPVOL_PREALLOC) || fd < 0)
+        return -1;
+
+    if (fallocate(fd, 0, from, to - from) != 0) {
+        LOG(log_debug, logtype_afpd, "grow_fork(%s): fallocate: %s",
+            of_name(ofork), strerror(errno));
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 int afp_setforkparams(AFPObj *obj, char *ibuf, size_t ibuflen, char *rbuf _U_, size_t *rbuflen)
 {
     struct ofork    *ofork;
@@ -588,7 +621,10 @@ int afp_setforkparams(AFPObj *obj, char *ibuf, size_t ibuflen, char *rbuf _U_, s
             ad_tmplock(ofork->of_ad, eid, ADLOCK_WR, size, st_size -size, ofork->of_refnum) < 0)
             goto afp_setfork_err;
 
-        err = ad_dtruncate( ofork->of_ad, size );
+        if (st_size < size && grow_fork(ofork, st_size, size) == 0)
+            err = 0;
+        else
+            err = ad_dtruncate( ofork->of_ad, size );
         if (st_size > size)
             ad_tmplock(ofork->of_ad, eid, ADLOCK_CLR, size, st_size -size, ofork->of_refnum);
         if (err < 0)
@@ -616,6 +652,8 @@ int afp_setforkparams(AFPObj *obj, char *ibuf, size_t ibuflen, char *rbuf _U_, s
     } else
         return AFPERR_BITMAP;
 
+    ofork->of_flags |= AFPFORK_UNSYNCED;
+
 #ifdef AFS
     if ( flushfork( ofork ) < 0 ) {
         LOG(log_error, logtype_afpd, "afp_setforkparams(%s): flushfork: %s", of_name(ofork), strerror(errno) );
@@ -775,13 +813,236 @@ static int read_file(const struct ofork *ofork, int eid, off_t offset, char *rbu
     return AFP_OK;
 }
 
+/*!
+ * Track the access pattern of a fork and read ahead of sequential streams
+ *
+ * The read-ahead window starts at FORK_RA_MIN and doubles with every
+ * sequential read up to FORK_RA_MAX, we top it up once half of it has been
+ * consumed. Streams longer than FORK_RA_DROP drop the cache behind them so
+ * they don't push everything else out of it.
+ *
+ * @param ofork    (rw) fork handle
+ * @param eid      (r)  data fork or ressource fork entry id
+ * @param offset   (r)  offset of the read
+ * @param reqcount (r)  length of the read
+ * @param size     (r)  size of the fork
+ */
+static void read_ahead(struct ofork *ofork, int eid, off_t offset, off_t reqcount, off_t size)
+{
+#ifdef HAVE_POSIX_FADVISE
+    off_t base, start, end;
+    int   fd;
+
+    if (eid == ADEID_DFORK)
+        fd = ad_data_fileno(ofork->of_ad);
+    else
+        fd = ad_reso_fileno(ofork->of_ad);
+    if (fd < 0)
+        return;
+
+    if (offset != ofork->of_ra_next) {
+        /* random access, start over */
+        ofork->of_ra_start = ofork->of_ra_drop = offset;
+        ofork->of_ra_end = 0;
+        ofork->of_ra_window = 0;
+    } else if (ofork->of_ra_window == 0) {
+        ofork->of_ra_window = FORK_RA_MIN;
+    } else if (ofork->of_ra_window < FORK_RA_MAX) {
+        ofork->of_ra_window *= 2;
+    }
+    ofork->of_ra_next = offset + reqcount;
+
+    if (ofork->of_ra_window == 0)
+        return;
+
+    base = ad_getentryoff(ofork->of_ad, eid);
+    start = MAX(ofork->of_ra_end, ofork->of_ra_next);
+    end = MIN(ofork->of_ra_next + ofork->of_ra_window, size);
+
+    if (start < end && (end - start >= ofork->of_ra_window / 2 || end == size)) {
+        LOG(log_maxdebug, logtype_afpd, "read_ahead(%s): %jd-%jd",
+            of_name(ofork), (intmax_t)start, (intmax_t)end);
+        (void)posix_fadvise(fd, base + start, end - start, POSIX_FADV_WILLNEED);
+        ofork->of_ra_end = end;
+    }
+
+    if (ofork->of_ra_next - ofork->of_ra_start > FORK_RA_DROP
+        && offset - ofork->of_ra_drop >= FORK_RA_MAX) {
+        (void)posix_fadvise(fd, base + ofork->of_ra_drop, offset - ofork->of_ra_drop,
+                            POSIX_FADV_DONTNEED);
+        ofork->of_ra_drop = offset;
+    }
+#endif
+}
+
+/*!
+ * O_DIRECT fd of the data fork for streaming transfers
+ *
+ * Forks on volumes with "direct io" switch to direct I/O once more than that
+ * many bytes have been read or written through them, so large transfers don't
+ * push everything else out of the page cache. The fd is a second open of the
+ * data fork kept with the adouble, the fd of the adouble is still used for
+ * everything else. Only the read and write pipelines use it.
+ *
+ * @param ofork    (rw) fork handle
+ * @param eid      (r)  data fork or ressource fork entry id
+ * @param reqcount (r)  length of the transfer
+ * @param write    (r)  the fd is used for writing
+ *
+ * @returns fd, -1 if the fork doesn't use direct I/O
+ */
+static int direct_fd(struct ofork *ofork, int eid, off_t reqcount, int write)
+{
+#ifdef O_DIRECT
+    struct ad_fd *adf = &ofork->of_ad->ad_data_fork;
+    char path[64];
+    int  fd, flags;
+
+    if (eid != ADEID_DFORK || ofork->of_vol->v_directio < 0 || adf->adf_dfd == -2)
+        return -1;
+
+    if (adf->adf_dfd < 0) {
+        ofork->of_xfer += reqcount;
+        if (ofork->of_xfer <= ofork->of_vol->v_directio)
+            return -1;
+
+        if ((fd = ad_data_fileno(ofork->of_ad)) < 0 || (flags = fcntl(fd, F_GETFL)) == -1) {
+            adf->adf_dfd = -2;
+            return -1;
+        }
+
+        /* reopening through /proc gives an fd with its own file flags */
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+        if ((adf->adf_dfd = open(path, (flags & O_ACCMODE) | O_DIRECT)) < 0) {
+            LOG(log_info, logtype_afpd, "direct_fd(%s): %s", of_name(ofork), strerror(errno));
+            adf->adf_dfd = -2;
+            return -1;
+        }
+
+        LOG(log_debug, logtype_afpd, "direct_fd(%s): direct I/O after %jd bytes",
+            of_name(ofork), (intmax_t)ofork->of_xfer);
+    }
+
+    if (write && ((flags = fcntl(adf->adf_dfd, F_GETFL)) == -1 || (flags & O_ACCMODE) == O_RDONLY))
+        return -1;
+    return adf->adf_dfd;
+#else
+    return -1;
+#endif
+}
+
+/*!
+ * Send reqcount bytes of the fork at offset through the read pipeline
+ *
+ * @returns 0 if the data has been sent, 1 if the pipeline can't be used and
+ *          nothing has been sent, -1 if sending the reply failed
+ */
+static int read_fork_pipelined(DSI *dsi, struct ofork *ofork, int eid, int dfd,
+                               off_t offset, off_t reqcount, int err)
+{
+    size_t  chunk;
+    off_t   sent;
+    ssize_t cc;
+    char    *buf;
+    int     fd;
+
+    chunk = MAX(dsi->server_quantum / READPIPE_SPLIT, READPIPE_MINCHUNK);
+    if (reqcount <= chunk && dfd < 0)
+        return 1;
+
+    if (eid == ADEID_DFORK)
+        fd = ad_data_fileno(ofork->of_ad);
+    else
+        fd = ad_reso_fileno(ofork->of_ad);
+    if (fd < 0)
+        return 1;
+
+    if (readpipe_start(fd, dfd, ad_getentryoff(ofork->of_ad, eid) + offset, reqcount, chunk) != 0)
+        return 1;
+
+    /* Let read_fork() deal with errors as long as we haven't replied */
+    if ((cc = readpipe_next(&buf)) <= 0) {
+        readpipe_stop();
+        return 1;
+    }
+
+    if (dsi_readinit(dsi, buf, cc, reqcount, err) < 0)
+        goto error;
+
+    for (sent = cc; sent < reqcount; sent += cc) {
+        if ((cc = readpipe_next(&buf)) <= 0) {
+            if (cc == 0)
+                errno = EIO;    /* fork shrunk */
+            goto error;
+        }
+        if (dsi_read(dsi, buf, cc) < 0)
+            goto error;
+    }
+
+    readpipe_stop();
+    dsi_readdone(dsi);
+    return 0;
+
+error:
+    readpipe_stop();
+    return -1;
+}
+
+/*
+ * FPRead of a range that is a hole of a sparse data fork: send zeroes without
+ * reading the file.
+ *
+ * Returns 0 when sent, 1 if the range isn't a hole and -1 on error.
+ */
+static int read_fork_hole(DSI *dsi, struct ofork *ofork, off_t offset, off_t reqcount, int err)
+{
+#ifdef SEEK_DATA
+    static char zeroes[64 * 1024];
+    struct stat st;
+    off_t   cur, data, sent;
+    size_t  len;
+    int     fd = ad_data_fileno(ofork->of_ad);
+
+    if (fd < 0 || fstat(fd, &st) != 0 || (off_t)st.st_blocks * 512 >= st.st_size)
+        return 1;
+
+    /* the fd is shared with the other forks of the file, leave its offset alone */
+    if ((cur = lseek(fd, 0, SEEK_CUR)) == -1)
+        return 1;
+    data = lseek(fd, offset, SEEK_DATA);
+    if (data == -1 && errno != ENXIO) {
+        (void)lseek(fd, cur, SEEK_SET);
+        return 1;
+    }
+    (void)lseek(fd, cur, SEEK_SET);
+    if (data != -1 && data < offset + reqcount)
+        return 1;
+
+    LOG(log_debug, logtype_afpd, "afp_read(%s): hole at %jd, len: %jd",
+        of_name(ofork), (intmax_t)offset, (intmax_t)reqcount);
+
+    len = MIN(reqcount, sizeof(zeroes));
+    if (dsi_readinit(dsi, zeroes, len, reqcount, err) < 0)
+        return -1;
+    for (sent = len; sent < reqcount; sent += len) {
+        len = MIN(reqcount - sent, sizeof(zeroes));
+        if (dsi_read(dsi, zeroes, len) < 0)
+            return -1;
+    }
+    dsi_readdone(dsi);
+    return 0;
+#else
+    return 1;
+#endif
+}
+
 static int read_fork(AFPObj *obj, char *ibuf, size_t ibuflen _U_, char *rbuf, size_t *rbuflen, int is64)
 {
     DSI          *dsi = obj->dsi;
     struct ofork *ofork;
     off_t        offset, saveoff, reqcount, savereqcount, size;
     ssize_t      cc, err;
-    int          eid;
+    int          eid, dfd;
     uint16_t     ofrefnum;
 
     /* we break the AFP spec here by not supporting nlmask and nlchar anymore */
@@ -854,8 +1115,24 @@ static int read_fork(AFPObj *obj, char *ibuf, size_t ibuflen _U_, char *rbuf, si
         }
     }
 
+    dfd = direct_fd(ofork, eid, reqcount, 0);
+    if (dfd < 0)
+        read_ahead(ofork, eid, offset, reqcount, size);
+
+    if (eid == ADEID_DFORK && (ofork->of_vol->v_flags & AFPVOL_SPARSEREAD)) {
+        switch (read_fork_hole(dsi, ofork, offset, reqcount, err)) {
+        case 0:
+            goto afp_read_done;
+        case -1:
+            goto afp_read_exit;
+        default:
+            break;
+        }
+    }
+
 #ifdef WITH_SENDFILE
-    if (!(eid == ADEID_DFORK && ad_data_fileno(ofork->of_ad) == AD_SYMLINK) &&
+    if (dfd < 0 &&
+        !(eid == ADEID_DFORK && ad_data_fileno(ofork->of_ad) == AD_SYMLINK) &&
         !(obj->options.flags & OPTION_NOSENDFILE)) {
         int fd = ad_readfile_init(ofork->of_ad, eid, &offset, 0);
         if (dsi_stream_read_file(dsi, fd, offset, reqcount, err) < 0) {
@@ -867,6 +1144,15 @@ static int read_fork(AFPObj *obj, char *ibuf, size_t ibuflen _U_, char *rbuf, si
     }
 #endif
 
+    switch (read_fork_pipelined(dsi, ofork, eid, dfd, offset, reqcount, err)) {
+    case 0:
+        goto afp_read_done;
+    case -1:
+        goto afp_read_exit;
+    default:
+        break;
+    }
+
     *rbuflen = MIN(reqcount, dsi->server_quantum);
 
     cc = read_file(ofork, eid, offset, ibuf, rbuflen);
@@ -962,6 +1248,7 @@ int afp_flushfork(AFPObj *obj _U_, char *ibuf, size_t ibuflen _U_, char *rbuf _U
 {
     struct ofork    *ofork;
     uint16_t       ofrefnum;
+    int             err;
 
     *rbuflen = 0;
     ibuf += 2;
@@ -979,7 +1266,9 @@ int afp_flushfork(AFPObj *obj _U_, char *ibuf, size_t ibuflen _U_, char *rbuf _U
         LOG(log_error, logtype_afpd, "afp_flushfork(%s): %s", of_name(ofork), strerror(errno) );
     }
 
-    return( AFP_OK );
+    err = ofork->of_write_err;
+    ofork->of_write_err = AFP_OK;
+    return err;
 }
 
 /*
@@ -992,6 +1281,7 @@ int afp_syncfork(AFPObj *obj _U_, char *ibuf, size_t ibuflen _U_, char *rbuf _U_
 {
     struct ofork        *ofork;
     uint16_t           ofrefnum;
+    int                 err;
 
     *rbuflen = 0;
     ibuf += 2;
@@ -1012,21 +1302,28 @@ int afp_syncfork(AFPObj *obj _U_, char *ibuf, size_t ibuflen _U_, char *rbuf _U_
         return AFPERR_MISC;
     }
 
-    return( AFP_OK );
+    err = ofork->of_write_err;
+    ofork->of_write_err = AFP_OK;
+    return err;
 }
 
 /* this is very similar to closefork */
 int flushfork(struct ofork *ofork)
 {
     struct timeval tv;
-
+    int dfd = ad_data_fileno(ofork->of_ad);
     int err = 0, doflush = 0;
 
-    if ( ad_data_fileno( ofork->of_ad ) != -1 &&
-         fsync( ad_data_fileno( ofork->of_ad )) < 0 ) {
-        LOG(log_error, logtype_afpd, "flushfork(%s): dfile(%d) %s",
-            of_name(ofork), ad_data_fileno(ofork->of_ad), strerror(errno) );
-        err = -1;
+    /* Nothing to do for data forks that haven't been written since the last sync.
+       With many written forks on the filesystem one syncfs() does them all. */
+    if (dfd != -1 && of_unsynced(ofork, AFPFORK_DATA)) {
+        if (of_syncfs(ofork, dfd) != 0 && fdatasync(dfd) < 0) {
+            LOG(log_error, logtype_afpd, "flushfork(%s): dfile(%d) %s",
+                of_name(ofork), dfd, strerror(errno) );
+            err = -1;
+        } else {
+            of_synced(ofork, AFPFORK_DATA);
+        }
     }
 
     if ( ad_reso_fileno( ofork->of_ad ) != -1 &&  /* HF */
@@ -1048,6 +1345,8 @@ int flushfork(struct ofork *ofork)
 
         if (fsync( ad_reso_fileno( ofork->of_ad )) < 0)
             err = -1;
+        else
+            of_synced(ofork, AFPFORK_RSRC);
 
         if (err < 0)
             LOG(log_error, logtype_afpd, "flushfork(%s): hfile(%d) %s",
@@ -1061,6 +1360,7 @@ int afp_closefork(AFPObj *obj, char *ibuf, size_t ibuflen _U_, char *rbuf _U_, s
 {
     struct ofork    *ofork;
     uint16_t       ofrefnum;
+    int             err;
 
     *rbuflen = 0;
     ibuf += 2;
@@ -1074,12 +1374,15 @@ int afp_closefork(AFPObj *obj, char *ibuf, size_t ibuflen _U_, char *rbuf _U_, s
     LOG(log_debug, logtype_afpd, "afp_closefork(fork: %" PRIu16 " [%s])",
         ofork->of_refnum, (ofork->of_flags & AFPFORK_DATA) ? "data" : "rsrc");
 
+    /* of_closefork() frees ofork */
+    err = ofork->of_write_err;
+
     if (of_closefork(obj, ofork) < 0 ) {
         LOG(log_error, logtype_afpd, "afp_closefork: of_closefork: %s", strerror(errno) );
         return( AFPERR_PARAM );
     }
 
-    return( AFP_OK );
+    return err;
 }
 
 
@@ -1112,6 +1415,127 @@ static ssize_t write_file(struct ofork *ofork, int eid,
 }
 
 
+/*
+ * Preallocate ahead of sequential writes appending to the data fork, so a
+ * large file that is streamed in ends up contiguous. The space beyond the end
+ * of the fork is released in of_closefork().
+ */
+static void prealloc_ahead(struct ofork *ofork, off_t offset, off_t reqcount, off_t size)
+{
+#ifdef HAVE_FALLOCATE
+    off_t start, end;
+    int   fd = ad_data_fileno(ofork->of_ad);
+
+    if (!(ofork->of_vol->v_flags & AFPVOL_PREALLOC) || fd < 0 || ofork->of_pa_window < 0)
+        return;
+
+    if (offset != ofork->of_pa_next || offset + reqcount <= size) {
+        /* not a sequential append, start over */
+        ofork->of_pa_next = offset + reqcount;
+        ofork->of_pa_window = 0;
+        return;
+    }
+    ofork->of_pa_next = offset + reqcount;
+
+    if (ofork->of_pa_next + ofork->of_pa_window / 2 <= ofork->of_pa_end)
+        return;
+
+    if (ofork->of_pa_window == 0)
+        ofork->of_pa_window = FORK_PA_MIN;
+    else if (ofork->of_pa_window < FORK_PA_MAX)
+        ofork->of_pa_window *= 2;
+
+    start = MAX(ofork->of_pa_end, offset);
+    end = ofork->of_pa_next + ofork->of_pa_window;
+
+    LOG(log_maxdebug, logtype_afpd, "prealloc_ahead(%s): %jd-%jd",
+        of_name(ofork), (intmax_t)start, (intmax_t)end);
+
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, start, end - start) != 0) {
+        LOG(log_debug, logtype_afpd, "prealloc_ahead(%s): fallocate: %s",
+            of_name(ofork), strerror(errno));
+        ofork->of_pa_window = -1;
+        return;
+    }
+    ofork->of_pa_end = end;
+#endif
+}
+
+/* Hand errors of completed write-behind writes to their forks */
+static void fork_write_errors(void)
+{
+    struct ofork *ofork;
+    int refnum, err;
+
+    while ((err = writepipe_error(&refnum)) != 0) {
+        if ((ofork = of_find(refnum)) == NULL)
+            continue;
+        switch (err) {
+        case EDQUOT:
+        case EFBIG:
+        case ENOSPC:
+            ofork->of_write_err = AFPERR_DFULL;
+            break;
+        case EACCES:
+            ofork->of_write_err = AFPERR_ACCESS;
+            break;
+        default:
+            ofork->of_write_err = AFPERR_PARAM;
+        }
+    }
+}
+
+/*!
+ * @brief Wait for all write-behind writes
+ *
+ * Must be called before anything but write_fork() accesses a fork that might
+ * have been written. Errors are reported by the next FPWrite, FPFlushFork or
+ * FPCloseFork of the fork.
+ */
+void fork_write_sync(void)
+{
+    writepipe_sync();
+    fork_write_errors();
+}
+
+/*
+ * Write-behind: receive the data into the buffers of the write pipeline and
+ * queue them, the pipeline writes them to the fork while we receive the next
+ * chunk or request. cc bytes are already in rcvbuf.
+ *
+ * Returns 0 with offset advanced past the data, -1 if the pipeline isn't
+ * available and nothing has been received.
+ */
+static int write_fork_pipelined(DSI *dsi, struct ofork *ofork, int dfd, off_t *offset,
+                                char *rcvbuf, size_t cc, size_t bufsize)
+{
+    char    *buf;
+    size_t  space, len, n;
+
+    for (;;) {
+        /* only the first call can fail, the buffers exist afterwards */
+        if ((buf = writepipe_buf(bufsize, *offset, &space)) == NULL)
+            return -1;
+
+        len = MIN(cc, space);
+        memcpy(buf, rcvbuf, len);
+        rcvbuf += len;
+        cc -= len;
+        while (len < space && (n = dsi_write(dsi, buf + len, space - len)) > 0)
+            len += n;
+        if (len == 0)
+            return 0;
+
+        LOG(log_debug, logtype_afpd, "afp_write: queued: %zu, offset: %jd",
+            len, (intmax_t)*offset);
+
+        writepipe_submit(ad_data_fileno(ofork->of_ad), dfd, *offset, len, ofork->of_refnum);
+        *offset += len;
+        if (len < space)
+            return 0;
+    }
+}
+
 /*
  * FPWrite. NOTE: on an error, we always use afp_write_err as
  * the client may have sent us a bunch of data that's not reflected
@@ -1121,7 +1545,7 @@ static int write_fork(AFPObj *obj, char *ibuf, size_t ibuflen _U_, char *rbuf, s
 {
     struct ofork    *ofork;
     off_t           offset, saveoff, reqcount, oldsize, newsize;
-    int             endflag, eid, err = AFP_OK;
+    int             endflag, eid, dfd, err = AFP_OK;
     uint16_t        ofrefnum;
     ssize_t         cc;
     DSI             *dsi = obj->dsi;
@@ -1152,6 +1576,14 @@ static int write_fork(AFPObj *obj, char *ibuf, size_t ibuflen _U_, char *rbuf, s
         goto afp_write_err;
     }
 
+    /* report a failed write-behind write of a previous FPWrite */
+    fork_write_errors();
+    if (ofork->of_write_err != AFP_OK) {
+        err = ofork->of_write_err;
+        ofork->of_write_err = AFP_OK;
+        goto afp_write_err;
+    }
+
 #ifdef AFS
     writtenfork = ofork;
 #endif /* AFS */
@@ -1166,6 +1598,9 @@ static int write_fork(AFPObj *obj, char *ibuf, size_t ibuflen _U_, char *rbuf, s
     }
 
     oldsize = ad_size(ofork->of_ad, eid);
+    if (eid == ADEID_DFORK)
+        /* queued write-behind writes may extend the fork */
+        oldsize = MAX(oldsize, writepipe_end(ad_data_fileno(ofork->of_ad)));
     if (endflag)
         offset += oldsize;
 
@@ -1191,6 +1626,9 @@ static int write_fork(AFPObj *obj, char *ibuf, size_t ibuflen _U_, char *rbuf, s
         goto afp_write_err;
     }
 
+    if (eid == ADEID_DFORK)
+        prealloc_ahead(ofork, offset, reqcount, oldsize);
+
     AFP_WRITE_START((long)reqcount);
 
     saveoff = offset;
@@ -1201,8 +1639,22 @@ static int write_fork(AFPObj *obj, char *ibuf, size_t ibuflen _U_, char *rbuf, s
         }
     }
 
+    ofork->of_flags |= AFPFORK_UNSYNCED;
+    dfd = direct_fd(ofork, eid, reqcount, 1);
+
     /* find out what we have already */
-    if ((cc = dsi_writeinit(dsi, rcvbuf, rcvbuflen)) > 0) {
+    cc = dsi_writeinit(dsi, rcvbuf, rcvbuflen);
+
+    /* recvfile would go through the page cache, direct I/O takes precedence */
+    if (eid == ADEID_DFORK
+        && ad_data_fileno(ofork->of_ad) >= 0
+        && (obj->options.flags & OPTION_WRITEBEHIND)
+        && !(obj->options.flags & OPTION_AFP_READ_LOCK)
+        && (dfd >= 0 || !(obj->options.flags & OPTION_RECVFILE))
+        && write_fork_pipelined(dsi, ofork, dfd, &offset, rcvbuf, cc, rcvbuflen) == 0)
+        goto afp_write_done;
+
+    if (cc > 0) {
         ssize_t written;
         if ((written = write_file(ofork, eid, offset, rcvbuf, cc)) != cc) {
             dsi_writeflush(dsi);
@@ -1229,10 +1681,9 @@ static int write_fork(AFPObj *obj, char *ibuf, size_t ibuflen _U_, char *rbuf, s
             case EFBIG:
             case ENOSPC:
                 cc = AFPERR_DFULL;
-                dsi_writeflush(dsi);
+                /* ad_recvfile() has discarded the rest of the data */
+                dsi->datasize = 0;
                 break;
-            case ENOSYS:
-                goto afp_write_loop;
             default:
                 /* Low level error, can't do much to back up */
                 cc = AFPERR_MISC;
@@ -1249,7 +1700,6 @@ static int write_fork(AFPObj *obj, char *ibuf, size_t ibuflen _U_, char *rbuf, s
     }
 #endif
 
-afp_write_loop:
     /* loop until everything gets written. currently
      * dsi_write handles the end case by itself. */
     while ((cc = dsi_write(dsi, rcvbuf, rcvbuflen))) {
@@ -25,9 +25,28 @@ struct ofork {
     cnid_t              of_did;
     uint16_t            of_refnum;
     int                 of_flags;
+    off_t               of_ra_start;    /* where the current read stream started */
+    off_t               of_ra_next;     /* offset a sequential read continues at */
+    off_t               of_ra_end;      /* end of the read-ahead issued so far */
+    off_t               of_ra_drop;     /* cache below this offset has been dropped */
+    off_t               of_ra_window;   /* read-ahead window, 0: not sequential */
+    int                 of_write_err;   /* AFP error of a write-behind write, reported on the next call */
+    off_t               of_pa_next;     /* offset a sequential append continues at */
+    off_t               of_pa_end;      /* end of the space preallocated so far */
+    off_t               of_pa_window;   /* preallocation window, -1: not supported */
+    off_t               of_xfer;        /* bytes read and written, for "direct io" */
     struct ofork        **prevp, *next;
 };
 
+/* Read-ahead for sequential FPRead streams */
+#define FORK_RA_MIN     (256 * 1024)
+#define FORK_RA_MAX     (16 * 1024 * 1024)
+#define FORK_RA_DROP    ((off_t)1024 * 1024 * 1024) /* drop cache behind longer streams */
+
+/* Preallocation ahead of sequential appends, "preallocate" volume option */
+#define FORK_PA_MIN     (1024 * 1024)
+#define FORK_PA_MAX     (64 * 1024 * 1024)
+
 #define OPENFORK_DATA   (0)
 #define OPENFORK_RSCS   (1<<7)
 
@@ -46,6 +65,7 @@ struct ofork {
 #define AFPFORK_ACCMASK (AFPFORK_ACCRD | AFPFORK_ACCWR)
 #define AFPFORK_MODIFIED (1<<6) /* used in FCE for modified files */
 #define AFPFORK_ERROR   (1<<7)  /* used to indicate an error in opening the fork */
+#define AFPFORK_UNSYNCED (1<<8) /* written since the last fsync */
 
 #ifdef AFS
 extern struct ofork *writtenfork;
@@ -65,6 +85,9 @@ extern int          of_rename    (const struct vol *,
                                           struct dir *, const char *,
                                           struct dir *, const char *);
 extern int          of_flush     (const struct vol *);
+extern int          of_unsynced  (const struct ofork *, int forks);
+extern void         of_synced    (const struct ofork *, int forks);
+extern int          of_syncfs    (const struct ofork *, int fd);
 extern int          of_stat      (const struct vol *vol, struct path *);
 extern int          of_statdir   (struct vol *vol, struct path *);
 extern int          of_closefork (const AFPObj *obj, struct ofork *ofork);
@@ -80,6 +103,7 @@ extern int of_fstatat(int dirfd, struct path *path);
 
 /* in fork.c */
 extern int          flushfork    (struct ofork *);
+extern void         fork_write_sync(void);
 
 /* FP functions */
 int afp_openfork (AFPObj *obj, char *ibuf, size_t ibuflen, char *rbuf,  size_t *rbuflen);
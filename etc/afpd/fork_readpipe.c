@@ -0,0 +1,309 @@
+/*
+  Copyright (c) 2026 Netatalk Team
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+*/
+
+/*
+ * FPRead pipeline
+ * ===============
+ *
+ * Without sendfile, read_fork() reads a chunk of the fork and then sends it to
+ * the client, so disk and network I/O never overlap. The pipeline moves the
+ * reading to a helper thread with two buffers: while the afpd main thread
+ * sends one chunk, the helper reads the next one into the other buffer.
+ *
+ * A buffer is either empty, owned by the helper while it's being filled, or
+ * full, and then owned by the main thread until it asks for the next chunk.
+ * The helper only ever sees an fd and offsets, never any afpd data structure.
+ * readpipe_stop() waits for a pread() in progress, so the fd may be closed
+ * afterwards.
+ *
+ * With an O_DIRECT fd for the file (the "direct io" volume option), the
+ * helper reads the READPIPE_DIRECT aligned blocks around each chunk through
+ * it, bypassing the page cache.
+ *
+ * The helper thread is started on first use and then kept around for the
+ * lifetime of the process.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <atalk/logger.h>
+
+#include "fork_readpipe.h"
+
+#define RP_EMPTY 0
+#define RP_BUSY  1              /* being filled by the helper */
+#define RP_FULL  2
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             started;
+    char            *buf[2];
+    size_t          bufsize;
+    int             state[2];
+    ssize_t         len[2];     /* bytes in buf, -1 on error */
+    size_t          skip[2];    /* data starts at buf + skip */
+    int             err[2];     /* errno if len is -1 */
+    int             fill;       /* buffer the helper fills next */
+    int             take;       /* buffer the main thread takes next */
+    int             holding;    /* main thread holds buffer take */
+    int             fd;
+    int             dfd;        /* O_DIRECT fd, -1: none */
+    off_t           offset;     /* where the helper continues reading */
+    off_t           left;       /* bytes the helper still has to read */
+    size_t          chunk;
+} rp = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+/* Read a whole chunk unless we hit EOF */
+static ssize_t rp_read(int fd, char *buf, size_t len, off_t offset)
+{
+    ssize_t cc;
+    size_t got = 0;
+
+    while (got < len) {
+        cc = pread(fd, buf + got, len - got, offset + got);
+        if (cc < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (cc == 0)
+            break;
+        got += cc;
+    }
+    return got;
+}
+
+/* Read the aligned blocks around a chunk from an O_DIRECT fd */
+static ssize_t rp_read_direct(int dfd, char *buf, size_t len, off_t offset, size_t *skip)
+{
+    off_t   aoff = offset & ~(off_t)(READPIPE_DIRECT - 1);
+    size_t  alen, got = 0;
+    ssize_t cc;
+
+    *skip = offset - aoff;
+    alen = (*skip + len + READPIPE_DIRECT - 1) & ~(size_t)(READPIPE_DIRECT - 1);
+
+    while (got < alen) {
+        cc = pread(dfd, buf + got, alen - got, aoff + got);
+        if (cc < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        got += cc;
+        /* a short read that isn't a whole number of blocks is EOF */
+        if (cc == 0 || got % READPIPE_DIRECT)
+            break;
+    }
+    if (got <= *skip)
+        return 0;
+    return MIN(got - *skip, len);
+}
+
+static void *rp_helper(void *arg _U_)
+{
+    ssize_t cc;
+    size_t  len, skip;
+    off_t   offset;
+    int     fd, dfd, s, err;
+
+    pthread_mutex_lock(&rp.lock);
+    for (;;) {
+        while (rp.left <= 0 || rp.state[rp.fill] != RP_EMPTY)
+            pthread_cond_wait(&rp.cond, &rp.lock);
+
+        s = rp.fill;
+        fd = rp.fd;
+        dfd = rp.dfd;
+        offset = rp.offset;
+        len = MIN(rp.left, (off_t)rp.chunk);
+        rp.state[s] = RP_BUSY;
+        pthread_mutex_unlock(&rp.lock);
+
+        skip = 0;
+        if (dfd < 0 || ((cc = rp_read_direct(dfd, rp.buf[s], len, offset, &skip)) < 0 && errno == EINVAL)) {
+            if (dfd >= 0)
+                LOG(log_debug, logtype_afpd, "readpipe: O_DIRECT read rejected, reading buffered");
+            skip = 0;
+            cc = rp_read(fd, rp.buf[s], len, offset);
+        }
+        err = errno;
+
+        pthread_mutex_lock(&rp.lock);
+        if (rp.state[s] == RP_BUSY) {
+            /* not stopped in the meantime */
+            rp.state[s] = RP_FULL;
+            rp.len[s] = cc;
+            rp.skip[s] = skip;
+            rp.err[s] = err;
+            if (cc <= 0) {
+                rp.left = 0;
+            } else {
+                rp.offset += cc;
+                rp.left -= cc;
+            }
+            rp.fill = !s;
+        }
+        pthread_cond_broadcast(&rp.cond);
+    }
+
+    return NULL;
+}
+
+static int rp_init(size_t chunk)
+{
+    sigset_t sigs, oldsigs;
+    pthread_t thread;
+    void *buf;
+    int i, ret;
+
+    if (chunk > rp.bufsize) {
+        /* room for the aligned blocks around a chunk */
+        for (i = 0; i < 2; i++) {
+            if (posix_memalign(&buf, READPIPE_DIRECT, chunk + 2 * READPIPE_DIRECT) != 0)
+                return -1;
+            free(rp.buf[i]);
+            rp.buf[i] = buf;
+        }
+        rp.bufsize = chunk;
+    }
+
+    if (rp.started)
+        return 0;
+
+    /* The helper must not receive any of our signals */
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+    ret = pthread_create(&thread, NULL, rp_helper, NULL);
+    pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+    if (ret != 0) {
+        LOG(log_error, logtype_afpd, "readpipe: pthread_create: %s", strerror(ret));
+        return -1;
+    }
+    pthread_detach(thread);
+    rp.started = 1;
+
+    LOG(log_debug, logtype_afpd, "readpipe: started helper thread");
+    return 0;
+}
+
+/********************************************************
+ * Interface
+ ********************************************************/
+
+/*!
+ * @brief Start reading len bytes at offset from fd in the background
+ *
+ * @param fd      (r) fd to read from, must stay open until readpipe_stop()
+ * @param dfd     (r) O_DIRECT fd of the same file or -1, must stay open until readpipe_stop()
+ * @param offset  (r) offset to start reading at
+ * @param len     (r) number of bytes to read
+ * @param chunk   (r) size of the chunks readpipe_next() returns
+ *
+ * @returns 0 on success, -1 if the pipeline isn't available
+ */
+int readpipe_start(int fd, int dfd, off_t offset, off_t len, size_t chunk)
+{
+    if (rp_init(chunk) != 0)
+        return -1;
+
+    pthread_mutex_lock(&rp.lock);
+    rp.fd = fd;
+    rp.dfd = dfd;
+    rp.offset = offset;
+    rp.left = len;
+    rp.chunk = chunk;
+    pthread_cond_broadcast(&rp.cond);
+    pthread_mutex_unlock(&rp.lock);
+
+    return 0;
+}
+
+/*!
+ * @brief Get the next chunk
+ *
+ * Hands the buffer of the previous chunk back to the helper thread.
+ *
+ * @param buf   (w) the data, valid until the next call to readpipe_next() or readpipe_stop()
+ *
+ * @returns number of bytes, 0 at EOF, -1 on error
+ */
+ssize_t readpipe_next(char **buf)
+{
+    ssize_t len;
+    int s;
+
+    pthread_mutex_lock(&rp.lock);
+    if (rp.holding) {
+        rp.state[rp.take] = RP_EMPTY;
+        rp.take = !rp.take;
+        rp.holding = 0;
+        pthread_cond_broadcast(&rp.cond);
+    }
+
+    s = rp.take;
+    while (rp.state[s] != RP_FULL && (rp.left > 0 || rp.state[s] == RP_BUSY))
+        pthread_cond_wait(&rp.cond, &rp.lock);
+
+    if (rp.state[s] != RP_FULL) {
+        pthread_mutex_unlock(&rp.lock);
+        return 0;
+    }
+
+    rp.holding = 1;
+    len = rp.len[s];
+    if (len < 0)
+        errno = rp.err[s];
+    *buf = rp.buf[s] + rp.skip[s];
+    pthread_mutex_unlock(&rp.lock);
+
+    return len;
+}
+
+/*!
+ * @brief Discard any data not yet taken, waits for a read in progress
+ */
+void readpipe_stop(void)
+{
+    int i;
+
+    if (!rp.started)
+        return;
+
+    pthread_mutex_lock(&rp.lock);
+    rp.left = 0;
+    while (rp.state[0] == RP_BUSY || rp.state[1] == RP_BUSY)
+        pthread_cond_wait(&rp.cond, &rp.lock);
+    for (i = 0; i < 2; i++)
+        rp.state[i] = RP_EMPTY;
+    rp.fill = rp.take = rp.holding = 0;
+    rp.fd = rp.dfd = -1;
+    pthread_mutex_unlock(&rp.lock);
+}
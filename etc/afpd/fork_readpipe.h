@@ -0,0 +1,29 @@
+/*
+   Copyright (c) 2026 Netatalk Team
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+ */
+
+#ifndef AFPD_FORK_READPIPE_H
+#define AFPD_FORK_READPIPE_H
+
+#include <sys/types.h>
+
+/* FPReads are split into chunks of server quantum / READPIPE_SPLIT */
+#define READPIPE_SPLIT    4
+#define READPIPE_MINCHUNK (64 * 1024)
+#define READPIPE_DIRECT   4096          /* alignment for O_DIRECT reads */
+
+extern int     readpipe_start(int fd, int dfd, off_t offset, off_t len, size_t chunk);
+extern ssize_t readpipe_next(char **buf);
+extern void    readpipe_stop(void);
+
+#endif /* AFPD_FORK_READPIPE_H */
@@ -0,0 +1,407 @@
+/*
+  Copyright (c) 2026 Netatalk Team
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+*/
+
+/*
+ * FPWrite pipeline
+ * ================
+ *
+ * write_fork() receives a chunk of data from the client and then writes it
+ * to the fork, so network and disk I/O never overlap and every chunk costs a
+ * pwrite(). The pipeline moves the writing to a helper thread with a ring of
+ * WRITEPIPE_NBUFS buffers: the afpd main thread receives into the next free
+ * buffer and queues it, while the helper writes the queued buffers. A run of
+ * queued buffers for the same fd at adjacent offsets is written with a single
+ * pwritev(). Buffers after the first one of a run end at WRITEPIPE_ALIGN
+ * boundaries, so the filesystem sees large aligned writes.
+ *
+ * The main thread owns the buffer behind the queue until it queues it, the
+ * helper owns the buffers it's writing. The helper only ever sees fds,
+ * offsets and tags, never any afpd data structure.
+ *
+ * Errors are recorded together with the tag of the write and reported by
+ * writepipe_error(). writepipe_sync() waits until everything queued has been
+ * written, it must be called before anything else uses or closes an fd with
+ * queued writes.
+ *
+ * With an O_DIRECT fd for the file (the "direct io" volume option), the
+ * helper writes the WRITEPIPE_DIRECT aligned blocks of a run through it and
+ * only the unaligned edges through the page cache. Data is put into the
+ * buffers at the alignment of its file offset, so aligned file offsets are
+ * at aligned addresses too.
+ *
+ * The helper thread is started on first use and then kept around for the
+ * lifetime of the process.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/uio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <atalk/logger.h>
+
+#include "fork_writepipe.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             started;
+    char            *buf[WRITEPIPE_NBUFS];
+    size_t          bufsize;
+    int             fd[WRITEPIPE_NBUFS];
+    int             dfd[WRITEPIPE_NBUFS];   /* O_DIRECT fd, -1: none */
+    off_t           offset[WRITEPIPE_NBUFS];
+    size_t          len[WRITEPIPE_NBUFS];
+    int             tag[WRITEPIPE_NBUFS];
+    int             head;       /* oldest queued buffer */
+    int             queued;     /* number of queued buffers */
+    int             nerr;
+    int             errtag[WRITEPIPE_NERR];
+    int             err[WRITEPIPE_NERR];
+} wp = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+/* Start of the data in buffer i */
+#define WP_DATA(i) (wp.buf[i] + wp.offset[i] % WRITEPIPE_DIRECT)
+
+/* Write a run of buffers, returns 0 or an errno */
+static int wp_write(int fd, struct iovec *iov, int iovcnt, off_t offset)
+{
+    ssize_t cc;
+
+    while (iovcnt > 0) {
+#ifdef HAVE_PWRITEV
+        cc = pwritev(fd, iov, iovcnt, offset);
+#else
+        cc = pwrite(fd, iov->iov_base, iov->iov_len, offset);
+#endif
+        if (cc < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (cc == 0)
+            return ENOSPC;
+        offset += cc;
+        while (iovcnt > 0 && (size_t)cc >= iov->iov_len) {
+            cc -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + cc;
+            iov->iov_len -= cc;
+        }
+    }
+    return 0;
+}
+
+/* Write a run, the aligned blocks through dfd, returns 0 or an errno */
+static int wp_write_direct(int fd, int dfd, struct iovec *iov, int iovcnt, off_t offset)
+{
+    struct iovec mid[WRITEPIPE_NBUFS], save[WRITEPIPE_NBUFS], part;
+    off_t   start, end = 0, ms = 0, me = 0, moff = 0, mend = 0;
+    int     i, n = 0, err;
+
+    for (i = 0, start = offset; i <= iovcnt; i++, start = end) {
+        if (i < iovcnt) {
+            end = start + iov[i].iov_len;
+            ms = (start + WRITEPIPE_DIRECT - 1) & ~(off_t)(WRITEPIPE_DIRECT - 1);
+            me = end & ~(off_t)(WRITEPIPE_DIRECT - 1);
+            if (ms >= me)
+                ms = me = end;
+        }
+
+        /* write the aligned blocks collected so far unless this one continues them */
+        if (n > 0 && (i == iovcnt || ms == me || ms != mend)) {
+            memcpy(save, mid, n * sizeof(struct iovec));
+            if ((err = wp_write(dfd, mid, n, moff)) == EINVAL) {
+                LOG(log_debug, logtype_afpd, "writepipe: O_DIRECT write rejected, writing buffered");
+                err = wp_write(fd, save, n, moff);
+            }
+            if (err)
+                return err;
+            n = 0;
+        }
+        if (i == iovcnt)
+            break;
+
+        if (ms > start) {
+            part.iov_base = iov[i].iov_base;
+            part.iov_len = ms - start;
+            if ((err = wp_write(fd, &part, 1, start)))
+                return err;
+        }
+        if (me > ms) {
+            if (n == 0)
+                moff = ms;
+            mid[n].iov_base = (char *)iov[i].iov_base + (ms - start);
+            mid[n].iov_len = me - ms;
+            mend = me;
+            n++;
+        }
+        if (end > me) {
+            part.iov_base = (char *)iov[i].iov_base + (me - start);
+            part.iov_len = end - me;
+            if ((err = wp_write(fd, &part, 1, me)))
+                return err;
+        }
+    }
+    return 0;
+}
+
+static void wp_seterror(int tag, int err)
+{
+    int i;
+
+    for (i = 0; i < wp.nerr; i++) {
+        if (wp.errtag[i] == tag)
+            return;
+    }
+    if (wp.nerr == WRITEPIPE_NERR) {
+        LOG(log_error, logtype_afpd, "writepipe: too many errors, dropping: %s", strerror(err));
+        return;
+    }
+    wp.errtag[wp.nerr] = tag;
+    wp.err[wp.nerr] = err;
+    wp.nerr++;
+}
+
+static void *wp_helper(void *arg _U_)
+{
+    struct iovec iov[WRITEPIPE_NBUFS];
+    off_t   offset, end;
+    int     fd, dfd, i, s, n, err;
+
+    pthread_mutex_lock(&wp.lock);
+    for (;;) {
+        while (wp.queued == 0)
+            pthread_cond_wait(&wp.cond, &wp.lock);
+
+        /* Collect the run of adjacent writes at the head of the queue */
+        s = wp.head;
+        fd = wp.fd[s];
+        dfd = wp.dfd[s];
+        offset = wp.offset[s];
+        end = offset;
+        for (n = 0; n < wp.queued && n < IOV_MAX; n++) {
+            i = (s + n) % WRITEPIPE_NBUFS;
+            if (wp.fd[i] != fd || wp.dfd[i] != dfd || wp.offset[i] != end)
+                break;
+            iov[n].iov_base = WP_DATA(i);
+            iov[n].iov_len = wp.len[i];
+            end += wp.len[i];
+        }
+        pthread_mutex_unlock(&wp.lock);
+
+        if (dfd >= 0)
+            err = wp_write_direct(fd, dfd, iov, n, offset);
+        else
+            err = wp_write(fd, iov, n, offset);
+
+        pthread_mutex_lock(&wp.lock);
+        if (err) {
+            LOG(log_error, logtype_afpd, "writepipe: write(fd: %d, off: %jd): %s",
+                fd, (intmax_t)offset, strerror(err));
+            for (i = 0; i < n; i++)
+                wp_seterror(wp.tag[(s + i) % WRITEPIPE_NBUFS], err);
+        }
+        wp.head = (s + n) % WRITEPIPE_NBUFS;
+        wp.queued -= n;
+        pthread_cond_broadcast(&wp.cond);
+    }
+
+    return NULL;
+}
+
+static int wp_init(size_t bufsize)
+{
+    sigset_t sigs, oldsigs;
+    pthread_t thread;
+    void *buf;
+    int i, ret;
+
+    if (bufsize > wp.bufsize) {
+        /* the buffers are only ever reallocated with an empty queue */
+        for (i = 0; i < WRITEPIPE_NBUFS; i++) {
+            if (posix_memalign(&buf, WRITEPIPE_DIRECT, bufsize + WRITEPIPE_DIRECT) != 0)
+                return -1;
+            free(wp.buf[i]);
+            wp.buf[i] = buf;
+        }
+        wp.bufsize = bufsize;
+    }
+
+    if (wp.started)
+        return 0;
+
+    /* The helper must not receive any of our signals */
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+    ret = pthread_create(&thread, NULL, wp_helper, NULL);
+    pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+    if (ret != 0) {
+        LOG(log_error, logtype_afpd, "writepipe: pthread_create: %s", strerror(ret));
+        return -1;
+    }
+    pthread_detach(thread);
+    wp.started = 1;
+
+    LOG(log_debug, logtype_afpd, "writepipe: started helper thread");
+    return 0;
+}
+
+/********************************************************
+ * Interface
+ ********************************************************/
+
+/*!
+ * @brief Get the next free buffer, waits for one if all are queued
+ *
+ * @param bufsize (r) size of the buffers
+ * @param offset  (r) file offset the data in the buffer is going to be written at
+ * @param space   (w) number of bytes to put into the buffer
+ *
+ * @returns buffer, NULL if the pipeline isn't available
+ */
+char *writepipe_buf(size_t bufsize, off_t offset, size_t *space)
+{
+    size_t tail;
+    char *buf;
+
+    if (bufsize > wp.bufsize)
+        writepipe_sync();
+    if (wp_init(bufsize) != 0)
+        return NULL;
+
+    pthread_mutex_lock(&wp.lock);
+    while (wp.queued == WRITEPIPE_NBUFS)
+        pthread_cond_wait(&wp.cond, &wp.lock);
+    buf = wp.buf[(wp.head + wp.queued) % WRITEPIPE_NBUFS] + offset % WRITEPIPE_DIRECT;
+    pthread_mutex_unlock(&wp.lock);
+
+    /* let the buffer end at an aligned offset, so the following ones are aligned */
+    *space = bufsize;
+    tail = (offset + bufsize) % WRITEPIPE_ALIGN;
+    if (tail < bufsize)
+        *space -= tail;
+
+    return buf;
+}
+
+/*!
+ * @brief Queue the buffer returned by writepipe_buf()
+ *
+ * @param fd      (r) fd to write to, must stay open until writepipe_sync()
+ * @param dfd     (r) O_DIRECT fd of the same file or -1, must stay open until writepipe_sync()
+ * @param offset  (r) offset to write at, as passed to writepipe_buf()
+ * @param len     (r) number of bytes in the buffer
+ * @param tag     (r) reported by writepipe_error() if the write fails
+ */
+void writepipe_submit(int fd, int dfd, off_t offset, size_t len, int tag)
+{
+    int s;
+
+    pthread_mutex_lock(&wp.lock);
+    s = (wp.head + wp.queued) % WRITEPIPE_NBUFS;
+    wp.fd[s] = fd;
+    wp.dfd[s] = dfd;
+    wp.offset[s] = offset;
+    wp.len[s] = len;
+    wp.tag[s] = tag;
+    wp.queued++;
+    pthread_cond_broadcast(&wp.cond);
+    pthread_mutex_unlock(&wp.lock);
+}
+
+/*!
+ * @brief Wait until all queued writes are done
+ */
+void writepipe_sync(void)
+{
+    if (!wp.started)
+        return;
+
+    pthread_mutex_lock(&wp.lock);
+    while (wp.queued > 0)
+        pthread_cond_wait(&wp.cond, &wp.lock);
+    pthread_mutex_unlock(&wp.lock);
+}
+
+/*!
+ * @brief Get an error of a completed write
+ *
+ * @param tag   (w) tag of the failed write
+ *
+ * @returns errno of the write, 0 if there are no more errors
+ */
+int writepipe_error(int *tag)
+{
+    int err = 0;
+
+    if (!wp.started)
+        return 0;
+
+    pthread_mutex_lock(&wp.lock);
+    if (wp.nerr > 0) {
+        wp.nerr--;
+        *tag = wp.errtag[wp.nerr];
+        err = wp.err[wp.nerr];
+    }
+    pthread_mutex_unlock(&wp.lock);
+
+    return err;
+}
+
+/*!
+ * @brief End of the queued writes for fd
+ *
+ * @returns highest offset queued writes for fd extend to, -1 if there are none
+ */
+off_t writepipe_end(int fd)
+{
+    off_t end = -1;
+    int i, s;
+
+    if (!wp.started)
+        return -1;
+
+    pthread_mutex_lock(&wp.lock);
+    for (i = 0; i < wp.queued; i++) {
+        s = (wp.head + i) % WRITEPIPE_NBUFS;
+        if (wp.fd[s] == fd && wp.offset[s] + (off_t)wp.len[s] > end)
+            end = wp.offset[s] + wp.len[s];
+    }
+    pthread_mutex_unlock(&wp.lock);
+
+    return end;
+}
@@ -0,0 +1,31 @@
+/*
+   Copyright (c) 2026 Netatalk Team
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+ */
+
+#ifndef AFPD_FORK_WRITEPIPE_H
+#define AFPD_FORK_WRITEPIPE_H
+
+#include <sys/types.h>
+
+#define WRITEPIPE_NBUFS  4              /* number of buffers */
+#define WRITEPIPE_ALIGN  (64 * 1024)    /* buffers after the first end at multiples of this */
+#define WRITEPIPE_NERR   16             /* max number of pending errors */
+#define WRITEPIPE_DIRECT 4096           /* alignment for O_DIRECT writes */
+
+extern char  *writepipe_buf(size_t bufsize, off_t offset, size_t *space);
+extern void  writepipe_submit(int fd, int dfd, off_t offset, size_t len, int tag);
+extern void  writepipe_sync(void);
+extern int   writepipe_error(int *tag);
+extern off_t writepipe_end(int fd);
+
+#endif /* AFPD_FORK_WRITEPIPE_H */
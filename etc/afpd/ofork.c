@@ -80,6 +80,92 @@ int of_flush(const struct vol *vol)
     return( 0 );
 }
 
+/*!
+ * @brief Whether the file of ofork has been written since the last sync
+ *
+ * Looks at all forks of the file, they may share the adouble.
+ *
+ * @param ofork   (r) fork
+ * @param forks   (r) AFPFORK_DATA and/or AFPFORK_RSRC, forks to look at
+ */
+int of_unsynced(const struct ofork *ofork, int forks)
+{
+    struct ofork *of;
+
+    for (of = ofork_table[hashfn(&ofork->key)]; of; of = of->next) {
+        if (of->of_ad == ofork->of_ad
+            && (of->of_flags & forks)
+            && (of->of_flags & AFPFORK_UNSYNCED))
+            return 1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief Mark forks of the file of ofork synced
+ *
+ * @param ofork   (r) fork
+ * @param forks   (r) AFPFORK_DATA and/or AFPFORK_RSRC, forks that have been synced
+ */
+void of_synced(const struct ofork *ofork, int forks)
+{
+    struct ofork *of;
+
+    for (of = ofork_table[hashfn(&ofork->key)]; of; of = of->next) {
+        if (of->of_ad == ofork->of_ad && (of->of_flags & forks))
+            of->of_flags &= ~AFPFORK_UNSYNCED;
+    }
+}
+
+/*!
+ * @brief Sync the whole filesystem of ofork if many forks on it need a sync
+ *
+ * One syncfs() is cheaper than a storm of fsync()s of the forks that have
+ * been written, e.g. by a backup. How many it takes is the "sync batch"
+ * option.
+ *
+ * @param ofork   (r) fork
+ * @param fd      (r) any fd on the filesystem
+ *
+ * @returns 0 if the filesystem has been synced, -1 otherwise
+ */
+int of_syncfs(const struct ofork *ofork, int fd)
+{
+#ifdef HAVE_SYNCFS
+    struct ofork *of;
+    int i, count = 0;
+    int batch = ofork->of_vol->v_obj->options.sync_batch;
+
+    if (batch <= 0)
+        return -1;
+
+    for (i = 0; i < OFORK_HASHSIZE; i++) {
+        for (of = ofork_table[i]; of; of = of->next) {
+            if (of->key.dev == ofork->key.dev && (of->of_flags & AFPFORK_UNSYNCED))
+                count++;
+        }
+    }
+    if (count < batch)
+        return -1;
+
+    if (syncfs(fd) != 0) {
+        LOG(log_error, logtype_afpd, "of_syncfs: %s", strerror(errno));
+        return -1;
+    }
+    LOG(log_debug, logtype_afpd, "of_syncfs: synced %d forks", count);
+
+    for (i = 0; i < OFORK_HASHSIZE; i++) {
+        for (of = ofork_table[i]; of; of = of->next) {
+            if (of->key.dev == ofork->key.dev)
+                of->of_flags &= ~AFPFORK_UNSYNCED;
+        }
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 int of_rename(const struct vol *vol,
               struct ofork *s_of,
               struct dir *olddir, const char *oldpath _U_,
@@ -216,6 +302,11 @@ of_alloc(struct vol *vol,
         of->of_flags = AFPFORK_DATA;
     else
         of->of_flags = AFPFORK_RSRC;
+    of->of_ra_start = of->of_ra_next = of->of_ra_end = of->of_ra_drop = 0;
+    of->of_ra_window = 0;
+    of->of_write_err = AFP_OK;
+    of->of_pa_next = of->of_pa_end = of->of_pa_window = 0;
+    of->of_xfer = 0;
 
     of_hash(of);
     return( of );
@@ -385,15 +476,33 @@ void of_dealloc(struct ofork *of)
     free( of );
 }
 
+/* Is the data fork of the file also open in another fork, ours or another afpd's? */
+static int of_data_shared(const struct ofork *ofork)
+{
+    struct ofork *of;
+
+    for (of = ofork_table[hashfn(&ofork->key)]; of; of = of->next) {
+        if (of != ofork && of->key.dev == ofork->key.dev && of->key.inode == ofork->key.inode
+            && (of->of_flags & AFPFORK_DATA))
+            return 1;
+    }
+
+    return (ad_openforks(ofork->of_ad, ATTRBIT_ROPEN) & ATTRBIT_DOPEN) != 0;
+}
+
 /* --------------------------- */
 int of_closefork(const AFPObj *obj, struct ofork *ofork)
 {
+    struct stat         st;
     struct timeval      tv;
     int         adflags = 0;
     int                 ret;
     struct dir *dir;
     bstring forkpath = NULL;
 
+    /* the fd may have write-behind writes queued */
+    fork_write_sync();
+
     adflags = 0;
     if (ofork->of_flags & AFPFORK_DATA)
         adflags |= ADFLAGS_DF;
@@ -425,6 +534,17 @@ int of_closefork(const AFPObj *obj, struct ofork *ofork)
 
     ad_unlock(ofork->of_ad, ofork->of_refnum, ofork->of_flags & AFPFORK_ERROR ? 0 : 1);
 
+    /*
+     * Release space preallocated beyond the end of the data fork. Another fork
+     * may be appending to the file and have just moved its end, so only do this
+     * when we're the last one with the data fork open. This has to come after
+     * ad_unlock(), ad_openforks() also sees the open mode locks of this fork.
+     */
+    if (ofork->of_pa_end > 0 && ad_data_fileno(ofork->of_ad) >= 0
+        && !of_data_shared(ofork)
+        && fstat(ad_data_fileno(ofork->of_ad), &st) == 0 && st.st_size < ofork->of_pa_end)
+        (void)ftruncate(ad_data_fileno(ofork->of_ad), st.st_size);
+
 #ifdef HAVE_FSHARE_T
     if (obj->options.flags & OPTION_SHARE_RESERV) {
         fshare_t shmd;
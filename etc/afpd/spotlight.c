@@ -27,6 +27,8 @@
 #include <inttypes.h>
 #include <time.h>
 #include <utime.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <atalk/list.h>
 #include <atalk/errchk.h>
@@ -40,11 +42,20 @@
 #include <atalk/spotlight.h>
 
 #include "directory.h"
+
+#ifdef HAVE_TRACKER
 #include "etc/spotlight/sparql_parser.h"
 
 #include <glib.h>
+#endif
+
+#define SL_BATCH_GROW_INTERVAL 1   /* seconds, see sl_adapt_batch() */
 
-#define MAX_SL_RESULTS 20
+/*
+ * Everything allocated while handling an RPC comes from a memory pool that is
+ * freed in one go afterwards. That's enough for large fetchAttributes replies.
+ */
+#define SL_RPC_POOL_SIZE (128 * 1024)
 
 struct slq_state_names {
     slq_state_t state;
@@ -63,8 +74,6 @@ static struct slq_state_names slq_state_names[] = {
 };
 
 
-static char *tracker_to_unix_path(TALLOC_CTX *mem_ctx, const char *uri);
-static int cnid_comp_fn(const void *p1, const void *p2);
 static bool create_result_handle(slq_t *slq);
 static bool add_filemeta(sl_array_t *reqinfo,
                          sl_array_t *fm_array,
@@ -111,9 +120,9 @@ static char *dd_dump(DALLOC_CTX *dd, int nestinglevel)
                                 "%s%s(#%lu): {\n",
                                 tab_string1,
                                 talloc_get_name(dd),
-                                talloc_array_length(dd->dd_talloc_array));
+                                dalloc_size(dd));
 
-    for (n = 0; n < talloc_array_length(dd->dd_talloc_array); n++) {
+    for (n = 0; n < dalloc_size(dd); n++) {
         type = talloc_get_name(dd->dd_talloc_array[n]);
         if (strequal(type, "DALLOC_CTX")
             || strequal(type, "sl_array_t")
@@ -233,32 +242,24 @@ static char *dd_dump(DALLOC_CTX *dd, int nestinglevel)
     return logstring;
 }
 
-static int cnid_comp_fn(const void *p1, const void *p2)
-{
-    const uint64_t *cnid1 = p1, *cnid2 = p2;
-    if (*cnid1 == *cnid2) {
-        return 0;
-    }
-    if (*cnid1 < *cnid2) {
-        return -1;
-    }
-    return 1;
-}
-
-static int sl_createCNIDArray(slq_t *slq, const DALLOC_CTX *p)
+static int sl_createCNIDSet(slq_t *slq, const DALLOC_CTX *p)
 {
     EC_INIT;
-    uint64_t *cnids = NULL;
+    struct sl_cnidset *cnids = NULL;
+    uint64_t uint64var;
 
-    EC_NULL( cnids = talloc_array(slq, uint64_t, talloc_array_length(p)) );
+    EC_NULL( cnids = sl_cnidset_new(slq) );
 
-    for (int i = 0; i < talloc_array_length(p); i++) {
-        memcpy(&cnids[i], p->dd_talloc_array[i], sizeof(uint64_t));
+    for (int i = 0; i < dalloc_size(p); i++) {
+        memcpy(&uint64var, p->dd_talloc_array[i], sizeof(uint64_t));
+        if (uint64var == CNID_INVALID || uint64var > UINT32_MAX) {
+            continue;
+        }
+        EC_ZERO( sl_cnidset_add(cnids, uint64var) );
     }
-    qsort(cnids, talloc_array_length(p), sizeof(uint64_t), cnid_comp_fn);
 
+    LOG(log_debug, logtype_sl, "query restricted to %zu CNIDs", sl_cnidset_count(cnids));
     slq->slq_cnids = cnids;
-    slq->slq_cnids_num = talloc_array_length(p);
 
 EC_CLEANUP:
     if (ret != 0) {
@@ -268,6 +269,7 @@ EC_CLEANUP:
     EC_EXIT;
 }
 
+#ifdef HAVE_TRACKER
 static char *tracker_to_unix_path(TALLOC_CTX *mem_ctx, const char *uri)
 {
     GFile *f;
@@ -291,6 +293,7 @@ static char *tracker_to_unix_path(TALLOC_CTX *mem_ctx, const char *uri)
 
     return talloc_path;
 }
+#endif
 
 /**
  * Add requested metadata for a query result element
@@ -312,7 +315,7 @@ static bool add_filemeta(sl_array_t *reqinfo,
     sl_time_t sl_time;
     char *p, *name;
 
-    metacount = talloc_array_length(reqinfo->dd_talloc_array);
+    metacount = dalloc_size(reqinfo);
     if (metacount == 0 || path == NULL || sp == NULL) {
         dalloc_add_copy(fm_array, &nil, sl_nil_t);
         return true;
@@ -399,9 +402,16 @@ static bool create_result_handle(slq_t *slq)
     return true;
 }
 
+/**
+ * Add the next batch of results to the reply to a fetch
+ *
+ * That's the prefetched batch, if there is one, otherwise whatever has been
+ * found so far.
+ **/
 static bool add_results(sl_array_t *array, slq_t *slq)
 {
     sl_filemeta_t *fm;
+    struct sl_rslts *results;
     uint64_t status;
 
     /* FileMeta */
@@ -423,15 +433,21 @@ static bool add_results(sl_array_t *array, slq_t *slq)
         break;
     }
 
+    results = slq->slq_ready ? slq->slq_ready : slq->query_results;
+
     dalloc_add_copy(array, &status, uint64_t);
-    dalloc_add(array, slq->query_results->cnids, sl_cnids_t);
-    if (slq->query_results->num_results > 0) {
-        dalloc_add(fm, slq->query_results->fm_array, sl_array_t);
+    dalloc_add(array, results->cnids, sl_cnids_t);
+    if (results->num_results > 0) {
+        dalloc_add(fm, results->fm_array, sl_array_t);
     }
     dalloc_add(array, fm, sl_filemeta_t);
 
     /* This ensure the results get clean up after been sent to the client */
-    talloc_steal(array, slq->query_results);
+    talloc_steal(array, results);
+    if (slq->slq_ready) {
+        slq->slq_ready = NULL;
+        return true;
+    }
     slq->query_results = NULL;
 
     if (!create_result_handle(slq)) {
@@ -443,6 +459,306 @@ static bool add_results(sl_array_t *array, slq_t *slq)
     return true;
 }
 
+/**
+ * Add a search result to the result handle of a query
+ *
+ * Results the user can't read are skipped. Results that are not in the CNID
+ * set the client passed with the query must have been dropped by the backend.
+ *
+ * @param slq   (rw) query handle
+ * @param id    (r)  CNID of the result in network byte order
+ * @param path  (r)  path of the result
+ * @param sp    (r)  stat of path
+ *
+ * @returns true on success or if the result was skipped, false on error
+ **/
+bool sl_add_result(slq_t *slq, cnid_t id, const char *path, const struct stat *sp)
+{
+    uint64_t uint64var;
+
+    /* The cache is shared by all users, so it gets results before the access check */
+    sl_cache_add(slq, id);
+
+    if (access(path, R_OK) != 0) {
+        return true;
+    }
+
+    uint64var = ntohl(id);
+
+    dalloc_add_copy(slq->query_results->cnids->ca_cnids,
+                    &uint64var, uint64_t);
+    if (!add_filemeta(slq->slq_reqinfo, slq->query_results->fm_array,
+                      path, sp)) {
+        LOG(log_error, logtype_sl, "add_filemeta error");
+        return false;
+    }
+
+    slq->query_results->num_results++;
+    slq->query_results->num_bytes += 32 + (16 + strlen(path))
+        * dalloc_size(slq->slq_reqinfo);
+    return true;
+}
+
+/**
+ * Whether the current batch of results is complete
+ *
+ * Batches are limited in the number of results, which grows as the client
+ * keeps fetching full batches, and in their size, as a batch must fit into a
+ * single AFP reply.
+ **/
+bool sl_results_full(const slq_t *slq)
+{
+    return slq->query_results->num_results >= slq->slq_batch
+        || slq->query_results->num_bytes >= SL_MAX_BATCH_BYTES;
+}
+
+/**
+ * Set a complete batch of results aside and start with the next one
+ *
+ * @returns true if the backend may go on searching, false if there's already
+ *          a batch waiting for the client
+ **/
+bool sl_results_prefetch(slq_t *slq)
+{
+    if (slq->slq_ready) {
+        return false;
+    }
+
+    slq->slq_ready = slq->query_results;
+    slq->query_results = NULL;
+
+    if (!create_result_handle(slq)) {
+        LOG(log_error, logtype_sl, "couldn't add result handle");
+        slq->query_results = slq->slq_ready;
+        slq->slq_ready = NULL;
+        return false;
+    }
+
+    LOG(log_debug, logtype_sl,
+        "ctx1: %" PRIx64 ", ctx2: %" PRIx64 ": prefetching next batch",
+        slq->slq_ctx1, slq->slq_ctx2);
+    return true;
+}
+
+/*
+ * Resolving result paths to CNIDs
+ *
+ * cnid_for_path() resolves a path component by component, so every result
+ * costs a CNID database request for each of its parent directories. Results
+ * tend to come in clusters, so we remember the CNIDs of the directories we've
+ * resolved for a query in a trie of path components and only need one request
+ * for the result itself. The paths of a batch are sorted first, so results in
+ * the same directory are resolved one after the other and their directory is
+ * at the front of its parents list of children.
+ */
+struct sl_dirnode {
+    struct sl_dirnode *dn_next;     /* next sibling */
+    struct sl_dirnode *dn_child;    /* first child */
+    cnid_t             dn_cnid;     /* CNID_INVALID if it couldn't be resolved */
+    char              *dn_name;
+};
+
+/**
+ * Find or resolve a subdirectory
+ *
+ * @param slq     (rw) query handle
+ * @param parent  (rw) parent directory
+ * @param path    (r)  absolute path of the subdirectory
+ * @param name    (r)  name of the subdirectory, the last component of path
+ *
+ * @returns the node of the subdirectory, NULL on error
+ **/
+static struct sl_dirnode *sl_dirnode_get(slq_t *slq,
+                                         struct sl_dirnode *parent,
+                                         const char *path,
+                                         const char *name)
+{
+    struct sl_dirnode **pp, *dn;
+    struct stat st;
+
+    for (pp = &parent->dn_child; (dn = *pp) != NULL; pp = &dn->dn_next) {
+        if (strcmp(dn->dn_name, name) == 0) {
+            /* Move to front */
+            *pp = dn->dn_next;
+            dn->dn_next = parent->dn_child;
+            parent->dn_child = dn;
+            return dn;
+        }
+    }
+
+    if ((dn = talloc_zero(slq->slq_dirtree, struct sl_dirnode)) == NULL) {
+        return NULL;
+    }
+    if ((dn->dn_name = talloc_strdup(dn, name)) == NULL) {
+        talloc_free(dn);
+        return NULL;
+    }
+
+    dn->dn_cnid = CNID_INVALID;
+    if (parent->dn_cnid != CNID_INVALID
+        && lstat(path, &st) == 0
+        && S_ISDIR(st.st_mode)) {
+        dn->dn_cnid = cnid_add(slq->slq_vol->v_cdb, &st, parent->dn_cnid,
+                               name, strlen(name), 0);
+    }
+    if (dn->dn_cnid == CNID_INVALID) {
+        LOG(log_debug, logtype_sl, "can't resolve directory: %s", path);
+    }
+
+    dn->dn_next = parent->dn_child;
+    parent->dn_child = dn;
+    return dn;
+}
+
+/**
+ * Resolve the CNID of a result path and add it to the results
+ *
+ * Results that are not inside the volume or can't be resolved are skipped.
+ * If the query is restricted to a set of CNIDs, the results must already have
+ * a CNID, which we look up before doing anything else with the result.
+ *
+ * @returns 0 on success or if the result was skipped, -1 on error
+ **/
+static int sl_resolve_result(slq_t *slq, const char *path)
+{
+    const char *volpath = slq->slq_vol->v_path;
+    char buf[MAXPATHLEN + 1];
+    char *name, *slash;
+    struct sl_dirnode *dn;
+    struct stat lst, st;
+    size_t len;
+    cnid_t id = CNID_INVALID;
+
+    len = strlen(volpath);
+    while (len > 0 && volpath[len - 1] == '/') {
+        len--;
+    }
+    if (strncmp(path, volpath, len) != 0 || path[len] != '/') {
+        LOG(log_debug, logtype_sl, "result not in volume: %s", path);
+        return 0;
+    }
+    if (strlcpy(buf, path, sizeof(buf)) >= sizeof(buf)) {
+        return 0;
+    }
+
+    dn = slq->slq_dirtree;
+    name = buf + len + 1;
+    while ((slash = strchr(name, '/')) != NULL) {
+        *slash = 0;
+        dn = sl_dirnode_get(slq, dn, buf, name);
+        *slash = '/';
+        if (dn == NULL) {
+            return -1;
+        }
+        if (dn->dn_cnid == CNID_INVALID) {
+            return 0;
+        }
+        name = slash + 1;
+    }
+    if (*name == 0) {
+        return 0;
+    }
+
+    if (slq->slq_cnids) {
+        id = cnid_get(slq->slq_vol->v_cdb, dn->dn_cnid, name, strlen(name));
+        if (id == CNID_INVALID || !sl_cnidset_contains(slq->slq_cnids, ntohl(id))) {
+            return 0;
+        }
+    }
+
+    if (lstat(path, &lst) != 0) {
+        return 0;
+    }
+    st = lst;
+    if (S_ISLNK(lst.st_mode) && stat(path, &st) != 0) {
+        return 0;
+    }
+
+    if (slq->slq_cnids == NULL) {
+        id = cnid_add(slq->slq_vol->v_cdb, &lst, dn->dn_cnid, name, strlen(name), 0);
+        if (id == CNID_INVALID) {
+            LOG(log_error, logtype_sl, "cnid_add error: %s", path);
+            return 0;
+        }
+    }
+
+    return sl_add_result(slq, id, path, &st) ? 0 : -1;
+}
+
+static int sl_path_comp_fn(const void *p1, const void *p2)
+{
+    return strcmp(*(char * const *)p1, *(char * const *)p2);
+}
+
+/**
+ * Queue the path of a search result, see sl_flush_results()
+ *
+ * @returns true on success, false on error
+ **/
+bool sl_queue_result(slq_t *slq, const char *path)
+{
+    char **pending;
+    size_t size;
+
+    if (slq->slq_pending == NULL) {
+        slq->slq_pending = talloc_array(slq, char *, MAX_SL_RESULTS);
+        if (slq->slq_pending == NULL) {
+            return false;
+        }
+    }
+
+    size = talloc_array_length(slq->slq_pending);
+    if (slq->slq_pending_num == size) {
+        pending = talloc_realloc(slq, slq->slq_pending, char *, 2 * size);
+        if (pending == NULL) {
+            return false;
+        }
+        slq->slq_pending = pending;
+    }
+
+    slq->slq_pending[slq->slq_pending_num] = talloc_strdup(slq->slq_pending, path);
+    if (slq->slq_pending[slq->slq_pending_num] == NULL) {
+        return false;
+    }
+    slq->slq_pending_num++;
+    return true;
+}
+
+/**
+ * Resolve the CNIDs of all queued result paths and add them to the results
+ *
+ * @returns true on success, false on error
+ **/
+bool sl_flush_results(slq_t *slq)
+{
+    bool ok = true;
+    int i;
+
+    if (slq->slq_pending_num == 0) {
+        return true;
+    }
+
+    if (slq->slq_dirtree == NULL) {
+        slq->slq_dirtree = talloc_zero(slq, struct sl_dirnode);
+        if (slq->slq_dirtree == NULL) {
+            return false;
+        }
+        slq->slq_dirtree->dn_cnid = DIRDID_ROOT;
+    }
+
+    qsort(slq->slq_pending, slq->slq_pending_num, sizeof(char *), sl_path_comp_fn);
+
+    for (i = 0; i < slq->slq_pending_num; i++) {
+        if (ok && sl_resolve_result(slq, slq->slq_pending[i]) != 0) {
+            ok = false;
+        }
+        TALLOC_FREE(slq->slq_pending[i]);
+    }
+    slq->slq_pending_num = 0;
+
+    return ok;
+}
+
 /******************************************************************************
  * Spotlight queries
  ******************************************************************************/
@@ -521,6 +837,9 @@ static void slq_cancel(slq_t *slq)
     slq->slq_state = SLQ_STATE_CANCEL_PENDING;
     slq_remove(slq);
     slq_cancelled_add(slq);
+    if (slq->slq_backend->sb_cancel) {
+        slq->slq_backend->sb_cancel(slq);
+    }
 }
 
 /**
@@ -528,8 +847,8 @@ static void slq_cancel(slq_t *slq)
  **/
 static int slq_free_cb(slq_t *slq)
 {
-    if (slq->tracker_cursor) {
-        g_object_unref(slq->tracker_cursor);
+    if (slq->slq_backend->sb_free) {
+        slq->slq_backend->sb_free(slq);
     }
     return 0;
 }
@@ -578,9 +897,12 @@ static void slq_dump(void)
 }
 
 /************************************************
- * Tracker async callbacks
+ * Tracker backend
  ************************************************/
 
+#ifdef HAVE_TRACKER
+
+
 static void tracker_con_cb(GObject      *object,
                            GAsyncResult *res,
                            gpointer      user_data)
@@ -610,11 +932,7 @@ static void tracker_cursor_cb(GObject      *object,
     gboolean more_results;
     const gchar *uri;
     char *path;
-    int result;
-    struct stat sb;
-    uint64_t uint64var;
     bool ok;
-    cnid_t did, id;
 
     LOG(log_debug, logtype_sl,
         "cursor cb[%d]: ctx1: %" PRIx64 ", ctx2: %" PRIx64,
@@ -641,6 +959,10 @@ static void tracker_cursor_cb(GObject      *object,
 
     if (!more_results) {
         LOG(log_debug, logtype_sl, "tracker_cursor_cb: done");
+        if (!sl_flush_results(slq)) {
+            slq->slq_state = SLQ_STATE_ERROR;
+            return;
+        }
         slq->slq_state = SLQ_STATE_DONE;
         return;
     }
@@ -658,47 +980,36 @@ static void tracker_cursor_cb(GObject      *object,
 
     LOG(log_debug, logtype_sl, "URI: %s", uri);
 
-    path = tracker_to_unix_path(slq->query_results, uri);
+    path = tracker_to_unix_path(slq, uri);
     if (path == NULL) {
         LOG(log_error, logtype_sl, "error converting Tracker URI: %s", uri);
         slq->slq_state = SLQ_STATE_ERROR;
         return;
     }
 
-    result = access(path, R_OK);
-    if (result != 0) {
-        goto exit;
-    }
-
-    id = cnid_for_path(slq->slq_vol->v_cdb, slq->slq_vol->v_path, path, &did);
-    if (id == CNID_INVALID) {
-        LOG(log_error, logtype_sl, "cnid_for_path error: %s", path);
-        goto exit;
-    }
-    uint64var = ntohl(id);
-
-    if (slq->slq_cnids) {
-        ok = bsearch(&uint64var, slq->slq_cnids, slq->slq_cnids_num,
-                     sizeof(uint64_t), cnid_comp_fn);
-        if (!ok) {
-            goto exit;
-        }
-    }
-
-    dalloc_add_copy(slq->query_results->cnids->ca_cnids,
-                    &uint64var, uint64_t);
-    ok = add_filemeta(slq->slq_reqinfo, slq->query_results->fm_array,
-                      path, &sb);
+    ok = sl_queue_result(slq, path);
+    talloc_free(path);
     if (!ok) {
-        LOG(log_error, logtype_sl, "add_filemeta error");
         slq->slq_state = SLQ_STATE_ERROR;
         return;
     }
 
-    slq->query_results->num_results++;
+    /*
+     * Pull rows until we have enough for a batch of results, then resolve
+     * them together. Some may be skipped, in that case we keep going.
+     */
+    if (slq->query_results->num_results + slq->slq_pending_num >= slq->slq_batch) {
+        if (!sl_flush_results(slq)) {
+            slq->slq_state = SLQ_STATE_ERROR;
+            return;
+        }
+    }
 
-exit:
-    if (slq->query_results->num_results < MAX_SL_RESULTS) {
+    /*
+     * Once a batch is complete, go on with the next one while the client
+     * fetches it, but don't get further ahead than that.
+     */
+    if (!sl_results_full(slq) || sl_results_prefetch(slq)) {
         LOG(log_debug, logtype_sl,
             "cursor cb[%d]: ctx1: %" PRIx64 ", ctx2: %" PRIx64 ": requesting more results",
             slq->query_results->num_results - 1, slq->slq_ctx1, slq->slq_ctx2);
@@ -754,6 +1065,128 @@ static void tracker_query_cb(GObject      *object,
                                      slq);
 }
 
+static int tracker_init(AFPObj *obj)
+{
+    struct sl_ctx *sl_ctx = obj->sl_ctx;
+    const char *attributes;
+
+    attributes = atalk_iniparser_getstring(obj->iniconfig, INISEC_GLOBAL,
+                                           "spotlight attributes", NULL);
+    if (attributes) {
+        configure_spotlight_attributes(attributes);
+    }
+
+    /*
+     * Tracker uses glibs event dispatching, so we need a mainloop
+     */
+#if ((GLIB_MAJOR_VERSION <= 2) && (GLIB_MINOR_VERSION < 36))
+        g_type_init();
+#endif
+    sl_ctx->mainloop = g_main_loop_new(NULL, false);
+    sl_ctx->cancellable = g_cancellable_new();
+
+    setenv("DBUS_SESSION_BUS_ADDRESS", "unix:path=" _PATH_STATEDIR "spotlight.ipc", 1);
+    setenv("XDG_DATA_HOME", _PATH_STATEDIR, 0);
+    setenv("XDG_CACHE_HOME", _PATH_STATEDIR, 0);
+    setenv("TRACKER_USE_LOG_FILES", "1", 0);
+
+    tracker_sparql_connection_get_async(sl_ctx->cancellable,
+                                        tracker_con_cb, sl_ctx);
+    return 0;
+}
+
+/**
+ * Process finished glib events
+ **/
+static void tracker_dispatch(AFPObj *obj)
+{
+    bool event = true;
+
+    while (event) {
+        event = g_main_context_iteration(NULL, false);
+    }
+}
+
+static int tracker_open_query(slq_t *slq)
+{
+    EC_INIT;
+    gchar *scope;
+    gchar *sparql_query;
+
+    if (slq->slq_obj->sl_ctx->tracker_con == NULL) {
+        LOG(log_error, logtype_sl, "no tracker connection");
+        EC_FAIL;
+    }
+
+    /* Tracker URIs are escaped */
+    scope = g_uri_escape_string(slq->slq_scope,
+                                G_URI_RESERVED_CHARS_ALLOWED_IN_PATH, TRUE);
+    if (scope == NULL) {
+        LOG(log_error, logtype_sl, "failed to setup search scope");
+        EC_FAIL;
+    }
+    talloc_free(slq->slq_scope);
+    slq->slq_scope = talloc_strdup(slq, scope);
+    g_free(scope);
+    if (slq->slq_scope == NULL) {
+        LOG(log_error, logtype_sl, "talloc_strdup failed");
+        EC_FAIL;
+    }
+
+    ret = map_spotlight_to_sparql_query(slq, &sparql_query);
+    if (ret != 0) {
+        LOG(log_debug, logtype_sl, "mapping retured non-zero");
+        EC_FAIL;
+    }
+    LOG(log_debug, logtype_sl, "SPARQL query: \"%s\"", sparql_query);
+
+    tracker_sparql_connection_query_async(slq->slq_obj->sl_ctx->tracker_con,
+                                          sparql_query,
+                                          slq->slq_obj->sl_ctx->cancellable,
+                                          tracker_query_cb,
+                                          slq);
+    slq->slq_state = SLQ_STATE_RUNNING;
+
+EC_CLEANUP:
+    EC_EXIT;
+}
+
+static void tracker_fetch_more(slq_t *slq)
+{
+    if (slq->slq_state != SLQ_STATE_FULL) {
+        return;
+    }
+    if (sl_results_full(slq) && !sl_results_prefetch(slq)) {
+        return;
+    }
+
+    slq->slq_state = SLQ_STATE_RESULTS;
+
+    tracker_sparql_cursor_next_async(slq->tracker_cursor,
+                                     slq->slq_obj->sl_ctx->cancellable,
+                                     tracker_cursor_cb,
+                                     slq);
+}
+
+static void tracker_free(slq_t *slq)
+{
+    if (slq->tracker_cursor) {
+        g_object_unref(slq->tracker_cursor);
+    }
+}
+
+static const struct sl_backend sl_tracker_backend = {
+    .sb_name       = "tracker",
+    .sb_init       = tracker_init,
+    .sb_dispatch   = tracker_dispatch,
+    .sb_open_query = tracker_open_query,
+    .sb_fetch_more = tracker_fetch_more,
+    .sb_cancel     = NULL,
+    .sb_free       = tracker_free
+};
+
+#endif /* HAVE_TRACKER */
+
 /*******************************************************************************
  * Spotlight RPC functions
  ******************************************************************************/
@@ -812,6 +1245,36 @@ EC_CLEANUP:
     EC_EXIT;
 }
 
+/**
+ * Copy the array of requested attributes of a query
+ *
+ * The RPC request lives in the per RPC memory pool, moving parts of it over
+ * to a long-lived query would keep the whole pool around.
+ **/
+static sl_array_t *sl_copy_reqinfo(TALLOC_CTX *mem_ctx, const sl_array_t *reqinfo)
+{
+    sl_array_t *copy;
+    const char *attr;
+    char *s;
+    int i;
+
+    if ((copy = talloc_zero(mem_ctx, sl_array_t)) == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < dalloc_size(reqinfo); i++) {
+        /* Anything but a string can't be an attribute, it'll get a nil value */
+        attr = talloc_check_name(reqinfo->dd_talloc_array[i], "char *");
+        if ((s = dalloc_strdup(copy, attr ? attr : "")) == NULL
+            || dalloc_add(copy, s, char *) != 0) {
+            talloc_free(copy);
+            return NULL;
+        }
+    }
+
+    return copy;
+}
+
 static int sl_rpc_openQuery(AFPObj *obj,
                             const DALLOC_CTX *query,
                             DALLOC_CTX *reply,
@@ -827,19 +1290,11 @@ static int sl_rpc_openQuery(AFPObj *obj,
     char slq_host[MAXPATHLEN + 1];
     uint16_t convflags = v->v_mtou_flags;
     uint64_t result;
-    gchar *sparql_query;
-    GError *error = NULL;
     bool ok;
     sl_array_t *scope_array;
-    char *scope = NULL;
 
     array = talloc_zero(reply, sl_array_t);
 
-    if (obj->sl_ctx->tracker_con == NULL) {
-        LOG(log_error, logtype_sl, "no tracker connection");
-        EC_FAIL;
-    }
-
     /* Allocate and initialize query object */
     slq = talloc_zero(obj->sl_ctx, slq_t);
     slq->slq_state = SLQ_STATE_NEW;
@@ -847,6 +1302,8 @@ static int sl_rpc_openQuery(AFPObj *obj,
     slq->slq_vol = v;
     slq->slq_allow_expr = obj->options.flags & OPTION_SPOTLIGHT_EXPR ? true : false;
     slq->slq_result_limit = obj->options.sparql_limit;
+    slq->slq_batch = MAX_SL_RESULTS;
+    slq->slq_backend = obj->sl_ctx->sl_backend;
     talloc_set_destructor(slq, slq_free_cb);
 
     LOG(log_debug, logtype_sl, "Spotlight: expr: %s, limit: %" PRIu64,
@@ -890,25 +1347,18 @@ static int sl_rpc_openQuery(AFPObj *obj,
     if (reqinfo == NULL) {
         EC_FAIL;
     }
-    slq->slq_reqinfo = talloc_steal(slq, reqinfo);
+    slq->slq_reqinfo = sl_copy_reqinfo(slq, reqinfo);
+    if (slq->slq_reqinfo == NULL) {
+        EC_FAIL;
+    }
 
     scope_array = dalloc_value_for_key(query, "DALLOC_CTX", 0, "DALLOC_CTX", 1,
                                        "kMDScopeArray");
     if (scope_array == NULL) {
-        scope = g_uri_escape_string(v->v_path,
-                                    G_URI_RESERVED_CHARS_ALLOWED_IN_PATH, TRUE);
+        slq->slq_scope = talloc_strdup(slq, v->v_path);
     } else {
-        scope = g_uri_escape_string(scope_array->dd_talloc_array[0],
-                                    G_URI_RESERVED_CHARS_ALLOWED_IN_PATH, TRUE);
-    }
-
-    if (scope == NULL) {
-        LOG(log_error, logtype_sl, "failed to setup search scope");
-        EC_FAIL;
+        slq->slq_scope = talloc_strdup(slq, scope_array->dd_talloc_array[0]);
     }
-
-    slq->slq_scope = talloc_strdup(slq, scope);
-    g_free(scope);
     if (slq->slq_scope == NULL) {
         LOG(log_error, logtype_sl, "talloc_strdup failed");
         EC_FAIL;
@@ -920,30 +1370,9 @@ static int sl_rpc_openQuery(AFPObj *obj,
     cnids = dalloc_value_for_key(query, "DALLOC_CTX", 0, "DALLOC_CTX", 1,
                                  "kMDQueryItemArray");
     if (cnids) {
-        EC_ZERO_LOG( sl_createCNIDArray(slq, cnids->ca_cnids) );
-    }
-
-    ret = map_spotlight_to_sparql_query(slq, &sparql_query);
-    if (ret != 0) {
-        LOG(log_debug, logtype_sl, "mapping retured non-zero");
-        EC_FAIL;
-    }
-    LOG(log_debug, logtype_sl, "SPARQL query: \"%s\"", sparql_query);
-
-    tracker_sparql_connection_query_async(obj->sl_ctx->tracker_con,
-                                          sparql_query,
-                                          slq->slq_obj->sl_ctx->cancellable,
-                                          tracker_query_cb,
-                                          slq);
-    if (error) {
-        LOG(log_error, logtype_sl, "Couldn't query the Tracker Store: '%s'",
-            error->message);
-        g_clear_error(&error);
-        EC_FAIL;
+        EC_ZERO_LOG( sl_createCNIDSet(slq, cnids->ca_cnids) );
     }
 
-    slq->slq_state = SLQ_STATE_RUNNING;
-
     ok = create_result_handle(slq);
     if (!ok) {
         LOG(log_error, logtype_sl, "create_result_handle error");
@@ -951,6 +1380,10 @@ static int sl_rpc_openQuery(AFPObj *obj,
         EC_FAIL;
     }
 
+    if (!sl_cache_lookup(slq)) {
+        EC_ZERO( slq->slq_backend->sb_open_query(slq) );
+    }
+
     slq_add(slq);
 
 EC_CLEANUP:
@@ -967,6 +1400,32 @@ EC_CLEANUP:
     EC_EXIT;
 }
 
+/**
+ * Grow the batch size while the client keeps fetching full batches quickly
+ *
+ * Each fetch is a round trip, so a client that fetches a full batch every
+ * SL_BATCH_GROW_INTERVAL seconds or faster gets larger ones. The size is
+ * bounded by SL_MAX_BATCH and by the size of an AFP reply.
+ **/
+static void sl_adapt_batch(slq_t *slq)
+{
+    time_t now = time(NULL);
+    bool full;
+
+    full = slq->slq_ready != NULL || sl_results_full(slq);
+
+    if (full
+        && now - slq->slq_fetch_time <= SL_BATCH_GROW_INTERVAL
+        && slq->slq_batch < SL_MAX_BATCH) {
+        slq->slq_batch = MIN(2 * slq->slq_batch, SL_MAX_BATCH);
+        LOG(log_debug, logtype_sl,
+            "ctx1: %" PRIx64 ", ctx2: %" PRIx64 ": batch size %d",
+            slq->slq_ctx1, slq->slq_ctx2, slq->slq_batch);
+    }
+
+    slq->slq_fetch_time = now;
+}
+
 static int sl_rpc_fetchQueryResultsForContext(const AFPObj *obj,
                                               const DALLOC_CTX *query,
                                               DALLOC_CTX *reply,
@@ -1006,19 +1465,15 @@ static int sl_rpc_fetchQueryResultsForContext(const AFPObj *obj,
     case SLQ_STATE_RESULTS:
     case SLQ_STATE_FULL:
     case SLQ_STATE_DONE:
+        sl_adapt_batch(slq);
         ok = add_results(array, slq);
         if (!ok) {
             LOG(log_error, logtype_sl, "error adding results");
             EC_FAIL;
         }
-        if (slq->slq_state == SLQ_STATE_FULL) {
-            slq->slq_state = SLQ_STATE_RESULTS;
-
-            tracker_sparql_cursor_next_async(
-                slq->tracker_cursor,
-                slq->slq_obj->sl_ctx->cancellable,
-                tracker_cursor_cb,
-                slq);
+        slq->slq_backend->sb_fetch_more(slq);
+        if (slq->slq_state == SLQ_STATE_DONE) {
+            sl_cache_store(slq);
         }
         break;
 
@@ -1310,40 +1765,30 @@ EC_CLEANUP:
 int spotlight_init(AFPObj *obj)
 {
     static bool initialized = false;
-    const char *attributes;
     struct sl_ctx *sl_ctx;
 
     if (initialized) {
         return 0;
     }
 
-    LOG(log_info, logtype_sl, "Initializing Spotlight");
-
     sl_ctx = talloc_zero(NULL, struct sl_ctx);
     obj->sl_ctx = sl_ctx;
 
-    attributes = atalk_iniparser_getstring(obj->iniconfig, INISEC_GLOBAL,
-                                           "spotlight attributes", NULL);
-    if (attributes) {
-        configure_spotlight_attributes(attributes);
-    }
-
-    /*
-     * Tracker uses glibs event dispatching, so we need a mainloop
-     */
-#if ((GLIB_MAJOR_VERSION <= 2) && (GLIB_MINOR_VERSION < 36))
-        g_type_init();
+#ifdef HAVE_TRACKER
+    if (!(obj->options.flags & OPTION_SPOTLIGHT_NATIVE)) {
+        sl_ctx->sl_backend = &sl_tracker_backend;
+    } else
 #endif
-    sl_ctx->mainloop = g_main_loop_new(NULL, false);
-    sl_ctx->cancellable = g_cancellable_new();
+    {
+        sl_ctx->sl_backend = &sl_native_backend;
+    }
 
-    setenv("DBUS_SESSION_BUS_ADDRESS", "unix:path=" _PATH_STATEDIR "spotlight.ipc", 1);
-    setenv("XDG_DATA_HOME", _PATH_STATEDIR, 0);
-    setenv("XDG_CACHE_HOME", _PATH_STATEDIR, 0);
-    setenv("TRACKER_USE_LOG_FILES", "1", 0);
+    LOG(log_info, logtype_sl, "Initializing Spotlight, backend: %s",
+        sl_ctx->sl_backend->sb_name);
 
-    tracker_sparql_connection_get_async(sl_ctx->cancellable,
-                                        tracker_con_cb, sl_ctx);
+    if (sl_ctx->sl_backend->sb_init(obj) != 0) {
+        LOG(log_error, logtype_sl, "Initializing Spotlight backend failed");
+    }
 
     initialized = true;
     return 0;
@@ -1357,7 +1802,7 @@ int afp_spotlight_rpc(AFPObj *obj, char *ibuf, size_t ibuflen,
                       char *rbuf, size_t *rbuflen)
 {
     EC_INIT;
-    TALLOC_CTX *tmp_ctx = talloc_new(NULL);
+    TALLOC_CTX *tmp_ctx = talloc_pool(NULL, SL_RPC_POOL_SIZE);
     uint16_t vid;
     int cmd;
     struct vol      *vol;
@@ -1365,7 +1810,6 @@ int afp_spotlight_rpc(AFPObj *obj, char *ibuf, size_t ibuflen,
     DALLOC_CTX *reply;
     char *rpccmd;
     int len;
-    bool event;
 
     *rbuflen = 0;
 
@@ -1376,12 +1820,8 @@ int afp_spotlight_rpc(AFPObj *obj, char *ibuf, size_t ibuflen,
     spotlight_init(obj);
     slq_dump();
 
-    /*
-     * Process finished glib events
-     */
-    event = true;
-    while (event) {
-        event = g_main_context_iteration(NULL, false);
+    if (obj->sl_ctx->sl_backend->sb_dispatch) {
+        obj->sl_ctx->sl_backend->sb_dispatch(obj);
     }
     slq_cancelled_cleanup();
 
@@ -0,0 +1,479 @@
+/*
+  Copyright (c) 2026 Netatalk Team
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+*/
+
+/*
+ * Spotlight query cache
+ * =====================
+ *
+ * Finder repeats identical queries whenever a search window is reopened. The
+ * CNIDs of the results of finished queries are kept in a tdb in the state
+ * directory that all afpd processes share, keyed by volume, search backend,
+ * scope and the query string with whitespace normalized. A query that is
+ * found in the cache is answered from the stored CNIDs.
+ *
+ * Entries expire after "spotlight cache ttl" seconds. Besides, every file
+ * change event of a volume stores the current time as the volume's
+ * modification time and entries of queries that started no later than that
+ * are stale.
+ *
+ * The cache stores every match, whether the user that ran the query could
+ * read it or not, sl_add_result() checks access for the user the results are
+ * returned to. Queries restricted to a list of CNIDs are not cached.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <atalk/errchk.h>
+#include <atalk/util.h>
+#include <atalk/logger.h>
+#include <atalk/talloc.h>
+#include <atalk/tdb.h>
+#include <atalk/unix.h>
+#include <atalk/cnid.h>
+#include <atalk/bstrlib.h>
+#include <atalk/netatalk_conf.h>
+#include <atalk/volume.h>
+#include <atalk/spotlight.h>
+
+#include "directory.h"
+
+#define SL_CACHE_PATH        _PATH_STATEDIR "spotlight_cache.tdb"
+#define SL_CACHE_VERSION     1
+#define SL_CACHE_MAX_RESULTS 10000  /* larger result sets are not cached */
+#define SL_CACHE_PURGE       64     /* purge expired entries every that many stores */
+
+/* Cache entries, followed by sch_count CNIDs */
+struct sl_cache_hdr {
+    uint32_t sch_version;
+    uint32_t sch_count;
+    int64_t  sch_time;              /* when the query started */
+};
+
+/* A query answered from the cache */
+struct sl_cache_query {
+    cnid_t  *scq_cnids;
+    uint32_t scq_count;
+    uint32_t scq_idx;               /* next CNID to return */
+};
+
+static struct tdb_context *sl_cache_tdb;
+static bool sl_cache_failed;        /* don't try to open it over and over again */
+static time_t sl_cache_last_mod;    /* last modification time we've stored ... */
+static const struct vol *sl_cache_last_vol; /* ... and for which volume */
+static int sl_cache_stores;
+
+static bool sl_cache_open(const AFPObj *obj)
+{
+    if (sl_cache_tdb) {
+        return true;
+    }
+    if (sl_cache_failed || obj->options.sl_cache_ttl <= 0) {
+        return false;
+    }
+
+    /* We may have dropped privileges already, the cache is private to afpd */
+    become_root();
+    sl_cache_tdb = tdb_open(SL_CACHE_PATH, 0, TDB_CLEAR_IF_FIRST, O_RDWR | O_CREAT, 0600);
+    unbecome_root();
+
+    if (sl_cache_tdb == NULL) {
+        LOG(log_error, logtype_sl, "sl_cache_open(\"%s\"): %s", SL_CACHE_PATH, strerror(errno));
+        sl_cache_failed = true;
+        return false;
+    }
+    return true;
+}
+
+static TDB_DATA sl_cache_mod_key(const struct vol *vol)
+{
+    TDB_DATA key;
+
+    /* "mod", NUL, volume path, NUL */
+    key.dptr = (unsigned char *)talloc_asprintf(NULL, "mod%c%s", 0, vol->v_path);
+    key.dsize = key.dptr ? 4 + strlen(vol->v_path) + 1 : 0;
+    return key;
+}
+
+/* When the volume was last modified, 0 if never */
+static time_t sl_cache_mod_time(const struct vol *vol)
+{
+    TDB_DATA key, data;
+    int64_t t = 0;
+
+    key = sl_cache_mod_key(vol);
+    if (key.dptr == NULL) {
+        /* Treat everything as stale */
+        return time(NULL);
+    }
+
+    data = tdb_fetch(sl_cache_tdb, key);
+    if (data.dptr && data.dsize == sizeof(t)) {
+        memcpy(&t, data.dptr, sizeof(t));
+    }
+    free(data.dptr);
+    talloc_free(key.dptr);
+    return t;
+}
+
+/**
+ * Build the cache key of a query
+ *
+ * Volume path, backend, scope and query string separated by NULs. Runs of
+ * whitespace in the query string are collapsed, as they don't change its
+ * meaning.
+ *
+ * @returns the key as talloc blob on slq, NULL on error
+ **/
+static char *sl_cache_key(slq_t *slq)
+{
+    const char *q;
+    char *key, *p;
+    size_t len;
+
+    len = strlen(slq->slq_vol->v_path) + 1
+        + strlen(slq->slq_obj->sl_ctx->sl_backend->sb_name) + 1
+        + strlen(slq->slq_scope) + 1
+        + strlen(slq->slq_qstring) + 1;
+
+    if ((key = talloc_size(slq, len)) == NULL) {
+        return NULL;
+    }
+
+    p = key;
+    p += sprintf(p, "%s", slq->slq_vol->v_path) + 1;
+    p += sprintf(p, "%s", slq->slq_obj->sl_ctx->sl_backend->sb_name) + 1;
+    p += sprintf(p, "%s", slq->slq_scope) + 1;
+
+    for (q = slq->slq_qstring; *q == ' ' || *q == '\t'; q++)
+        ;
+    while (*q) {
+        if (*q == ' ' || *q == '\t') {
+            while (*q == ' ' || *q == '\t') {
+                q++;
+            }
+            if (*q) {
+                *p++ = ' ';
+            }
+            continue;
+        }
+        *p++ = *q++;
+    }
+    *p++ = 0;
+
+    return talloc_realloc_size(slq, key, p - key);
+}
+
+static int sl_cache_purge_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data, void *private_data)
+{
+    const time_t *oldest = private_data;
+    struct sl_cache_hdr hdr;
+
+    /* Leave the volume modification times alone */
+    if (key.dsize > 4 && memcmp(key.dptr, "mod", 4) == 0) {
+        return 0;
+    }
+
+    if (data.dsize < sizeof(hdr)) {
+        tdb_delete(tdb, key);
+        return 0;
+    }
+    memcpy(&hdr, data.dptr, sizeof(hdr));
+    if (hdr.sch_version != SL_CACHE_VERSION || hdr.sch_time < *oldest) {
+        tdb_delete(tdb, key);
+    }
+    return 0;
+}
+
+/******************************************************************************
+ * Answering queries from the cache
+ ******************************************************************************/
+
+static void sl_cache_fill(slq_t *slq)
+{
+    struct sl_cache_query *scq = slq->slq_backend_data;
+    const struct vol *vol = slq->slq_vol;
+    char buffer[12 + MAXPATHLEN + 1];
+    char path[MAXPATHLEN + 1];
+    const char *name;
+    struct dir *dir;
+    struct stat st;
+    cnid_t id, did;
+
+    slq->slq_state = SLQ_STATE_RESULTS;
+
+    while (!sl_results_full(slq)) {
+        if (scq->scq_idx == scq->scq_count) {
+            slq->slq_state = SLQ_STATE_DONE;
+            return;
+        }
+        id = did = scq->scq_cnids[scq->scq_idx++];
+
+        /* The file may have gone in the meantime */
+        if ((name = cnid_resolve(vol->v_cdb, &did, buffer, sizeof(buffer))) == NULL) {
+            continue;
+        }
+        if ((dir = dirlookup(vol, did)) == NULL) {
+            continue;
+        }
+        if (snprintf(path, sizeof(path), "%s/%s", bdata(dir->d_fullpath), name) >= sizeof(path)) {
+            continue;
+        }
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+        if (!sl_add_result(slq, id, path, &st)) {
+            slq->slq_state = SLQ_STATE_ERROR;
+            return;
+        }
+    }
+
+    slq->slq_state = SLQ_STATE_FULL;
+}
+
+static int sl_cache_open_query(slq_t *slq)
+{
+    /* Only used via sl_cache_lookup() */
+    return -1;
+}
+
+static void sl_cache_fetch_more(slq_t *slq)
+{
+    switch (slq->slq_state) {
+    case SLQ_STATE_RESULTS:
+    case SLQ_STATE_FULL:
+        sl_cache_fill(slq);
+        break;
+    default:
+        break;
+    }
+}
+
+static void sl_cache_cancel(slq_t *slq)
+{
+    slq->slq_state = SLQ_STATE_CANCELLED;
+}
+
+static const struct sl_backend sl_cache_backend = {
+    .sb_name       = "cache",
+    .sb_init       = NULL,
+    .sb_dispatch   = NULL,
+    .sb_open_query = sl_cache_open_query,
+    .sb_fetch_more = sl_cache_fetch_more,
+    .sb_cancel     = sl_cache_cancel,
+    .sb_free       = NULL
+};
+
+/******************************************************************************
+ * Interface
+ ******************************************************************************/
+
+/**
+ * Answer a new query from the cache, if possible
+ *
+ * On a hit the query is switched over to the cache and the first batch of
+ * results is ready. On a miss, the query is set up to record its results
+ * for sl_cache_store().
+ *
+ * @returns true on a cache hit
+ **/
+bool sl_cache_lookup(slq_t *slq)
+{
+    const AFPObj *obj = slq->slq_obj;
+    struct sl_cache_query *scq;
+    struct sl_cache_hdr hdr;
+    TDB_DATA key, data;
+    time_t now = time(NULL);
+    bool hit = false;
+
+    if (slq->slq_cnids || !sl_cache_open(obj)) {
+        return false;
+    }
+    if ((slq->slq_cache_key = sl_cache_key(slq)) == NULL) {
+        return false;
+    }
+
+    key.dptr = (unsigned char *)slq->slq_cache_key;
+    key.dsize = talloc_get_size(slq->slq_cache_key);
+
+    data = tdb_fetch(sl_cache_tdb, key);
+    if (data.dptr == NULL) {
+        goto miss;
+    }
+    if (data.dsize < sizeof(hdr)) {
+        tdb_delete(sl_cache_tdb, key);
+        goto miss;
+    }
+    memcpy(&hdr, data.dptr, sizeof(hdr));
+    if (hdr.sch_version != SL_CACHE_VERSION
+        || data.dsize != sizeof(hdr) + hdr.sch_count * sizeof(cnid_t)
+        || now - hdr.sch_time > obj->options.sl_cache_ttl) {
+        tdb_delete(sl_cache_tdb, key);
+        goto miss;
+    }
+    if (hdr.sch_time <= sl_cache_mod_time(slq->slq_vol)) {
+        tdb_delete(sl_cache_tdb, key);
+        goto miss;
+    }
+
+    if ((scq = talloc_zero(slq, struct sl_cache_query)) == NULL) {
+        goto miss;
+    }
+    scq->scq_count = hdr.sch_count;
+    if ((scq->scq_cnids = talloc_array(scq, cnid_t, hdr.sch_count ? hdr.sch_count : 1)) == NULL) {
+        talloc_free(scq);
+        goto miss;
+    }
+    memcpy(scq->scq_cnids, data.dptr + sizeof(hdr), hdr.sch_count * sizeof(cnid_t));
+
+    LOG(log_debug, logtype_sl, "query \"%s\": cache hit, %" PRIu32 " results",
+        slq->slq_qstring, hdr.sch_count);
+
+    slq->slq_backend = &sl_cache_backend;
+    slq->slq_backend_data = scq;
+    TALLOC_FREE(slq->slq_cache_key);
+    sl_cache_fill(slq);
+    hit = true;
+
+miss:
+    free(data.dptr);
+    if (!hit && slq->slq_cache_key) {
+        /* Record the results */
+        slq->slq_cache_cnids = talloc_array(slq, cnid_t, MAX_SL_RESULTS);
+        if (slq->slq_cache_cnids == NULL) {
+            TALLOC_FREE(slq->slq_cache_key);
+        }
+        slq->slq_cache_num = 0;
+    }
+    return hit;
+}
+
+/**
+ * Remember a result of a query for the cache
+ **/
+void sl_cache_add(slq_t *slq, cnid_t id)
+{
+    cnid_t *cnids;
+    size_t size;
+
+    if (slq->slq_cache_cnids == NULL) {
+        return;
+    }
+
+    if (slq->slq_cache_num == SL_CACHE_MAX_RESULTS) {
+        /* Too many, forget about caching this one */
+        TALLOC_FREE(slq->slq_cache_cnids);
+        TALLOC_FREE(slq->slq_cache_key);
+        return;
+    }
+
+    size = talloc_array_length(slq->slq_cache_cnids);
+    if (slq->slq_cache_num == size) {
+        cnids = talloc_realloc(slq, slq->slq_cache_cnids, cnid_t, 2 * size);
+        if (cnids == NULL) {
+            TALLOC_FREE(slq->slq_cache_cnids);
+            TALLOC_FREE(slq->slq_cache_key);
+            return;
+        }
+        slq->slq_cache_cnids = cnids;
+    }
+
+    slq->slq_cache_cnids[slq->slq_cache_num++] = id;
+}
+
+/**
+ * Store the results of a finished query in the cache
+ **/
+void sl_cache_store(slq_t *slq)
+{
+    struct sl_cache_hdr hdr;
+    TDB_DATA key, data;
+    time_t oldest;
+
+    if (slq->slq_cache_cnids == NULL || slq->slq_cache_key == NULL || sl_cache_tdb == NULL) {
+        return;
+    }
+
+    hdr.sch_version = SL_CACHE_VERSION;
+    hdr.sch_count = slq->slq_cache_num;
+    hdr.sch_time = slq->slq_time;
+
+    key.dptr = (unsigned char *)slq->slq_cache_key;
+    key.dsize = talloc_get_size(slq->slq_cache_key);
+    data.dsize = sizeof(hdr) + slq->slq_cache_num * sizeof(cnid_t);
+
+    if ((data.dptr = talloc_size(slq, data.dsize)) != NULL) {
+        memcpy(data.dptr, &hdr, sizeof(hdr));
+        memcpy(data.dptr + sizeof(hdr), slq->slq_cache_cnids, slq->slq_cache_num * sizeof(cnid_t));
+        if (tdb_store(sl_cache_tdb, key, data, TDB_REPLACE) != 0) {
+            LOG(log_error, logtype_sl, "sl_cache_store: %s", tdb_errorstr(sl_cache_tdb));
+        } else {
+            LOG(log_debug, logtype_sl, "query \"%s\": cached %d results",
+                slq->slq_qstring, slq->slq_cache_num);
+        }
+        talloc_free(data.dptr);
+    }
+
+    TALLOC_FREE(slq->slq_cache_cnids);
+    TALLOC_FREE(slq->slq_cache_key);
+
+    if (++sl_cache_stores % SL_CACHE_PURGE == 0) {
+        oldest = time(NULL) - slq->slq_obj->options.sl_cache_ttl;
+        tdb_traverse(sl_cache_tdb, sl_cache_purge_fn, &oldest);
+    }
+}
+
+/**
+ * A volume has been modified, invalidate its cached queries
+ *
+ * Stores the time as the volume's modification time, at most once a second per
+ * process and volume.
+ **/
+void sl_cache_invalidate(const AFPObj *obj, const struct vol *vol)
+{
+    TDB_DATA key, data;
+    time_t now = time(NULL);
+    int64_t t = now;
+
+    if ((now == sl_cache_last_mod && vol == sl_cache_last_vol) || !sl_cache_open(obj)) {
+        return;
+    }
+
+    key = sl_cache_mod_key(vol);
+    if (key.dptr == NULL) {
+        return;
+    }
+    data.dptr = (unsigned char *)&t;
+    data.dsize = sizeof(t);
+
+    if (tdb_store(sl_cache_tdb, key, data, TDB_REPLACE) == 0) {
+        sl_cache_last_mod = now;
+        sl_cache_last_vol = vol;
+    }
+    talloc_free(key.dptr);
+}
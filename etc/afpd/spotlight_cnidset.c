@@ -0,0 +1,299 @@
+/*
+  Copyright (c) 2026 Netatalk Team
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+*/
+
+/*
+ * CNID sets
+ * =========
+ *
+ * Queries may be restricted to a set of CNIDs the client passes along, which
+ * can be large for scoped searches. The set is split by the upper 16 bits of
+ * the CNIDs into containers, kept sorted by those bits. A container stores the
+ * lower 16 bits of its members in a sorted array as long as it has at most
+ * SC_ARRAY_MAX members, and in a bitmap of all 65536 possible values above
+ * that, which then takes no more space than the array would. As CNIDs are
+ * handed out sequentially, a set usually has few and dense containers.
+ *
+ * CNIDs are in host byte order here.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <atalk/talloc.h>
+#include <atalk/spotlight.h>
+
+#define SC_ARRAY_MAX  4096          /* max members of an array container */
+#define SC_BITMAP_LEN (65536 / 64)  /* number of words of a bitmap container */
+
+struct sl_cnidset_cont {
+    uint16_t  sc_key;               /* upper 16 bits of the members */
+    uint32_t  sc_card;              /* number of members */
+    uint16_t *sc_array;             /* sorted lower 16 bits, or NULL ... */
+    uint64_t *sc_bits;              /* ... if we have a bitmap */
+};
+
+struct sl_cnidset {
+    struct sl_cnidset_cont *cs_conts;  /* sorted by sc_key */
+    int                     cs_num;
+    size_t                  cs_card;
+};
+
+/* Index of the container with key, or where it would have to be inserted */
+static int cs_find(const struct sl_cnidset *set, uint16_t key, bool *found)
+{
+    int lo = 0, hi = set->cs_num, mid;
+
+    /* Members are mostly added in ascending order */
+    if (set->cs_num > 0 && set->cs_conts[set->cs_num - 1].sc_key < key) {
+        *found = false;
+        return set->cs_num;
+    }
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (set->cs_conts[mid].sc_key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *found = lo < set->cs_num && set->cs_conts[lo].sc_key == key;
+    return lo;
+}
+
+/* Index of the first array element >= low */
+static uint32_t sc_array_find(const struct sl_cnidset_cont *c, uint16_t low)
+{
+    uint32_t lo = 0, hi = c->sc_card, mid;
+
+    if (c->sc_card > 0 && c->sc_array[c->sc_card - 1] < low) {
+        return c->sc_card;
+    }
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (c->sc_array[mid] < low) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static bool sc_contains(const struct sl_cnidset_cont *c, uint16_t low)
+{
+    uint32_t i;
+
+    if (c->sc_bits) {
+        return (c->sc_bits[low / 64] >> (low % 64)) & 1;
+    }
+    i = sc_array_find(c, low);
+    return i < c->sc_card && c->sc_array[i] == low;
+}
+
+static int sc_to_bitmap(struct sl_cnidset *set, struct sl_cnidset_cont *c)
+{
+    uint32_t i;
+
+    if ((c->sc_bits = talloc_zero_array(set, uint64_t, SC_BITMAP_LEN)) == NULL) {
+        return -1;
+    }
+    for (i = 0; i < c->sc_card; i++) {
+        c->sc_bits[c->sc_array[i] / 64] |= (uint64_t)1 << (c->sc_array[i] % 64);
+    }
+    TALLOC_FREE(c->sc_array);
+    return 0;
+}
+
+/* @returns 1 if low has been added, 0 if it was already a member, -1 on error */
+static int sc_add(struct sl_cnidset *set, struct sl_cnidset_cont *c, uint16_t low)
+{
+    uint16_t *array;
+    uint32_t i;
+    size_t size;
+
+    if (c->sc_bits == NULL) {
+        i = sc_array_find(c, low);
+        if (i < c->sc_card && c->sc_array[i] == low) {
+            return 0;
+        }
+        if (c->sc_card == SC_ARRAY_MAX) {
+            if (sc_to_bitmap(set, c) != 0) {
+                return -1;
+            }
+        } else {
+            size = c->sc_array ? talloc_array_length(c->sc_array) : 0;
+            if (c->sc_card == size) {
+                size = size ? 2 * size : 8;
+                if ((array = talloc_realloc(set, c->sc_array, uint16_t, size)) == NULL) {
+                    return -1;
+                }
+                c->sc_array = array;
+            }
+            memmove(&c->sc_array[i + 1], &c->sc_array[i], (c->sc_card - i) * sizeof(uint16_t));
+            c->sc_array[i] = low;
+            c->sc_card++;
+            return 1;
+        }
+    }
+
+    if (sc_contains(c, low)) {
+        return 0;
+    }
+    c->sc_bits[low / 64] |= (uint64_t)1 << (low % 64);
+    c->sc_card++;
+    return 1;
+}
+
+/* Find the smallest member >= low, @returns false if there is none */
+static bool sc_next(const struct sl_cnidset_cont *c, uint16_t low, uint16_t *next)
+{
+    uint64_t word;
+    uint32_t i;
+
+    if (c->sc_bits == NULL) {
+        i = sc_array_find(c, low);
+        if (i == c->sc_card) {
+            return false;
+        }
+        *next = c->sc_array[i];
+        return true;
+    }
+
+    for (i = low / 64; i < SC_BITMAP_LEN; i++) {
+        word = c->sc_bits[i];
+        if (i == low / 64) {
+            word &= ~(uint64_t)0 << (low % 64);
+        }
+        if (word == 0) {
+            continue;
+        }
+        *next = i * 64;
+        while (!(word & 1)) {
+            word >>= 1;
+            (*next)++;
+        }
+        return true;
+    }
+    return false;
+}
+
+/******************************************************************************
+ * Interface
+ ******************************************************************************/
+
+/**
+ * Create an empty CNID set as a talloc child of ctx
+ **/
+struct sl_cnidset *sl_cnidset_new(TALLOC_CTX *ctx)
+{
+    return talloc_zero(ctx, struct sl_cnidset);
+}
+
+/**
+ * Add a CNID to a set
+ *
+ * @returns 0 on success, -1 on error
+ **/
+int sl_cnidset_add(struct sl_cnidset *set, uint32_t cnid)
+{
+    struct sl_cnidset_cont *conts;
+    uint16_t key = cnid >> 16;
+    bool found;
+    size_t size;
+    int i, ret;
+
+    i = cs_find(set, key, &found);
+    if (!found) {
+        size = set->cs_conts ? talloc_array_length(set->cs_conts) : 0;
+        if (set->cs_num == size) {
+            size = size ? 2 * size : 4;
+            conts = talloc_realloc(set, set->cs_conts, struct sl_cnidset_cont, size);
+            if (conts == NULL) {
+                return -1;
+            }
+            set->cs_conts = conts;
+        }
+        memmove(&set->cs_conts[i + 1], &set->cs_conts[i],
+                (set->cs_num - i) * sizeof(struct sl_cnidset_cont));
+        memset(&set->cs_conts[i], 0, sizeof(struct sl_cnidset_cont));
+        set->cs_conts[i].sc_key = key;
+        set->cs_num++;
+    }
+
+    if ((ret = sc_add(set, &set->cs_conts[i], cnid & 0xffff)) < 0) {
+        return -1;
+    }
+    set->cs_card += ret;
+    return 0;
+}
+
+/**
+ * Whether a CNID is a member of a set
+ **/
+bool sl_cnidset_contains(const struct sl_cnidset *set, uint32_t cnid)
+{
+    bool found;
+    int i;
+
+    i = cs_find(set, cnid >> 16, &found);
+    return found && sc_contains(&set->cs_conts[i], cnid & 0xffff);
+}
+
+/**
+ * Number of members of a set
+ **/
+size_t sl_cnidset_count(const struct sl_cnidset *set)
+{
+    return set->cs_card;
+}
+
+/**
+ * Iterate over the members of a set in ascending order
+ *
+ * @param set   (r)  CNID set
+ * @param cnid  (rw) in: the previous member or 0 to start, out: the next member
+ *
+ * @returns false if there are no more members
+ **/
+bool sl_cnidset_next(const struct sl_cnidset *set, uint32_t *cnid)
+{
+    uint16_t key, low, next;
+    bool found;
+    int i;
+
+    if (*cnid == UINT32_MAX) {
+        return false;
+    }
+    key = (*cnid + 1) >> 16;
+    low = (*cnid + 1) & 0xffff;
+
+    for (i = cs_find(set, key, &found); i < set->cs_num; i++) {
+        if (set->cs_conts[i].sc_key != key) {
+            low = 0;
+        }
+        if (sc_next(&set->cs_conts[i], low, &next)) {
+            *cnid = ((uint32_t)set->cs_conts[i].sc_key << 16) | next;
+            return true;
+        }
+    }
+    return false;
+}
@@ -217,7 +217,7 @@ static int sl_pack_CNID(sl_cnids_t *cnids, char *buf, int offset, char *toc_buf,
 {
     EC_INIT;
     int len;
-    int cnid_count = talloc_array_length(cnids->ca_cnids->dd_talloc_array);
+    int cnid_count = dalloc_size(cnids->ca_cnids);
     uint64_t id;
 
     EC_ZERO( slvalc(toc_buf, *toc_idx * 8, MAX_SLQ_TOC, sl_pack_tag(SQ_CPX_TYPE_CNIDS, (offset + SL_OFFSET_DELTA) / 8, 0)) );
@@ -252,7 +252,7 @@ EC_CLEANUP:
 static int sl_pack_array(sl_array_t *array, char *buf, int offset, char *toc_buf, int *toc_idx)
 {
     EC_INIT;
-    int count = talloc_array_length(array->dd_talloc_array);
+    int count = dalloc_size(array);
     int octets = (offset + SL_OFFSET_DELTA) / 8;
 
     EC_ZERO( slvalc(toc_buf, *toc_idx * 8, MAX_SLQ_TOC, sl_pack_tag(SQ_CPX_TYPE_ARRAY, octets, count)) );
@@ -277,7 +277,7 @@ static int sl_pack_dict(sl_array_t *dict, char *buf, int offset, char *toc_buf,
                     MAX_SLQ_TOC,
                     sl_pack_tag(SQ_CPX_TYPE_DICT,
                                 (offset + SL_OFFSET_DELTA) / 8,
-                                talloc_array_length(dict->dd_talloc_array))) );
+                                dalloc_size(dict))) );
     EC_ZERO( slvalc(buf, offset, MAX_SLQ_DAT, sl_pack_tag(SQ_TYPE_COMPLEX, 1, *toc_idx + 1)) );
     *toc_idx += 1;
     offset += 8;
@@ -353,7 +353,7 @@ static int sl_pack_loop(DALLOC_CTX *query, char *buf, int offset, char *toc_buf,
     EC_INIT;
     const char *type;
 
-    for (int n = 0; n < talloc_array_length(query->dd_talloc_array); n++) {
+    for (int n = 0; n < dalloc_size(query); n++) {
 
         type = talloc_get_name(query->dd_talloc_array[n]);
 
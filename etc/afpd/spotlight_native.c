@@ -0,0 +1,1318 @@
+/*
+  Copyright (c) 2026 Netatalk Team
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+*/
+
+/*
+ * Native Spotlight backend
+ * ========================
+ *
+ * Answers Spotlight queries without Tracker from the indexes of the volume's
+ * CNID database: the trigram name index (cnid_find_substr()) and the
+ * modification date index (cnid_find_mtime()). The CNID database is already a
+ * per volume on-disk store that afpd updates whenever it creates, renames or
+ * deletes a file. Modifying a file doesn't touch it, so sl_index_event() notes
+ * the enabled file change events and sl_index_flush() looks modified and new
+ * files up again once the AFP command has been answered, which refreshes their
+ * entries.
+ *
+ * A query is parsed into an expression tree. From the tree we pick a set of
+ * index searches that together find every possible match: for "a && b" the
+ * search for a or the one for b, for "a || b" both. If there is no such set
+ * we walk all CNIDs of the volume, checking every file. That's the case for
+ * queries on sizes or content types only, and for ors where one side is such
+ * a query. Every candidate is checked against the whole expression, names
+ * against the case-folded query strings, everything else against stat().
+ * Filename extensions stand in for content types. File contents are not
+ * indexed, kMDItemTextContent queries match names only.
+ *
+ * afpd is single-threaded, so queries run synchronously: a batch of results is
+ * searched for while handling the RPC that opened the query or fetched the
+ * previous batch. The number of CNID database requests per batch is bounded.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <atalk/standards.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <atalk/errchk.h>
+#include <atalk/util.h>
+#include <atalk/logger.h>
+#include <atalk/talloc.h>
+#include <atalk/cnid.h>
+#include <atalk/cnid_bdb_private.h>
+#include <atalk/bstrlib.h>
+#include <atalk/unicode.h>
+#include <atalk/netatalk_conf.h>
+#include <atalk/volume.h>
+#include <atalk/fce_api.h>
+#include <atalk/spotlight.h>
+
+#include "directory.h"
+
+#define SN_MAX_SOURCES  8           /* max number of index searches per query */
+#define SN_MAX_REQUESTS 8           /* max number of CNID db requests per batch */
+#define SN_SET_SCAN_MAX 4096        /* check all members of smaller CNID sets */
+#define SN_TIME_OFFSET  978307200   /* Spotlight dates are seconds since 2001 */
+#define SN_TIME_MAX     0xffffffff  /* the date index stores 32 bit dates */
+
+/* Attribute types */
+#define SNA_NAME        0           /* filename */
+#define SNA_MTIME       1           /* modification date */
+#define SNA_SIZE        2           /* file size */
+#define SNA_TYPE        3           /* content type, by filename extension */
+
+struct sn_attr {
+    const char *sna_name;
+    bool        sna_enabled;
+    int         sna_type;
+};
+
+static struct sn_attr sn_attrs[] = {
+    {"*",                               true, SNA_NAME},
+    {"kMDItemDisplayName",              true, SNA_NAME},
+    {"kMDItemFSName",                   true, SNA_NAME},
+    {"kMDItemTextContent",              true, SNA_NAME},
+    {"kMDItemFSContentChangeDate",      true, SNA_MTIME},
+    {"kMDItemContentModificationDate",  true, SNA_MTIME},
+    {"kMDItemAttributeChangeDate",      true, SNA_MTIME},
+    {"kMDItemFSSize",                   true, SNA_SIZE},
+    {"_kMDItemGroupId",                 true, SNA_TYPE},
+    {"kMDItemContentType",              true, SNA_TYPE},
+    {"kMDItemContentTypeTree",          true, SNA_TYPE},
+    {NULL,                              false, 0}
+};
+
+/* Content types, "/" stands for folders */
+static const struct sn_type_map {
+    const char *sntm_value;     /* value of _kMDItemGroupId or kMDItemContentType(Tree) */
+    const char *sntm_exts;      /* space separated list of filename extensions */
+} sn_type_map[] = {
+    {"1",                       "eml emlx"},
+    {"4",                       "ttf otf ttc dfont"},
+    {"7",                       "mov mp4 m4v avi mkv mpg mpeg wmv"},
+    {"8",                       "app command tool"},
+    {"9",                       "/"},
+    {"10",                      "mp3 m4a aac wav aif aiff flac"},
+    {"11",                      "pdf"},
+    {"12",                      "key ppt pptx odp"},
+    {"13",                      "jpg jpeg png gif tif tiff bmp heic psd"},
+    {"public.folder",           "/"},
+    {"public.image",            "jpg jpeg png gif tif tiff bmp heic psd"},
+    {"public.jpeg",             "jpg jpeg"},
+    {"public.tiff",             "tif tiff"},
+    {"com.compuserve.gif",      "gif"},
+    {"public.png",              "png"},
+    {"com.microsoft.bmp",       "bmp"},
+    {"public.movie",            "mov mp4 m4v avi mkv mpg mpeg wmv"},
+    {"public.audio",            "mp3 m4a aac wav aif aiff flac"},
+    {"public.mp3",              "mp3"},
+    {"public.mpeg-4-audio",     "m4a aac"},
+    {"com.adobe.pdf",           "pdf"},
+    {"public.content",          "pdf doc docx rtf txt pages odt xls xlsx numbers ods key ppt pptx odp"},
+    {"com.apple.application",   "app"},
+    {"public.text",             "txt text rtf html htm xml c h m cc cpp py pl sh java js"},
+    {"public.plain-text",       "txt text"},
+    {"public.rtf",              "rtf"},
+    {"public.html",             "html htm"},
+    {"public.xml",              "xml"},
+    {"public.source-code",      "c h m cc cpp py pl sh java js"},
+    {NULL,                      NULL}
+};
+
+/* Expression tree */
+enum sn_node_type {
+    SN_AND,
+    SN_OR,
+    SN_MATCH,                   /* attribute op value */
+    SN_RANGE                    /* InRange(attribute, lo, hi) */
+};
+
+struct sn_node {
+    enum sn_node_type sn_type;
+    struct sn_node   *sn_left;      /* SN_AND, SN_OR */
+    struct sn_node   *sn_right;
+    int               sn_attr;      /* SNA_* */
+    char              sn_op;        /* '=', '!', '<' or '>' */
+    const char       *sn_str;       /* case-folded pattern for SNA_NAME, extensions for SNA_TYPE */
+    const char       *sn_literal;   /* longest part of sn_str without wildcards */
+    bool              sn_words;     /* 'w' modifier, match at the start of words */
+    int64_t           sn_lo;        /* value of SN_MATCH, range of SN_RANGE */
+    int64_t           sn_hi;
+};
+
+/* Query state */
+struct sn_query {
+    struct sn_node       *snq_expr;
+    const struct sn_node *snq_src[SN_MAX_SOURCES]; /* index searches, NULL: all CNIDs */
+    int                   snq_nsrc;
+    int                   snq_cur;       /* current index search */
+    bool                  snq_setscan;   /* candidates are the members of slq_cnids */
+    bool                  snq_started;   /* snq_next, snq_from are valid */
+    cnid_t                snq_next;      /* where the current search continues */
+    time_t                snq_from;      /* where a date search continues */
+    time_t                snq_to;
+    size_t                snq_scopelen;  /* length of slq_scope without trailing slashes */
+    char                 *snq_resbuf;    /* CNIDs from the last request */
+    int                   snq_num;
+    int                   snq_idx;       /* next CNID in snq_resbuf */
+};
+
+/******************************************************************************
+ * Query parser
+ ******************************************************************************/
+
+enum sn_token {
+    SNT_END,
+    SNT_ERROR,
+    SNT_WORD,
+    SNT_STRING,
+    SNT_OBRACE,
+    SNT_CBRACE,
+    SNT_COMMA,
+    SNT_AND,
+    SNT_OR,
+    SNT_EQUAL,
+    SNT_UNEQUAL,
+    SNT_LT,
+    SNT_GT,
+    SNT_LE,
+    SNT_GE
+};
+
+struct sn_parser {
+    slq_t           *snp_slq;
+    struct sn_query *snp_query;     /* talloc context for nodes and tokens */
+    const char      *snp_pos;
+    enum sn_token    snp_tok;
+    char            *snp_val;       /* text of SNT_WORD and SNT_STRING */
+    char             snp_mods[8];   /* modifiers following a SNT_STRING, eg "cdw" */
+};
+
+static struct sn_node *sn_parse_expr(struct sn_parser *p);
+
+static bool sn_wordchar(unsigned char c)
+{
+    return isalnum(c) || c >= 0x80 || strchr("_*:-.$", c) != NULL;
+}
+
+static enum sn_token sn_next(struct sn_parser *p)
+{
+    const char *s = p->snp_pos;
+    const char *start;
+    char *d;
+    int i;
+
+    while (*s == ' ' || *s == '\t' || *s == '\n') {
+        s++;
+    }
+
+    p->snp_val = NULL;
+    p->snp_mods[0] = 0;
+
+    switch (*s) {
+    case 0:
+        p->snp_tok = SNT_END;
+        break;
+    case '(':
+        p->snp_tok = SNT_OBRACE;
+        s++;
+        break;
+    case ')':
+        p->snp_tok = SNT_CBRACE;
+        s++;
+        break;
+    case ',':
+        p->snp_tok = SNT_COMMA;
+        s++;
+        break;
+    case '&':
+    case '|':
+        if (s[1] != s[0]) {
+            p->snp_tok = SNT_ERROR;
+            break;
+        }
+        p->snp_tok = *s == '&' ? SNT_AND : SNT_OR;
+        s += 2;
+        break;
+    case '=':
+        p->snp_tok = SNT_EQUAL;
+        s++;
+        if (*s == '=') {
+            s++;
+        }
+        break;
+    case '!':
+        if (s[1] != '=') {
+            p->snp_tok = SNT_ERROR;
+            break;
+        }
+        p->snp_tok = SNT_UNEQUAL;
+        s += 2;
+        break;
+    case '<':
+    case '>':
+        if (s[1] == '=') {
+            p->snp_tok = *s == '<' ? SNT_LE : SNT_GE;
+            s += 2;
+        } else {
+            p->snp_tok = *s == '<' ? SNT_LT : SNT_GT;
+            s++;
+        }
+        break;
+    case '"':
+        s++;
+        if ((d = p->snp_val = talloc_array(p->snp_query, char, strlen(s) + 1)) == NULL) {
+            p->snp_tok = SNT_ERROR;
+            break;
+        }
+        while (*s && *s != '"') {
+            if (*s == '\\' && s[1]) {
+                s++;
+            }
+            *d++ = *s++;
+        }
+        *d = 0;
+        if (*s != '"') {
+            p->snp_tok = SNT_ERROR;
+            break;
+        }
+        s++;
+        for (i = 0; isalpha((unsigned char)*s); s++) {
+            if (i < sizeof(p->snp_mods) - 1) {
+                p->snp_mods[i++] = *s;
+            }
+        }
+        p->snp_mods[i] = 0;
+        p->snp_tok = SNT_STRING;
+        break;
+    default:
+        start = s;
+        while (*s && sn_wordchar((unsigned char)*s)) {
+            s++;
+        }
+        if (s == start) {
+            p->snp_tok = SNT_ERROR;
+            break;
+        }
+        if ((p->snp_val = talloc_strndup(p->snp_query, start, s - start)) == NULL) {
+            p->snp_tok = SNT_ERROR;
+            break;
+        }
+        p->snp_tok = SNT_WORD;
+        break;
+    }
+
+    p->snp_pos = s;
+    return p->snp_tok;
+}
+
+static struct sn_node *sn_error(const struct sn_parser *p, const char *msg)
+{
+    LOG(log_debug, logtype_sl, "Spotlight query \"%s\": %s at \"%s\"",
+        p->snp_slq->slq_qstring, msg, p->snp_pos);
+    return NULL;
+}
+
+static struct sn_node *sn_new_node(struct sn_parser *p, enum sn_node_type type)
+{
+    struct sn_node *n;
+
+    if ((n = talloc_zero(p->snp_query, struct sn_node)) == NULL) {
+        return NULL;
+    }
+    n->sn_type = type;
+    return n;
+}
+
+/* Case-fold a name the way catsearch does, buf must have MAXPATHLEN + 1 bytes */
+static bool sn_fold(const struct vol *vol, const char *s, char *buf)
+{
+    uint16_t flags = CONV_TOLOWER;
+    size_t len;
+
+    len = convert_charset(vol->v_volcharset, vol->v_volcharset, vol->v_maccharset,
+                          s, strlen(s), buf, MAXPATHLEN, &flags);
+    if (len == (size_t)-1) {
+        return false;
+    }
+    buf[len] = 0;
+    return true;
+}
+
+/* The longest part of a pattern without wildcards, that's what we look up in the index */
+static char *sn_literal(TALLOC_CTX *ctx, const char *pat)
+{
+    const char *best = pat;
+    size_t len, bestlen = 0;
+
+    while (*pat) {
+        len = strcspn(pat, "*");
+        if (len > bestlen) {
+            best = pat;
+            bestlen = len;
+        }
+        pat += len;
+        pat += strspn(pat, "*");
+    }
+
+    return talloc_strndup(ctx, best, bestlen);
+}
+
+/* $time.iso() dates are UTC */
+static bool sn_isodate(const char *s, int64_t *t)
+{
+    struct tm tm;
+
+    memset(&tm, 0, sizeof(tm));
+    if (strptime(s, "%Y-%m-%dT%H:%M:%SZ", &tm) == NULL) {
+        return false;
+    }
+    *t = timegm(&tm);
+    return true;
+}
+
+/* Parse a number or a date, either a $time.iso() or seconds since 2001 */
+static bool sn_parse_value(struct sn_parser *p, int attr, int64_t *v)
+{
+    char *end;
+    double d;
+
+    if (p->snp_tok == SNT_WORD && strcmp(p->snp_val, "$time.iso") == 0) {
+        if (attr != SNA_MTIME
+            || sn_next(p) != SNT_OBRACE
+            || sn_next(p) != SNT_WORD
+            || !sn_isodate(p->snp_val, v)
+            || sn_next(p) != SNT_CBRACE) {
+            return false;
+        }
+        sn_next(p);
+        return true;
+    }
+
+    if (p->snp_tok != SNT_WORD && p->snp_tok != SNT_STRING) {
+        return false;
+    }
+    d = strtod(p->snp_val, &end);
+    if (end == p->snp_val || *end != 0) {
+        return false;
+    }
+    *v = (int64_t)d;
+    if (attr == SNA_MTIME) {
+        *v += SN_TIME_OFFSET;
+    }
+    sn_next(p);
+    return true;
+}
+
+static int sn_attr_type(const struct sn_parser *p, const char *name)
+{
+    const struct sn_attr *a;
+
+    for (a = sn_attrs; a->sna_name; a++) {
+        if (strcmp(a->sna_name, name) == 0) {
+            if (!a->sna_enabled) {
+                LOG(log_debug, logtype_sl, "Spotlight attribute not enabled: %s", name);
+                return -1;
+            }
+            return a->sna_type;
+        }
+    }
+
+    LOG(log_debug, logtype_sl, "Spotlight attribute not supported: %s", name);
+    return -1;
+}
+
+/* InRange(attribute, lo, hi) */
+static struct sn_node *sn_parse_inrange(struct sn_parser *p)
+{
+    struct sn_node *n;
+
+    if (sn_next(p) != SNT_OBRACE || sn_next(p) != SNT_WORD) {
+        return sn_error(p, "syntax error");
+    }
+    if ((n = sn_new_node(p, SN_RANGE)) == NULL) {
+        return NULL;
+    }
+    n->sn_attr = sn_attr_type(p, p->snp_val);
+    if (n->sn_attr != SNA_MTIME && n->sn_attr != SNA_SIZE) {
+        return sn_error(p, "unsupported InRange attribute");
+    }
+    if (sn_next(p) != SNT_COMMA) {
+        return sn_error(p, "syntax error");
+    }
+    sn_next(p);
+    if (!sn_parse_value(p, n->sn_attr, &n->sn_lo) || p->snp_tok != SNT_COMMA) {
+        return sn_error(p, "bad value");
+    }
+    sn_next(p);
+    if (!sn_parse_value(p, n->sn_attr, &n->sn_hi) || p->snp_tok != SNT_CBRACE) {
+        return sn_error(p, "bad value");
+    }
+    sn_next(p);
+    return n;
+}
+
+/* attribute op value */
+static struct sn_node *sn_parse_match(struct sn_parser *p)
+{
+    struct sn_node *n;
+    const struct sn_type_map *t;
+    char buf[MAXPATHLEN + 1];
+    int adjust = 0;
+
+    if ((n = sn_new_node(p, SN_MATCH)) == NULL) {
+        return NULL;
+    }
+    if ((n->sn_attr = sn_attr_type(p, p->snp_val)) == -1) {
+        return NULL;
+    }
+
+    switch (sn_next(p)) {
+    case SNT_EQUAL:
+        n->sn_op = '=';
+        break;
+    case SNT_UNEQUAL:
+        n->sn_op = '!';
+        break;
+    case SNT_LT:
+        n->sn_op = '<';
+        break;
+    case SNT_GT:
+        n->sn_op = '>';
+        break;
+    case SNT_LE:
+        n->sn_op = '<';
+        adjust = 1;
+        break;
+    case SNT_GE:
+        n->sn_op = '>';
+        adjust = -1;
+        break;
+    default:
+        return sn_error(p, "expected operator");
+    }
+    sn_next(p);
+
+    switch (n->sn_attr) {
+    case SNA_NAME:
+    case SNA_TYPE:
+        if (n->sn_op != '=' && n->sn_op != '!') {
+            return sn_error(p, "bad operator");
+        }
+        if (p->snp_tok != SNT_STRING && p->snp_tok != SNT_WORD) {
+            return sn_error(p, "expected string");
+        }
+        if (n->sn_attr == SNA_TYPE) {
+            for (t = sn_type_map; t->sntm_value; t++) {
+                if (strcmp(t->sntm_value, p->snp_val) == 0) {
+                    break;
+                }
+            }
+            if (t->sntm_value == NULL) {
+                return sn_error(p, "unsupported content type");
+            }
+            n->sn_str = t->sntm_exts;
+        } else {
+            if (!sn_fold(p->snp_slq->slq_vol, p->snp_val, buf)) {
+                return sn_error(p, "charset conversion failed");
+            }
+            if ((n->sn_str = talloc_strdup(p->snp_query, buf)) == NULL
+                || (n->sn_literal = sn_literal(p->snp_query, buf)) == NULL) {
+                return NULL;
+            }
+            n->sn_words = strchr(p->snp_mods, 'w') != NULL;
+        }
+        sn_next(p);
+        break;
+
+    default:
+        if (!sn_parse_value(p, n->sn_attr, &n->sn_lo)) {
+            return sn_error(p, "bad value");
+        }
+        n->sn_lo += adjust;
+        break;
+    }
+
+    return n;
+}
+
+static struct sn_node *sn_parse_primary(struct sn_parser *p)
+{
+    struct sn_node *n;
+
+    switch (p->snp_tok) {
+    case SNT_OBRACE:
+        sn_next(p);
+        if ((n = sn_parse_expr(p)) == NULL) {
+            return NULL;
+        }
+        if (p->snp_tok != SNT_CBRACE) {
+            return sn_error(p, "missing )");
+        }
+        sn_next(p);
+        return n;
+
+    case SNT_WORD:
+        if (strcmp(p->snp_val, "InRange") == 0) {
+            return sn_parse_inrange(p);
+        }
+        return sn_parse_match(p);
+
+    default:
+        return sn_error(p, "syntax error");
+    }
+}
+
+static struct sn_node *sn_parse_and(struct sn_parser *p)
+{
+    struct sn_node *n, *left, *right;
+
+    if ((left = sn_parse_primary(p)) == NULL) {
+        return NULL;
+    }
+    while (p->snp_tok == SNT_AND) {
+        sn_next(p);
+        if ((right = sn_parse_primary(p)) == NULL) {
+            return NULL;
+        }
+        if ((n = sn_new_node(p, SN_AND)) == NULL) {
+            return NULL;
+        }
+        n->sn_left = left;
+        n->sn_right = right;
+        left = n;
+    }
+    return left;
+}
+
+static struct sn_node *sn_parse_expr(struct sn_parser *p)
+{
+    struct sn_node *n, *left, *right;
+
+    if ((left = sn_parse_and(p)) == NULL) {
+        return NULL;
+    }
+    while (p->snp_tok == SNT_OR) {
+        sn_next(p);
+        if ((right = sn_parse_and(p)) == NULL) {
+            return NULL;
+        }
+        if ((n = sn_new_node(p, SN_OR)) == NULL) {
+            return NULL;
+        }
+        n->sn_left = left;
+        n->sn_right = right;
+        left = n;
+    }
+    return left;
+}
+
+/* Parse the query string of slq into q->snq_expr */
+static int sn_parse(slq_t *slq, struct sn_query *q)
+{
+    struct sn_parser p;
+
+    memset(&p, 0, sizeof(p));
+    p.snp_slq = slq;
+    p.snp_query = q;
+    p.snp_pos = slq->slq_qstring;
+    sn_next(&p);
+
+    if ((q->snq_expr = sn_parse_expr(&p)) == NULL) {
+        return -1;
+    }
+    if (p.snp_tok != SNT_END) {
+        sn_error(&p, "syntax error");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Without "spotlight expr" we only allow what the Tracker backend allows:
+ * a single match or two matches ored, eg Finders name or content queries.
+ */
+static bool sn_simple(const struct sn_node *n)
+{
+    switch (n->sn_type) {
+    case SN_AND:
+        return false;
+    case SN_OR:
+        return n->sn_left->sn_type == SN_MATCH && n->sn_right->sn_type == SN_MATCH;
+    default:
+        return true;
+    }
+}
+
+/******************************************************************************
+ * Evaluation
+ ******************************************************************************/
+
+/*
+ * Match a string against a pattern with '*' wildcards.
+ * With prefix the pattern only has to match the beginning of s.
+ */
+static bool sn_glob(const char *pat, const char *s, bool prefix)
+{
+    const char *star = NULL;
+    const char *retry = s;
+
+    while (*s) {
+        if (*pat == 0 && prefix) {
+            return true;
+        }
+        if (*pat == '*') {
+            star = pat++;
+            retry = s;
+        } else if (*pat == *s) {
+            pat++;
+            s++;
+        } else if (star) {
+            pat = star + 1;
+            s = ++retry;
+        } else {
+            return false;
+        }
+    }
+
+    while (*pat == '*') {
+        pat++;
+    }
+    return *pat == 0;
+}
+
+static bool sn_match_name(const struct sn_node *n, const char *name)
+{
+    const char *s;
+
+    if (!n->sn_words) {
+        return sn_glob(n->sn_str, name, false);
+    }
+
+    /* Word based: the pattern may match at the beginning of any word */
+    for (s = name; *s; s++) {
+        if (s != name && (isalnum((unsigned char)s[-1]) || (unsigned char)s[-1] >= 0x80)) {
+            continue;
+        }
+        if (sn_glob(n->sn_str, s, true)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool sn_match_type(const struct sn_node *n, const char *name, const struct stat *st)
+{
+    const char *ext, *p;
+    size_t len;
+
+    if (S_ISDIR(st->st_mode)) {
+        ext = "/";
+    } else {
+        if ((ext = strrchr(name, '.')) == NULL || ext == name) {
+            return false;
+        }
+        ext++;
+    }
+    len = strlen(ext);
+
+    for (p = n->sn_str; *p; p += strspn(p, " ")) {
+        if (strcspn(p, " ") == len && strncmp(p, ext, len) == 0) {
+            return true;
+        }
+        p += strcspn(p, " ");
+    }
+    return false;
+}
+
+static int64_t sn_value(int attr, const struct stat *st)
+{
+    if (attr == SNA_MTIME) {
+        return st->st_mtime;
+    }
+    return S_ISDIR(st->st_mode) ? 0 : st->st_size;
+}
+
+/*!
+ * Check whether a file matches an expression
+ *
+ * @param n     (r) expression
+ * @param name  (r) case-folded name of the file
+ * @param st    (r) stat of the file
+ */
+static bool sn_eval(const struct sn_node *n, const char *name, const struct stat *st)
+{
+    int64_t v;
+    bool res;
+
+    switch (n->sn_type) {
+    case SN_AND:
+        return sn_eval(n->sn_left, name, st) && sn_eval(n->sn_right, name, st);
+    case SN_OR:
+        return sn_eval(n->sn_left, name, st) || sn_eval(n->sn_right, name, st);
+    case SN_RANGE:
+        v = sn_value(n->sn_attr, st);
+        return v >= n->sn_lo && v <= n->sn_hi;
+    case SN_MATCH:
+        break;
+    }
+
+    switch (n->sn_attr) {
+    case SNA_NAME:
+        res = sn_match_name(n, name);
+        break;
+    case SNA_TYPE:
+        res = sn_match_type(n, name, st);
+        break;
+    default:
+        v = sn_value(n->sn_attr, st);
+        switch (n->sn_op) {
+        case '<':
+            return v < n->sn_lo;
+        case '>':
+            return v > n->sn_lo;
+        default:
+            res = v == n->sn_lo;
+            break;
+        }
+        break;
+    }
+
+    return n->sn_op == '!' ? !res : res;
+}
+
+/*!
+ * Find the index searches that together return all matches of an expression
+ *
+ * @param n     (r) expression
+ * @param src   (w) array for the searches
+ * @param max   (r) size of src
+ *
+ * @returns number of searches, -1 if the indexes can't be used
+ */
+static int sn_plan(const struct sn_node *n, const struct sn_node **src, int max)
+{
+    const struct sn_node *tmp[SN_MAX_SOURCES];
+    int l, r;
+
+    if (max < 1) {
+        return -1;
+    }
+
+    switch (n->sn_type) {
+    case SN_AND:
+        /* Either side will do, prefer fewer searches and names over dates */
+        l = sn_plan(n->sn_left, src, max);
+        r = sn_plan(n->sn_right, tmp, max);
+        if (r > 0 && (l <= 0
+                      || r < l
+                      || (r == l && src[0]->sn_attr != SNA_NAME && tmp[0]->sn_attr == SNA_NAME))) {
+            memcpy(src, tmp, r * sizeof(*src));
+            return r;
+        }
+        return l;
+
+    case SN_OR:
+        if ((l = sn_plan(n->sn_left, src, max)) <= 0) {
+            return -1;
+        }
+        if ((r = sn_plan(n->sn_right, src + l, max - l)) <= 0) {
+            return -1;
+        }
+        return l + r;
+
+    case SN_RANGE:
+        if (n->sn_attr != SNA_MTIME) {
+            return -1;
+        }
+        src[0] = n;
+        return 1;
+
+    case SN_MATCH:
+        if ((n->sn_attr == SNA_NAME && n->sn_op == '=' && n->sn_literal[0])
+            || (n->sn_attr == SNA_MTIME && n->sn_op != '!')) {
+            src[0] = n;
+            return 1;
+        }
+        return -1;
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+ * Searching
+ ******************************************************************************/
+
+static void sn_mtime_range(const struct sn_node *n, time_t *from, time_t *to)
+{
+    *from = 0;
+    *to = SN_TIME_MAX;
+
+    if (n->sn_type == SN_RANGE) {
+        *from = n->sn_lo;
+        *to = n->sn_hi;
+        return;
+    }
+
+    switch (n->sn_op) {
+    case '<':
+        *to = n->sn_lo - 1;
+        break;
+    case '>':
+        *from = n->sn_lo + 1;
+        break;
+    default:
+        *from = *to = n->sn_lo;
+        break;
+    }
+}
+
+/* Fetch the next batch of CNIDs of the current index search */
+static int sn_search(slq_t *slq, struct sn_query *q)
+{
+    const struct sn_node *src = q->snq_src[q->snq_cur];
+    struct _cnid_db *cdb = slq->slq_vol->v_cdb;
+    cnid_t id;
+    int num;
+
+    if (!q->snq_started) {
+        q->snq_next = CNID_INVALID;
+        if (src && src->sn_attr == SNA_MTIME) {
+            sn_mtime_range(src, &q->snq_from, &q->snq_to);
+        }
+        q->snq_started = true;
+    }
+
+    if (q->snq_setscan) {
+        for (num = 0; num < DBD_MAX_SRCH_RSLTS; num++) {
+            if (!sl_cnidset_next(slq->slq_cnids, &q->snq_next)) {
+                q->snq_next = CNID_INVALID;
+                break;
+            }
+            id = htonl(q->snq_next);
+            memcpy(q->snq_resbuf + num * sizeof(cnid_t), &id, sizeof(cnid_t));
+        }
+    } else if (src == NULL) {
+        /* No usable index, the empty string is part of all names */
+        num = cnid_find_substr(cdb, "", 0, &q->snq_next,
+                               q->snq_resbuf, DBD_MAX_SRCH_RSLTS * sizeof(cnid_t));
+    } else if (src->sn_attr == SNA_NAME) {
+        num = cnid_find_substr(cdb, src->sn_literal, strlen(src->sn_literal), &q->snq_next,
+                               q->snq_resbuf, DBD_MAX_SRCH_RSLTS * sizeof(cnid_t));
+    } else {
+        num = cnid_find_mtime(cdb, &q->snq_from, q->snq_to, &q->snq_next,
+                              q->snq_resbuf, DBD_MAX_SRCH_RSLTS * sizeof(cnid_t));
+    }
+    if (num < 0) {
+        return -1;
+    }
+
+    q->snq_num = num;
+    q->snq_idx = 0;
+    return 0;
+}
+
+/*!
+ * Check a candidate from an index search and add it to the results if it matches
+ *
+ * @returns 0 on success, -1 on error
+ */
+static int sn_check(slq_t *slq, struct sn_query *q, cnid_t id)
+{
+    const struct vol *vol = slq->slq_vol;
+    char buffer[12 + MAXPATHLEN + 1];
+    char path[MAXPATHLEN + 1];
+    char folded[MAXPATHLEN + 1];
+    const char *name;
+    struct dir *dir;
+    struct stat st;
+    cnid_t did = id;
+    int i;
+
+    if ((name = cnid_resolve(vol->v_cdb, &did, buffer, sizeof(buffer))) == NULL) {
+        return 0;
+    }
+    if ((dir = dirlookup(vol, did)) == NULL) {
+        return 0;
+    }
+    if (snprintf(path, sizeof(path), "%s/%s", bdata(dir->d_fullpath), name) >= sizeof(path)) {
+        return 0;
+    }
+    if (strncmp(path, slq->slq_scope, q->snq_scopelen) != 0 || path[q->snq_scopelen] != '/') {
+        return 0;
+    }
+    if (stat(path, &st) != 0) {
+        return 0;
+    }
+    if (!sn_fold(vol, name, folded)) {
+        return 0;
+    }
+
+    if (!sn_eval(q->snq_expr, folded, &st)) {
+        return 0;
+    }
+
+    /* Matches of the previous index searches have already been returned */
+    for (i = 0; i < q->snq_cur; i++) {
+        if (sn_eval(q->snq_src[i], folded, &st)) {
+            return 0;
+        }
+    }
+
+    LOG(log_debug, logtype_sl, "match: %s", path);
+
+    return sl_add_result(slq, id, path, &st) ? 0 : -1;
+}
+
+/* Search until we have a batch of results, the query is done or we've used our budget */
+static void sn_fill(slq_t *slq)
+{
+    struct sn_query *q = slq->slq_backend_data;
+    int requests = 0;
+    cnid_t id;
+
+    slq->slq_state = SLQ_STATE_RESULTS;
+
+    while (!sl_results_full(slq)) {
+        if (q->snq_idx < q->snq_num) {
+            memcpy(&id, q->snq_resbuf + q->snq_idx * sizeof(cnid_t), sizeof(cnid_t));
+            q->snq_idx++;
+            if (slq->slq_cnids && !q->snq_setscan
+                && !sl_cnidset_contains(slq->slq_cnids, ntohl(id))) {
+                continue;
+            }
+            if (sn_check(slq, q, id) != 0) {
+                slq->slq_state = SLQ_STATE_ERROR;
+                return;
+            }
+            continue;
+        }
+
+        if (q->snq_started && q->snq_next == CNID_INVALID) {
+            /* Current index search is done, on to the next one */
+            if (++q->snq_cur == q->snq_nsrc) {
+                LOG(log_debug, logtype_sl, "ctx1: %" PRIx64 ", ctx2: %" PRIx64 ": done",
+                    slq->slq_ctx1, slq->slq_ctx2);
+                slq->slq_state = SLQ_STATE_DONE;
+                return;
+            }
+            q->snq_started = false;
+        }
+
+        if (requests++ == SN_MAX_REQUESTS) {
+            return;
+        }
+        if (sn_search(slq, q) != 0) {
+            LOG(log_error, logtype_sl, "CNID database search failed");
+            slq->slq_state = SLQ_STATE_ERROR;
+            return;
+        }
+    }
+
+    slq->slq_state = SLQ_STATE_FULL;
+}
+
+/******************************************************************************
+ * Backend interface
+ ******************************************************************************/
+
+static void sn_configure_attributes(const char *attributes_in)
+{
+    struct sn_attr *a;
+    char *attr, *attributes;
+
+    for (a = sn_attrs; a->sna_name; a++) {
+        a->sna_enabled = false;
+    }
+
+    if ((attributes = strdup(attributes_in)) == NULL) {
+        return;
+    }
+
+    for (attr = strtok(attributes, ","); attr; attr = strtok(NULL, ",")) {
+        for (a = sn_attrs; a->sna_name; a++) {
+            if (strcmp(attr, a->sna_name) == 0) {
+                LOG(log_info, logtype_sl, "Enabling Spotlight attribute: %s", a->sna_name);
+                a->sna_enabled = true;
+                break;
+            }
+        }
+    }
+
+    free(attributes);
+}
+
+static int sn_init(AFPObj *obj)
+{
+    const char *attributes;
+
+    attributes = atalk_iniparser_getstring(obj->iniconfig, INISEC_GLOBAL,
+                                           "spotlight attributes", NULL);
+    if (attributes) {
+        sn_configure_attributes(attributes);
+    }
+    return 0;
+}
+
+static int sn_open_query(slq_t *slq)
+{
+    EC_INIT;
+    const struct vol *vol = slq->slq_vol;
+    struct sn_query *q;
+    size_t len;
+
+    if (vol->v_cdb == NULL
+        || vol->v_cdb->cnid_find_substr == NULL
+        || vol->v_cdb->cnid_find_mtime == NULL) {
+        LOG(log_error, logtype_sl, "Spotlight: CNID backend of volume \"%s\" can't search",
+            vol->v_localname);
+        EC_FAIL;
+    }
+
+    EC_NULL_LOG( q = talloc_zero(slq, struct sn_query) );
+    EC_NULL_LOG( q->snq_resbuf = talloc_array(q, char, DBD_MAX_SRCH_RSLTS * sizeof(cnid_t)) );
+
+    EC_ZERO( sn_parse(slq, q) );
+    if (!slq->slq_allow_expr && !sn_simple(q->snq_expr)) {
+        LOG(log_debug, logtype_sl, "Spotlight queries with logic expressions are disabled");
+        EC_FAIL;
+    }
+
+    q->snq_nsrc = sn_plan(q->snq_expr, q->snq_src, SN_MAX_SOURCES);
+    if (slq->slq_cnids
+        && (q->snq_nsrc <= 0 || sl_cnidset_count(slq->slq_cnids) <= SN_SET_SCAN_MAX)) {
+        /*
+         * The query is restricted to a small set of CNIDs, or we would have
+         * to check all files otherwise, check the members of the set instead
+         */
+        q->snq_setscan = true;
+        q->snq_src[0] = NULL;
+        q->snq_nsrc = 1;
+    } else if (q->snq_nsrc <= 0) {
+        LOG(log_debug, logtype_sl, "Spotlight query \"%s\": no usable index, checking all files",
+            slq->slq_qstring);
+        q->snq_src[0] = NULL;
+        q->snq_nsrc = 1;
+    }
+
+    len = strlen(slq->slq_scope);
+    while (len > 0 && slq->slq_scope[len - 1] == '/') {
+        len--;
+    }
+    q->snq_scopelen = len;
+
+    slq->slq_backend_data = q;
+    slq->slq_state = SLQ_STATE_RUNNING;
+
+    sn_fill(slq);
+
+EC_CLEANUP:
+    EC_EXIT;
+}
+
+static void sn_fetch_more(slq_t *slq)
+{
+    switch (slq->slq_state) {
+    case SLQ_STATE_RUNNING:
+    case SLQ_STATE_RESULTS:
+    case SLQ_STATE_FULL:
+        sn_fill(slq);
+        break;
+    default:
+        break;
+    }
+}
+
+static void sn_cancel(slq_t *slq)
+{
+    /* Nothing runs in the background */
+    slq->slq_state = SLQ_STATE_CANCELLED;
+}
+
+const struct sl_backend sl_native_backend = {
+    .sb_name       = "native",
+    .sb_init       = sn_init,
+    .sb_dispatch   = NULL,
+    .sb_open_query = sn_open_query,
+    .sb_fetch_more = sn_fetch_more,
+    .sb_cancel     = sn_cancel,
+    .sb_free       = NULL
+};
+
+/*!
+ * Translate a query and check a file against it, for the tests
+ *
+ * @param vol    (r) volume, for the charsets
+ * @param query  (r) Spotlight query string
+ * @param name   (r) name of the file
+ * @param st     (r) stat of the file
+ * @param nsrc   (w) number of index searches, -1 if all CNIDs would be checked
+ *
+ * @returns 1 if the file matches, 0 if not, -1 if the query is not supported
+ */
+int sl_native_eval(const struct vol *vol, const char *query,
+                   const char *name, const struct stat *st, int *nsrc)
+{
+    slq_t slq;
+    struct sn_query *q;
+    char folded[MAXPATHLEN + 1];
+    int ret = -1;
+
+    memset(&slq, 0, sizeof(slq));
+    slq.slq_vol = vol;
+    slq.slq_qstring = query;
+
+    if ((q = talloc_zero(NULL, struct sn_query)) == NULL) {
+        return -1;
+    }
+    if (sn_parse(&slq, q) == 0 && sn_fold(vol, name, folded)) {
+        if ((*nsrc = sn_plan(q->snq_expr, q->snq_src, SN_MAX_SOURCES)) <= 0) {
+            *nsrc = -1;
+        }
+        ret = sn_eval(q->snq_expr, folded, st) ? 1 : 0;
+    }
+    talloc_free(q);
+    return ret;
+}
+
+/* File change events waiting for sl_index_flush() */
+#define SN_PENDING_MAX 32
+
+static struct {
+    uint16_t  vid;
+    char     *path;             /* file to look up again, NULL to only invalidate the cache */
+} sn_pending[SN_PENDING_MAX];
+static int sn_num_pending;
+static bool sn_pending_overflow;
+
+/*!
+ * Note a file change for sl_index_flush()
+ *
+ * Called for the enabled file change events, whether FCE listeners are
+ * configured or not. This is on the path of the AFP command that changed the
+ * file, so we only remember the change here.
+ *
+ * @param obj    (r) handle
+ * @param event  (r) FCE event
+ * @param path   (r) absolute path of the file or directory
+ */
+void sl_index_event(const AFPObj *obj, fce_ev_t event, const char *path)
+{
+    const struct vol *vol;
+    size_t len;
+    bool lookup;
+    int i;
+
+    if (!(obj->options.flags & OPTION_SPOTLIGHT) || path == NULL) {
+        return;
+    }
+
+    for (vol = getvolumes(); vol; vol = vol->v_next) {
+        if (!(vol->v_flags & AFPVOL_SPOTLIGHT)) {
+            continue;
+        }
+        len = strlen(vol->v_path);
+        if (strncmp(path, vol->v_path, len) == 0 && path[len] == '/') {
+            break;
+        }
+    }
+    if (vol == NULL) {
+        return;
+    }
+
+    switch (event) {
+    case FCE_FILE_MODIFY:
+    case FCE_FILE_CREATE:
+    case FCE_DIR_CREATE:
+        lookup = (obj->options.flags & OPTION_SPOTLIGHT_NATIVE) && vol->v_cdb != NULL;
+        break;
+    default:
+        lookup = false;
+        break;
+    }
+
+    for (i = 0; i < sn_num_pending; i++) {
+        if (sn_pending[i].vid == vol->v_vid
+            && (!lookup || (sn_pending[i].path && strcmp(sn_pending[i].path, path) == 0))) {
+            return;
+        }
+    }
+
+    if (sn_num_pending == SN_PENDING_MAX) {
+        /* Invalidate all volumes, the files are looked up again when clients see them */
+        sn_pending_overflow = true;
+        return;
+    }
+
+    sn_pending[sn_num_pending].vid = vol->v_vid;
+    sn_pending[sn_num_pending].path = lookup ? strdup(path) : NULL;
+    sn_num_pending++;
+}
+
+/*!
+ * Keep the query cache and the CNID database of Spotlight volumes current
+ *
+ * Called after every AFP command. Changes noted by sl_index_event() invalidate
+ * the cached queries of their volume.
+ *
+ * For the native backend, modifying a file doesn't touch the CNID database, so
+ * we look the file up again, which stores its current modification date. New
+ * files get their CNID right away, so they can be found before a client has
+ * seen them.
+ *
+ * @param obj    (r) handle
+ */
+void sl_index_flush(const AFPObj *obj)
+{
+    const struct vol *vol;
+    cnid_t did;
+    int i;
+
+    if (sn_pending_overflow) {
+        for (vol = getvolumes(); vol; vol = vol->v_next) {
+            if (vol->v_flags & AFPVOL_SPOTLIGHT) {
+                sl_cache_invalidate(obj, vol);
+            }
+        }
+        sn_pending_overflow = false;
+    }
+
+    for (i = 0; i < sn_num_pending; i++) {
+        if ((vol = getvolbyvid(sn_pending[i].vid)) != NULL) {
+            sl_cache_invalidate(obj, vol);
+            if (sn_pending[i].path && vol->v_cdb
+                && cnid_for_path(vol->v_cdb, vol->v_path, sn_pending[i].path, &did) == CNID_INVALID) {
+                LOG(log_debug, logtype_sl, "sl_index_flush: no CNID for \"%s\"", sn_pending[i].path);
+            }
+        }
+        free(sn_pending[i].path);
+        sn_pending[i].path = NULL;
+    }
+    sn_num_pending = 0;
+}
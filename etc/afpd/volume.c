@@ -21,6 +21,10 @@
 #include <arpa/inet.h>
 #include <inttypes.h>
 #include <time.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 
 #include <atalk/dsi.h>
 #include <atalk/adouble.h>
@@ -124,6 +128,222 @@ EC_CLEANUP:
     return count;
 }
 
+/*
+ * Sparsebundles of a TimeMachine volume
+ *
+ * Counting the bands of a sparsebundle means reading a directory with tens of
+ * thousands of entries, so we keep the counts between calculations:
+ *
+ * - with inotify, a watch on the bands directory keeps the count up to date,
+ *   including the bands we create and delete ourselves
+ * - otherwise a count stays valid as long as the mtime of the bands directory
+ *   is unchanged
+ * - a count is stored together with that mtime in an EA of the bands
+ *   directory, so other afpd processes don't have to count the bands again
+ *
+ * The mtime has a resolution of a second here, so only counts of directories
+ * whose mtime is in the past are reused, otherwise another change in the same
+ * second would go unnoticed. The band-size is cached by the mtime of the
+ * Info.plist file.
+ */
+struct tm_bundle {
+    struct tm_bundle *next;
+    char            *name;
+    int             seen;           /* found by the last readdir() of the volume */
+    time_t          plist_mtime;    /* of Info.plist when bandsize was read, -1: reread */
+    long long int   bandsize;       /* -1: no valid Info.plist */
+    time_t          bands_mtime;    /* of bands/ when counted, -1: count again */
+    long long int   bands;          /* number of bands, -1: not counted */
+    int             wd;             /* inotify watch of bands/, -1: none */
+};
+
+static struct tm_bundle *tm_bundle_get(struct vol *vol, const char *name)
+{
+    struct tm_bundle *b;
+
+    for (b = vol->v_tm_bundles; b; b = b->next) {
+        if (strcmp(b->name, name) == 0)
+            return b;
+    }
+
+    if ((b = calloc(1, sizeof(struct tm_bundle))) == NULL)
+        return NULL;
+    if ((b->name = strdup(name)) == NULL) {
+        free(b);
+        return NULL;
+    }
+    b->plist_mtime = b->bands_mtime = -1;
+    b->bandsize = b->bands = -1;
+    b->wd = -1;
+    b->next = vol->v_tm_bundles;
+    vol->v_tm_bundles = b;
+    return b;
+}
+
+static void tm_bundle_unwatch(struct vol *vol _U_, struct tm_bundle *b)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    if (b->wd >= 0)
+        inotify_rm_watch(vol->v_tm_ifd, b->wd);
+#endif
+    b->wd = -1;
+}
+
+/* Forget the bundles that are gone, or all of them */
+static void tm_bundles_free(struct vol *vol, int all)
+{
+    struct tm_bundle **bp = &vol->v_tm_bundles, *b;
+
+    while ((b = *bp) != NULL) {
+        if (all || !b->seen) {
+            tm_bundle_unwatch(vol, b);
+            *bp = b->next;
+            free(b->name);
+            free(b);
+        } else {
+            bp = &b->next;
+        }
+    }
+}
+
+/* Apply the changes of watched bands directories since the last call */
+static void tm_read_events(struct vol *vol)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    struct tm_bundle *b;
+    ssize_t len;
+    char *p;
+
+    if (vol->v_tm_ifd < 0)
+        return;
+
+    while ((len = read(vol->v_tm_ifd, buf, sizeof(buf))) > 0) {
+        for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *)p;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                /* events lost, count all bands again */
+                for (b = vol->v_tm_bundles; b; b = b->next) {
+                    tm_bundle_unwatch(vol, b);
+                    b->bands = -1;
+                }
+                continue;
+            }
+
+            for (b = vol->v_tm_bundles; b && b->wd != ev->wd; b = b->next)
+                ;
+            if (b == NULL)
+                continue;
+
+            if (ev->mask & IN_CREATE) {
+                b->bands++;
+            } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                b->bands--;
+            } else {
+                /* moved in, possibly replacing a band, or the watch is gone */
+                tm_bundle_unwatch(vol, b);
+                b->bands = -1;
+            }
+        }
+    }
+#endif
+}
+
+static void tm_get_bandsize(struct tm_bundle *b, const char *path, time_t now)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        b->bandsize = -1;
+        return;
+    }
+    if (b->bandsize != -1 && st.st_mtime == b->plist_mtime)
+        return;
+
+    b->bandsize = get_tm_bandsize(path);
+    b->plist_mtime = (st.st_mtime < now) ? st.st_mtime : -1;
+}
+
+/* Band count stored by another afpd process for this mtime of the bands directory */
+static long long int tm_stored_bands(const char *path, time_t mtime)
+{
+    char buf[64];
+    long long int bands, stored_mtime;
+    ssize_t len;
+
+    if ((len = sys_getxattr(path, TM_BANDS_EA, buf, sizeof(buf) - 1)) <= 0)
+        return -1;
+    buf[len] = 0;
+    if (sscanf(buf, "%lld %lld", &bands, &stored_mtime) != 2
+        || stored_mtime != (long long int)mtime)
+        return -1;
+
+    LOG(log_debug, logtype_afpd, "getused(\"%s\"): %lld bands counted before", path, bands);
+    return bands;
+}
+
+static void tm_count_bands(struct vol *vol, struct tm_bundle *b, const char *path, time_t now)
+{
+    struct stat st, st2;
+    char buf[64];
+    long long int bands;
+    int counted = 0;
+
+    if (b->bands >= 0 && b->wd >= 0)
+        return;
+
+    if (stat(path, &st) != 0) {
+        tm_bundle_unwatch(vol, b);
+        b->bands = -1;
+        return;
+    }
+
+#ifdef HAVE_SYS_INOTIFY_H
+    /* changes after the stat() show up as events or in the mtime */
+    if (b->wd < 0 && vol->v_tm_ifd >= 0)
+        b->wd = inotify_add_watch(vol->v_tm_ifd, path,
+                                  IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                                  | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+#endif
+
+    if (b->bands >= 0 && b->bands_mtime == st.st_mtime) {
+        bands = b->bands;
+    } else if ((bands = tm_stored_bands(path, st.st_mtime)) == -1) {
+        if ((bands = get_tm_bands(path)) == -1) {
+            tm_bundle_unwatch(vol, b);
+            b->bands = -1;
+            return;
+        }
+        counted = 1;
+    }
+
+    b->bands = bands;
+    if (stat(path, &st2) != 0 || st2.st_mtime != st.st_mtime || st.st_mtime >= now) {
+        /* changed while counting, the count is only good for now */
+        tm_bundle_unwatch(vol, b);
+        b->bands_mtime = -1;
+        return;
+    }
+
+    b->bands_mtime = st.st_mtime;
+    if (counted) {
+        snprintf(buf, sizeof(buf), "%lld %lld", bands, (long long int)st.st_mtime);
+        if (sys_setxattr(path, TM_BANDS_EA, buf, strlen(buf), 0) != 0)
+            LOG(log_debug, logtype_afpd, "getused(\"%s\"): can't store band count: %s",
+                path, strerror(errno));
+    }
+}
+
+static void tm_close(struct vol *vol)
+{
+    tm_bundles_free(vol, 1);
+    if (vol->v_tm_ifd >= 0)
+        close(vol->v_tm_ifd);
+    vol->v_tm_ifd = -1;
+}
+
 /*!
  * Calculate used size of a TimeMachine volume
  *
@@ -132,7 +352,7 @@ EC_CLEANUP:
  * 1) readdir(path of volume)
  * 2) for every element that matches regex "\(.*\)\.sparsebundle$" :
  * 3) parse "\1.sparsebundle/Info.plist" and read the band-size XML key integer value
- * 4) readdir "\1.sparsebundle/bands/" counting files
+ * 4) count the files in "\1.sparsebundle/bands/", see struct tm_bundle
  * 5) calculate used size as: (file_count - 1) * band-size
  *
  * The result of the calculation is returned in "volume->v_tm_used".
@@ -150,14 +370,13 @@ EC_CLEANUP:
 static int get_tm_used(struct vol * restrict vol)
 {
     EC_INIT;
-    long long int bandsize;
+    struct tm_bundle *b;
     VolSpace used = 0;
     bstring infoplist = NULL;
     bstring bandsdir = NULL;
     DIR *dir = NULL;
     const struct dirent *entry;
     const char *p;
-    long int links;
     time_t now = time(NULL);
 
     if (vol->v_tm_cachetime
@@ -173,37 +392,50 @@ static int get_tm_used(struct vol * restrict vol)
 
     vol->v_tm_cachetime = now;
 
+#ifdef HAVE_SYS_INOTIFY_H
+    if (vol->v_tm_ifd == -1
+        && (vol->v_tm_ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+        LOG(log_info, logtype_afpd, "getused(\"%s\"): inotify: %s", vol->v_path, strerror(errno));
+        vol->v_tm_ifd = -2;
+    }
+#endif
+    tm_read_events(vol);
+
+    for (b = vol->v_tm_bundles; b; b = b->next)
+        b->seen = 0;
+
     EC_NULL( dir = opendir(vol->v_path) );
 
     while ((entry = readdir(dir)) != NULL) {
         if (((p = strstr(entry->d_name, "sparsebundle")) != NULL)
             && (strlen(entry->d_name) == (p + strlen("sparsebundle") - entry->d_name))) {
 
+            if ((b = tm_bundle_get(vol, entry->d_name)) == NULL)
+                EC_FAIL;
+            b->seen = 1;
+
             EC_NULL_LOG( infoplist = bformat("%s/%s/%s", vol->v_path, entry->d_name, "Info.plist") );
-            
-            if ((bandsize = get_tm_bandsize(cfrombstr(infoplist))) == -1) {
-                bdestroy(infoplist);
-                infoplist = NULL;
+            tm_get_bandsize(b, cfrombstr(infoplist), now);
+            bdestroy(infoplist);
+            infoplist = NULL;
+            if (b->bandsize == -1)
                 continue;
-            }
 
             EC_NULL_LOG( bandsdir = bformat("%s/%s/%s/", vol->v_path, entry->d_name, "bands") );
+            tm_count_bands(vol, b, cfrombstr(bandsdir), now);
 
-            if ((links = get_tm_bands(cfrombstr(bandsdir))) == -1) {
-                bdestroy(infoplist);
-                infoplist = NULL;
-                bdestroy(bandsdir);
-                bandsdir = NULL;
-                continue;
-            }
-
-            used += (links - 1) * bandsize;
+            if (b->bands > 0)
+                used += (b->bands - 1) * b->bandsize;
             LOG(log_debug, logtype_afpd, "getused(\"%s\"): bands: %" PRIu64 " bytes",
                 cfrombstr(bandsdir), used);
+            bdestroy(bandsdir);
+            bandsdir = NULL;
         }
     }
 
+    tm_bundles_free(vol, 0);
     vol->v_tm_used = used;
+    vol->v_appended = 0;
 
 EC_CLEANUP:
     if (infoplist)
@@ -907,6 +1139,7 @@ void closevol(const AFPObj *obj, struct vol *vol)
 
     dir_free( vol->v_root );
     vol->v_root = NULL;
+    tm_close(vol);
     if (vol->v_cdb != NULL) {
         cnid_close(vol->v_cdb);
         vol->v_cdb = NULL;
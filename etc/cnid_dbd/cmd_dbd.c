@@ -273,7 +273,7 @@ int main(int argc, char **argv)
     }
 
     /* Sanity checks to ensure we can touch this volume */
-    if (vol->v_vfs_ea != AFPVOL_EA_AD && vol->v_vfs_ea != AFPVOL_EA_SYS) {
+    if (vol->v_vfs_ea != AFPVOL_EA_AD && vol->v_vfs_ea != AFPVOL_EA_SYS && vol->v_vfs_ea != AFPVOL_EA_TDB) {
         dbd_log( LOGSTD, "Unknown Extended Attributes option: %u", vol->v_vfs_ea);
         exit(EXIT_FAILURE);        
     }
@@ -415,8 +415,8 @@ static int check_eafile_in_adouble(const char *name)
     int ret = 0;
     char *namep, *namedup = NULL;
 
-    /* Check if this is an AFPVOL_EA_AD vol */
-    if (vol->v_vfs_ea == AFPVOL_EA_AD) {
+    /* Check if this is an AFPVOL_EA_AD vol, AFPVOL_EA_TDB vols may still have such files */
+    if (vol->v_vfs_ea == AFPVOL_EA_AD || vol->v_vfs_ea == AFPVOL_EA_TDB) {
         /* Does the filename contain "::EA" ? */
         namedup = strdup(name);
         if ((namep = strstr(namedup, "::EA")) == NULL) {
@@ -454,7 +454,7 @@ static int check_eafile_in_adouble(const char *name)
                 }
             } /* if (access) */
         } /* if strstr */
-    } /* if AFPVOL_EA_AD */
+    } /* if AFPVOL_EA_AD || AFPVOL_EA_TDB */
 
 ea_check_done:
     if (namedup)
@@ -494,8 +494,8 @@ static int read_addir(void)
         if (DIR_DOT_OR_DOTDOT(ep->d_name))
             continue;
 
-        /* Skip ".Parent" */
-        if (STRCMP(ep->d_name, ==, ".Parent"))
+        /* Skip ".Parent" and the EA store */
+        if (STRCMP(ep->d_name, ==, ".Parent") || STRCMP(ep->d_name, ==, EA_STORE_NAME))
             continue;
 
         if ((lstat(ep->d_name, &st)) < 0) {
@@ -762,7 +762,7 @@ static int dbd_readdir(int volroot, cnid_t did)
             cnid = check_cnid(name, did, &st, adfile_ok);
 
             /* Check EA files */
-            if (vol->v_vfs_ea == AFPVOL_EA_AD)
+            if (vol->v_vfs_ea == AFPVOL_EA_AD || vol->v_vfs_ea == AFPVOL_EA_TDB)
                 check_eafiles(name);
         }
 
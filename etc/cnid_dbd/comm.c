@@ -212,8 +212,23 @@ int comm_rcv(struct cnid_dbd_rqst *rqst, time_t timeout, const sigset_t *sigmask
     }
 
     nametmp = (char *)rqst->name;
-    if ((b = readt(cur_fd, rqst, sizeof(struct cnid_dbd_rqst), 1, CNID_DBD_TIMEOUT))
-        != sizeof(struct cnid_dbd_rqst)) {
+    if ((b = readt(cur_fd, &rqst->version, sizeof(rqst->version), 1, CNID_DBD_TIMEOUT))
+        != sizeof(rqst->version)) {
+        if (b)
+            LOG(log_error, logtype_cnid, "error reading message header: %s", strerror(errno));
+        invalidate_fd(cur_fd);
+        return 0;
+    }
+    if (rqst->version != CNID_DBD_PROTO_VERSION) {
+        /* An afpd from before an upgrade, we can't parse its requests */
+        LOG(log_error, logtype_cnid, "comm_rcv: client uses request version 0x%x, expected 0x%x, restart afpd",
+            rqst->version, CNID_DBD_PROTO_VERSION);
+        invalidate_fd(cur_fd);
+        return 0;
+    }
+    if ((b = readt(cur_fd, (char *)rqst + sizeof(rqst->version),
+                   sizeof(struct cnid_dbd_rqst) - sizeof(rqst->version), 1, CNID_DBD_TIMEOUT))
+        != sizeof(struct cnid_dbd_rqst) - sizeof(rqst->version)) {
         if (b)
             LOG(log_error, logtype_cnid, "error reading message header: %s", strerror(errno));
         invalidate_fd(cur_fd);
@@ -221,6 +236,7 @@ int comm_rcv(struct cnid_dbd_rqst *rqst, time_t timeout, const sigset_t *sigmask
         return 0;
     }
     rqst->name = nametmp;
+    b += sizeof(rqst->version);
     if (rqst->namelen && readt(cur_fd, (char *)rqst->name, rqst->namelen, 1, CNID_DBD_TIMEOUT)
         != rqst->namelen) {
         LOG(log_error, logtype_cnid, "error reading message name: %s", strerror(errno));
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2026 Netatalk Team
+ * All Rights Reserved.  See COPYING.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include <atalk/logger.h>
+#include <atalk/cnid_bdb_private.h>
+#include <atalk/cnid.h>
+
+#include "dbif.h"
+#include "dbd.h"
+#include "pack.h"
+
+/*
+ * Attribute database
+ *
+ * Next to the CNID record we store file attributes that catsearch can use to
+ * answer range queries without visiting every file, for now only the modification
+ * date which is indexed in DBIF_IDX_MTIME. They are taken from the stat data afpd
+ * sends with add, lookup, update and rebuild requests, so they are as current
+ * as the last time afpd or dbd looked at the file. catsearch checks all criteria
+ * on the file itself anyway, the index only preselects candidates.
+ *
+ * Every CNID gets an attribute record when it's added or looked up and loses it
+ * when it's deleted, so once every CNID has one, the index knows all files. Databases
+ * that predate the attribute database only get there after dbd has scanned the
+ * volume, until then catsearch walks the volume.
+ */
+
+/*
+ * Counting the records of both databases walks them, so we only count again once
+ * enough CNIDs may have got attributes, or have been deleted without, to fill the
+ * gap we counted last time. Overcounting only means counting again sooner.
+ */
+static int      attr_counted;
+static uint32_t attr_missing;   /* CNIDs without attributes at the last count */
+static uint32_t attr_gained;    /* attribute records added since then */
+
+/*
+ * Store the attributes of cnid from rqst. Only writes if they changed, lookups
+ * are by far the most frequent request and mustn't start a transaction for nothing.
+ */
+int dbd_setattr(DBD *dbd, struct cnid_dbd_rqst *rqst, cnid_t cnid)
+{
+    DBT key, data;
+    char buf[ATTR_DATALEN];
+    uint32_t mtime;
+    int rc;
+
+    if (cnid == CNID_INVALID)
+        return 0;
+
+    memset(&key, 0, sizeof(key));
+    memset(&data, 0, sizeof(data));
+
+    mtime = rqst->mtime < 0 ? 0 : rqst->mtime > UINT32_MAX ? UINT32_MAX : rqst->mtime;
+    mtime = htonl(mtime);
+    memcpy(buf + ATTR_MTIME_OFS, &mtime, ATTR_MTIME_LEN);
+
+    key.data = &cnid;
+    key.size = sizeof(cnid);
+
+    if ((rc = dbif_get(dbd, DBIF_ATTR, &key, &data, 0)) < 0)
+        return -1;
+    if (rc == 1 && data.size == ATTR_DATALEN && memcmp(data.data, buf, ATTR_DATALEN) == 0)
+        return 0;
+    if (rc == 0)
+        attr_gained++;
+
+    memset(&data, 0, sizeof(data));
+    data.data = buf;
+    data.size = ATTR_DATALEN;
+
+    if (dbif_put(dbd, DBIF_ATTR, &key, &data, 0) < 0) {
+        LOG(log_error, logtype_cnid, "dbd_setattr: Unable to update attributes of CNID %u", ntohl(cnid));
+        return -1;
+    }
+
+    LOG(log_maxdebug, logtype_cnid, "dbd_setattr(CNID %u): mtime %u", ntohl(cnid), ntohl(mtime));
+    return 1;
+}
+
+/*
+ * Delete the attributes of the CNID record key refers to in database dbi.
+ * The attribute database isn't associated with the CNID database, records deleted
+ * through one of its indexes must be looked up first.
+ */
+int dbd_delattr(DBD *dbd, int dbi, DBT *key)
+{
+    DBT cnidkey, data;
+    cnid_t cnid;
+    int rc;
+
+    if (dbi != DBIF_CNID) {
+        memset(&data, 0, sizeof(data));
+        if ((rc = dbif_get(dbd, dbi, key, &data, 0)) <= 0)
+            return rc;
+        memcpy(&cnid, (char *)data.data + CNID_OFS, sizeof(cnid));
+
+        memset(&cnidkey, 0, sizeof(cnidkey));
+        cnidkey.data = &cnid;
+        cnidkey.size = sizeof(cnid);
+        key = &cnidkey;
+    }
+
+    if ((rc = dbif_del(dbd, DBIF_ATTR, key, 0)) < 0)
+        return -1;
+    if (rc == 0)
+        attr_gained++;
+    return 0;
+}
+
+/*
+ * Whether every CNID has an attribute record, i.e. whether the modification date
+ * index can answer searches. Once it has, it stays that way.
+ * Returns -1 on error.
+ */
+int dbd_attr_complete(DBD *dbd)
+{
+    static int complete;
+    uint32_t c_cnid, c_attr;
+
+    if (complete)
+        return 1;
+    if (attr_counted && attr_gained < attr_missing)
+        return 0;
+
+    if (dbif_count(dbd, DBIF_CNID, &c_cnid) < 0 || dbif_count(dbd, DBIF_ATTR, &c_attr) < 0)
+        return -1;
+
+    /* The CNID database also holds the rootinfo record */
+    if (c_attr + 1 == c_cnid)
+        complete = 1;
+    /* with stale attribute records we can't tell, so count again after the next change */
+    attr_missing = c_cnid > c_attr + 1 ? c_cnid - c_attr - 1 : 1;
+    attr_gained = 0;
+    attr_counted = 1;
+
+    LOG(log_debug, logtype_cnid, "dbd_attr_complete: %u CNIDs, %u with attributes", c_cnid - 1, c_attr);
+    return complete;
+}
@@ -33,7 +33,8 @@ int dbd_delete(DBD *dbd, struct cnid_dbd_rqst *rqst, struct cnid_dbd_rply *rply,
         buf = pack_cnid_data(rqst);
         key.data = buf + CNID_DEVINO_OFS;
         key.size = CNID_DEVINO_LEN;
-        if ((rc = dbif_del(dbd, DBIF_IDX_DEVINO, &key, 0)) < 0) {
+        if (dbd_delattr(dbd, DBIF_IDX_DEVINO, &key) < 0
+            || (rc = dbif_del(dbd, DBIF_IDX_DEVINO, &key, 0)) < 0) {
             LOG(log_error, logtype_cnid, "dbd_delete: Unable to delete entry for dev/ino: 0x%llx/0x%llx",
                 (unsigned long long)rqst->dev, (unsigned long long)rqst->ino);
             rply->result = CNID_DBD_RES_ERR_DB;
@@ -53,7 +54,8 @@ int dbd_delete(DBD *dbd, struct cnid_dbd_rqst *rqst, struct cnid_dbd_rply *rply,
         buf = pack_cnid_data(rqst);
         key.data = buf + CNID_DID_OFS;
         key.size = CNID_DID_LEN + rqst->namelen + 1;
-        if ((rc = dbif_del(dbd, DBIF_IDX_DIDNAME, &key, 0)) < 0) {
+        if (dbd_delattr(dbd, DBIF_IDX_DIDNAME, &key) < 0
+            || (rc = dbif_del(dbd, DBIF_IDX_DIDNAME, &key, 0)) < 0) {
             LOG(log_error, logtype_cnid, "dbd_delete: Unable to delete entry for DID: %lu, name: %s",
                 ntohl(rqst->did), rqst->name);
             rply->result = CNID_DBD_RES_ERR_DB;
@@ -78,6 +80,11 @@ int dbd_delete(DBD *dbd, struct cnid_dbd_rqst *rqst, struct cnid_dbd_rply *rply,
             rply->result = CNID_DBD_RES_ERR_DB;
             return -1;
         }
+        if (dbd_delattr(dbd, DBIF_CNID, &key) < 0) {
+            LOG(log_error, logtype_cnid, "dbd_delete: Unable to delete attributes for CNID %u", ntohl(rqst->cnid));
+            rply->result = CNID_DBD_RES_ERR_DB;
+            return -1;
+        }
         if (rc) {
             LOG(log_debug, logtype_cnid, "cnid_delete: CNID %u deleted", ntohl(rqst->cnid));
             rply->result = CNID_DBD_RES_OK;
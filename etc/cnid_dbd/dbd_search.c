@@ -13,6 +13,7 @@
 
 #include <atalk/logger.h>
 #include <atalk/cnid_bdb_private.h>
+#include <atalk/cnid.h>
 
 #include "dbif.h"
 #include "dbd.h"
@@ -49,3 +50,93 @@ int dbd_search(DBD *dbd, struct cnid_dbd_rqst *rqst, struct cnid_dbd_rply *rply)
 
     return 1;
 }
+
+/*
+ * Substring search, rqst->cnid is where to continue a previous search, 0 for a new one.
+ * Returns CNID_DBD_RES_SRCH_CNT with the CNID to continue at in rply->cnid,
+ * or CNID_DBD_RES_SRCH_DONE when there are no more matches.
+ */
+int dbd_search_substr(DBD *dbd, struct cnid_dbd_rqst *rqst, struct cnid_dbd_rply *rply)
+{
+    int results;
+    cnid_t next = rqst->cnid;
+    static char resbuf[DBD_MAX_SRCH_RSLTS * sizeof(cnid_t)];
+
+    LOG(log_debug, logtype_cnid, "dbd_search_substr(\"%s\", next: %u):", rqst->name, ntohl(next));
+
+    rply->name = resbuf;
+    rply->namelen = 0;
+    rply->cnid = 0;
+
+    if ((results = dbif_search_substr(dbd, rqst->name, rqst->namelen, &next, resbuf)) < 0) {
+        LOG(log_error, logtype_cnid, "dbd_search_substr(\"%s\"): db error", rqst->name);
+        rply->result = CNID_DBD_RES_ERR_DB;
+        return -1;
+    }
+
+    LOG(log_debug, logtype_cnid, "dbd_search_substr(\"%s\"): %d matches, next: %u",
+        rqst->name, results, ntohl(next));
+
+    rply->namelen = results * sizeof(cnid_t);
+    rply->cnid = next;
+    rply->result = next ? CNID_DBD_RES_SRCH_CNT : CNID_DBD_RES_SRCH_DONE;
+
+    return 1;
+}
+
+/*
+ * Modification date range search, rqst->name holds the range as two uint32_t
+ * in network byte order, rqst->cnid is where to continue a previous search,
+ * 0 for a new one. On CNID_DBD_RES_SRCH_CNT the search continues at the
+ * date in rply->did and the CNID in rply->cnid. CNID_DBD_RES_NOTFOUND means
+ * the index doesn't know all files yet.
+ */
+int dbd_search_mtime(DBD *dbd, struct cnid_dbd_rqst *rqst, struct cnid_dbd_rply *rply)
+{
+    int results;
+    uint32_t from, to;
+    cnid_t next = rqst->cnid;
+    static char resbuf[DBD_MAX_SRCH_RSLTS * sizeof(cnid_t)];
+
+    rply->name = resbuf;
+    rply->namelen = 0;
+    rply->cnid = 0;
+    rply->did = 0;
+
+    if (rqst->namelen != 2 * sizeof(uint32_t)) {
+        LOG(log_error, logtype_cnid, "dbd_search_mtime: bad request");
+        rply->result = CNID_DBD_RES_ERR_DB;
+        return -1;
+    }
+    memcpy(&from, rqst->name, sizeof(uint32_t));
+    memcpy(&to, rqst->name + sizeof(uint32_t), sizeof(uint32_t));
+    from = ntohl(from);
+    to = ntohl(to);
+
+    LOG(log_debug, logtype_cnid, "dbd_search_mtime(%u - %u, next: %u):", from, to, ntohl(next));
+
+    if (next == CNID_INVALID && (results = dbd_attr_complete(dbd)) != 1) {
+        if (results < 0) {
+            rply->result = CNID_DBD_RES_ERR_DB;
+            return -1;
+        }
+        LOG(log_debug, logtype_cnid, "dbd_search_mtime: index incomplete");
+        rply->result = CNID_DBD_RES_NOTFOUND;
+        return 1;
+    }
+
+    if ((results = dbif_search_mtime(dbd, &from, to, &next, resbuf)) < 0) {
+        LOG(log_error, logtype_cnid, "dbd_search_mtime: db error");
+        rply->result = CNID_DBD_RES_ERR_DB;
+        return -1;
+    }
+
+    LOG(log_debug, logtype_cnid, "dbd_search_mtime: %d matches, next: %u/%u", results, from, ntohl(next));
+
+    rply->namelen = results * sizeof(cnid_t);
+    rply->cnid = next;
+    rply->did = htonl(from);
+    rply->result = next ? CNID_DBD_RES_SRCH_CNT : CNID_DBD_RES_SRCH_DONE;
+
+    return 1;
+}
@@ -8,6 +8,8 @@
 #include "config.h"
 #endif /* HAVE_CONFIG_H */
 
+#include <atalk/standards.h>
+
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -362,18 +364,29 @@ DBD *dbif_init(const char *envhome, const char *filename)
     dbd->db_table[DBIF_IDX_DEVINO].name  = "devino.db";
     dbd->db_table[DBIF_IDX_DIDNAME].name = "didname.db";
     dbd->db_table[DBIF_IDX_NAME].name    = "name.db";
+    dbd->db_table[DBIF_IDX_TRIGRAM].name = "trigram.db";
+    dbd->db_table[DBIF_ATTR].name        = "attr.db";
+    dbd->db_table[DBIF_IDX_MTIME].name   = "mtime.db";
 
     dbd->db_table[DBIF_CNID].type        = DB_BTREE;
     dbd->db_table[DBIF_IDX_DEVINO].type  = DB_BTREE;
     dbd->db_table[DBIF_IDX_DIDNAME].type = DB_BTREE;
     dbd->db_table[DBIF_IDX_NAME].type    = DB_BTREE;
+    dbd->db_table[DBIF_IDX_TRIGRAM].type = DB_BTREE;
+    dbd->db_table[DBIF_ATTR].type        = DB_BTREE;
+    dbd->db_table[DBIF_IDX_MTIME].type   = DB_BTREE;
 
     dbd->db_table[DBIF_CNID].openflags        = DB_CREATE;
     dbd->db_table[DBIF_IDX_DEVINO].openflags  = DB_CREATE;
     dbd->db_table[DBIF_IDX_DIDNAME].openflags = DB_CREATE;
     dbd->db_table[DBIF_IDX_NAME].openflags    = DB_CREATE;
+    dbd->db_table[DBIF_IDX_TRIGRAM].openflags = DB_CREATE;
+    dbd->db_table[DBIF_ATTR].openflags        = DB_CREATE;
+    dbd->db_table[DBIF_IDX_MTIME].openflags   = DB_CREATE;
 
-    dbd->db_table[DBIF_IDX_NAME].flags = DB_DUPSORT;
+    dbd->db_table[DBIF_IDX_NAME].flags    = DB_DUPSORT;
+    dbd->db_table[DBIF_IDX_TRIGRAM].flags = DB_DUPSORT;
+    dbd->db_table[DBIF_IDX_MTIME].flags   = DB_DUPSORT;
 
     return dbd;
 }
@@ -595,7 +608,8 @@ int dbif_open(DBD *dbd, struct db_param *dbp, int reindex)
             return -1;
         }
 
-        if (reindex && i > 0) {
+        /* The attribute database is a primary, it can't be rebuilt from the CNID database */
+        if (reindex && i > 0 && i != DBIF_ATTR) {
             LOG(log_info, logtype_cnid, "Truncating CNID index.");
             if ((ret = dbd->db_table[i].db->truncate(dbd->db_table[i].db, NULL, &count, 0))) {
                 LOG(log_error, logtype_cnid, "error truncating database %s: %s",
@@ -641,7 +655,8 @@ int dbif_open(DBD *dbd, struct db_param *dbp, int reindex)
 
     /*
      * Upgrading from version 0 to 1 requires adding the name index below which
-     * must be done by specifying the DB_CREATE flag
+     * must be done by specifying the DB_CREATE flag, likewise the trigram index
+     * when upgrading to version 2
      */
     uint32_t version = CNID_VERSION;
     if (dbd->db_envhome && !reindex) {
@@ -649,13 +664,26 @@ int dbif_open(DBD *dbd, struct db_param *dbp, int reindex)
             return -1;
     }
 
+    /*
+     * Versions before 2 don't know the trigram index and the attribute database and
+     * set the version back to theirs when they open the database. If one has been
+     * running since we last had the database, these are stale, so start them over.
+     */
+    if (!reindex && version < CNID_VERSION_2) {
+        for (i = DBIF_IDX_TRIGRAM; i < DBIF_DB_CNT; i++) {
+            if ((ret = dbd->db_table[i].db->truncate(dbd->db_table[i].db, NULL, &count, 0))) {
+                LOG(log_error, logtype_cnid, "error truncating database %s: %s",
+                    dbd->db_table[i].name, db_strerror(ret));
+                return -1;
+            }
+        }
+    }
+
     if ((ret = dbd->db_table[0].db->associate(dbd->db_table[0].db, 
                                               dbd->db_txn,
                                               dbd->db_table[DBIF_IDX_NAME].db, 
                                               idxname,
-                                              (reindex
-                                               || 
-                                               ((CNID_VERSION == CNID_VERSION_1) && (version == CNID_VERSION_0)))
+                                              (reindex || version < CNID_VERSION_1)
                                               ? DB_CREATE : 0)) != 0) {
         LOG(log_error, logtype_cnid, "Failed to associate name index: %s", db_strerror(ret));
         return -1;
@@ -663,6 +691,33 @@ int dbif_open(DBD *dbd, struct db_param *dbp, int reindex)
     if (reindex)
         LOG(log_info, logtype_cnid, "... done.");
 
+    if (reindex || version < CNID_VERSION_2)
+        LOG(log_info, logtype_cnid, "Reindexing trigram index...");
+    if ((ret = dbd->db_table[0].db->associate(dbd->db_table[0].db,
+                                              dbd->db_txn,
+                                              dbd->db_table[DBIF_IDX_TRIGRAM].db,
+                                              idxtrigram,
+                                              (reindex || version < CNID_VERSION_2)
+                                              ? DB_CREATE : 0)) != 0) {
+        LOG(log_error, logtype_cnid, "Failed to associate trigram index: %s", db_strerror(ret));
+        return -1;
+    }
+    if (reindex || version < CNID_VERSION_2)
+        LOG(log_info, logtype_cnid, "... done.");
+
+    /*
+     * The modification date index belongs to the attribute database, not to the
+     * CNID database. Both are created empty and filled as afpd looks up files.
+     */
+    if ((ret = dbd->db_table[DBIF_ATTR].db->associate(dbd->db_table[DBIF_ATTR].db,
+                                                      dbd->db_txn,
+                                                      dbd->db_table[DBIF_IDX_MTIME].db,
+                                                      idxmtime,
+                                                      reindex ? DB_CREATE : 0)) != 0) {
+        LOG(log_error, logtype_cnid, "Failed to associate mtime index: %s", db_strerror(ret));
+        return -1;
+    }
+
     if ((dbd->db_envhome) && ((ret = dbif_upgrade(dbd)) != 0)) {
         LOG(log_error, logtype_cnid, "Error upgrading CNID database to version %d", CNID_VERSION);
         return -1;
@@ -953,6 +1008,311 @@ exit:
     return ret;
 }
 
+/* Maximum number of query trigrams we intersect, the rest is checked by the name compare */
+#define DBIF_MAX_TRIGRAMS  8
+/* Maximum number of index entries dbif_search_substr() looks at per call */
+#define DBIF_MAX_SRCH_SCAN 10000
+
+/*!
+ * Position cursor at the first CNID >= *cnid that has trigram tri in its name
+ *
+ * @returns 0 and the CNID in *cnid, DB_NOTFOUND if there's none, BerkeleyDB error otherwise
+ */
+static int dbif_trigram_seek(DBC *cursorp, const char *tri, cnid_t *cnid)
+{
+    int ret;
+    DBT key, pkey, data;
+    cnid_t start = htonl(*cnid);
+
+    memset(&key, 0, sizeof(DBT));
+    memset(&pkey, 0, sizeof(DBT));
+    memset(&data, 0, sizeof(DBT));
+
+    key.data = (char *)tri;
+    key.size = TRIGRAM_LEN;
+    pkey.data = &start;
+    pkey.size = sizeof(cnid_t);
+    /* We only want the primary key, not the data */
+    data.flags = DB_DBT_PARTIAL;
+
+    /* CNIDs are stored in network byte order, so the duplicates are sorted by CNID */
+    if ((ret = cursorp->pget(cursorp, &key, &pkey, &data, DB_GET_BOTH_RANGE)) != 0)
+        return ret;
+
+    memcpy(cnid, pkey.data, sizeof(cnid_t));
+    *cnid = ntohl(*cnid);
+    return 0;
+}
+
+/*!
+ * Check whether the name of a CNID contains the case-folded string name
+ *
+ * @returns 1 if it does, 0 if not or if there's no such CNID, -1 on error
+ */
+static int dbif_name_contains(DBD *dbd, cnid_t cnid, const char *name, size_t namelen)
+{
+    DBT key, data;
+    char folded[MAXPATHLEN + 2];
+    size_t len;
+    int ret;
+
+    memset(&key, 0, sizeof(DBT));
+    memset(&data, 0, sizeof(DBT));
+    cnid = htonl(cnid);
+    key.data = &cnid;
+    key.size = sizeof(cnid_t);
+
+    if ((ret = dbif_get(dbd, DBIF_CNID, &key, &data, 0)) <= 0)
+        return ret;
+
+    len = pack_foldname((char *)data.data + CNID_NAME_OFS, folded);
+    return memmem(folded, len, name, namelen) != NULL;
+}
+
+/*!
+ * Search the database for names containing a substring
+ *
+ * This is a streaming search: each call looks at a bounded number of index entries
+ * and returns at most DBD_MAX_SRCH_RSLTS results, ordered by CNID. The search is
+ * continued by passing in the CNID returned in *next.
+ *
+ * With at least TRIGRAM_LEN bytes we intersect the trigram index lists of the
+ * query's trigrams and then check the candidates names, shorter strings can't
+ * use the index so we check the names of all CNIDs.
+ *
+ * @param name      (r) case-folded substring to search for
+ * @param namelen   (r) length of name
+ * @param next      (rw) CNID (network byte order) to start at, 0 for a new search.
+ *                       Returns the CNID to continue at, or 0 when the search is done.
+ * @param resbuf    (w) buffer for search results CNIDs, maxsize is assumed to be
+ *                      DBD_MAX_SRCH_RSLTS * sizefof(cnid_t)
+ *
+ * @returns -1 on error, else the number of matches
+ */
+int dbif_search_substr(DBD *dbd, const char *name, size_t namelen, cnid_t *next, char *resbuf)
+{
+    int ret = 0;
+    int count = 0;
+    int scanned = 0;
+    int ntri = 0;
+    int agree, i;
+    DBC *cursors[DBIF_MAX_TRIGRAMS];
+    DBC *cursorp = NULL;
+    DBT key, data;
+    cnid_t cand, found, tmp;
+    size_t pos;
+
+    memset(cursors, 0, sizeof(cursors));
+    memset(&key, 0, sizeof(DBT));
+    memset(&data, 0, sizeof(DBT));
+
+    cand = ntohl(*next);
+    if (cand < CNID_START)
+        cand = CNID_START;
+    *next = 0;
+
+    if (namelen >= TRIGRAM_LEN) {
+        /* Use the non-overlapping trigrams of the query */
+        for (pos = 0; pos + TRIGRAM_LEN <= namelen && ntri < DBIF_MAX_TRIGRAMS; pos += TRIGRAM_LEN) {
+            ret = dbd->db_table[DBIF_IDX_TRIGRAM].db->cursor(dbd->db_table[DBIF_IDX_TRIGRAM].db,
+                                                             NULL,
+                                                             &cursors[ntri],
+                                                             0);
+            if (ret != 0) {
+                LOG(log_error, logtype_cnid, "Couldn't create cursor: %s", db_strerror(ret));
+                ret = -1;
+                goto exit;
+            }
+            ntri++;
+        }
+
+        while (count < DBD_MAX_SRCH_RSLTS) {
+            /*
+             * Leapfrog join: advance the lists until they all agree on one CNID.
+             * No CNID below cand can match, so that's where we continue if we
+             * run out of budget.
+             */
+            agree = 0;
+            i = 0;
+            while (agree < ntri) {
+                if (scanned >= DBIF_MAX_SRCH_SCAN) {
+                    *next = htonl(cand);
+                    goto done;
+                }
+                found = cand;
+                ret = dbif_trigram_seek(cursors[i], name + i * TRIGRAM_LEN, &found);
+                scanned++;
+                if (ret == DB_NOTFOUND)
+                    goto done;
+                if (ret != 0) {
+                    LOG(log_error, logtype_cnid, "dbif_search_substr: %s", db_strerror(ret));
+                    ret = -1;
+                    goto exit;
+                }
+                if (found == cand) {
+                    agree++;
+                } else {
+                    cand = found;
+                    agree = 1;
+                }
+                i = (i + 1) % ntri;
+            }
+
+            if ((ret = dbif_name_contains(dbd, cand, name, namelen)) == -1)
+                goto exit;
+            if (ret == 1) {
+                tmp = htonl(cand);
+                memcpy(resbuf + count * sizeof(cnid_t), &tmp, sizeof(cnid_t));
+                count++;
+                LOG(log_debug, logtype_cnid, "match: CNID %" PRIu32, cand);
+            }
+
+            if (cand == UINT32_MAX)
+                goto done;
+            cand++;
+            if (count == DBD_MAX_SRCH_RSLTS)
+                *next = htonl(cand);
+        }
+    } else {
+        /* Too short for the trigram index, walk all CNIDs */
+        char folded[MAXPATHLEN + 2];
+        size_t len;
+
+        ret = dbd->db_table[DBIF_CNID].db->cursor(dbd->db_table[DBIF_CNID].db,
+                                                  NULL,
+                                                  &cursorp,
+                                                  0);
+        if (ret != 0) {
+            LOG(log_error, logtype_cnid, "Couldn't create cursor: %s", db_strerror(ret));
+            ret = -1;
+            goto exit;
+        }
+
+        tmp = htonl(cand);
+        key.data = &tmp;
+        key.size = sizeof(cnid_t);
+        ret = cursorp->get(cursorp, &key, &data, DB_SET_RANGE);
+        while (ret == 0) {
+            memcpy(&cand, key.data, sizeof(cnid_t));
+            cand = ntohl(cand);
+            if (count == DBD_MAX_SRCH_RSLTS || scanned >= DBIF_MAX_SRCH_SCAN) {
+                *next = htonl(cand);
+                break;
+            }
+            scanned++;
+            len = pack_foldname((char *)data.data + CNID_NAME_OFS, folded);
+            if (memmem(folded, len, name, namelen) != NULL) {
+                memcpy(resbuf + count * sizeof(cnid_t), key.data, sizeof(cnid_t));
+                count++;
+                LOG(log_debug, logtype_cnid, "match: CNID %" PRIu32, cand);
+            }
+            ret = cursorp->get(cursorp, &key, &data, DB_NEXT);
+        }
+        if (ret != 0 && ret != DB_NOTFOUND) {
+            LOG(log_error, logtype_cnid, "dbif_search_substr: %s", db_strerror(ret));
+            ret = -1;
+            goto exit;
+        }
+    }
+
+done:
+    ret = count;
+
+exit:
+    for (i = 0; i < ntri; i++)
+        cursors[i]->close(cursors[i]);
+    if (cursorp != NULL)
+        cursorp->close(cursorp);
+    return ret;
+}
+
+/*!
+ * Search the modification date index
+ *
+ * Returns the CNIDs with a modification date in the range [*from, to], ordered
+ * by date and CNID, at most DBD_MAX_SRCH_RSLTS per call.
+ *
+ * @param from      (rw) start of the range. Returns the date to continue at.
+ * @param to        (r)  end of the range
+ * @param next      (rw) CNID (network byte order) to start at within *from, 0 for a
+ *                       new search. Returns the CNID to continue at, or 0 when done.
+ * @param resbuf    (w)  buffer for search results CNIDs, maxsize is assumed to be
+ *                       DBD_MAX_SRCH_RSLTS * sizefof(cnid_t)
+ *
+ * @returns -1 on error, else the number of matches
+ */
+int dbif_search_mtime(DBD *dbd, uint32_t *from, uint32_t to, cnid_t *next, char *resbuf)
+{
+    int ret;
+    int count = 0;
+    DBC *cursorp = NULL;
+    DBT key, pkey, data;
+    uint32_t mtime;
+    cnid_t cnid;
+
+    memset(&key, 0, sizeof(DBT));
+    memset(&pkey, 0, sizeof(DBT));
+    memset(&data, 0, sizeof(DBT));
+
+    ret = dbd->db_table[DBIF_IDX_MTIME].db->cursor(dbd->db_table[DBIF_IDX_MTIME].db,
+                                                   NULL,
+                                                   &cursorp,
+                                                   0);
+    if (ret != 0) {
+        LOG(log_error, logtype_cnid, "Couldn't create cursor: %s", db_strerror(ret));
+        return -1;
+    }
+
+    mtime = htonl(*from);
+    key.data = &mtime;
+    key.size = sizeof(mtime);
+    /* We only want the primary key, not the data */
+    data.flags = DB_DBT_PARTIAL;
+
+    if (*next != CNID_INVALID) {
+        /* Continue within the dates duplicates, or with the next date */
+        pkey.data = next;
+        pkey.size = sizeof(cnid_t);
+        ret = cursorp->pget(cursorp, &key, &pkey, &data, DB_GET_BOTH_RANGE);
+        if (ret == DB_NOTFOUND && *from < to) {
+            mtime = htonl(*from + 1);
+            memset(&pkey, 0, sizeof(DBT));
+            ret = cursorp->pget(cursorp, &key, &pkey, &data, DB_SET_RANGE);
+        }
+    } else {
+        ret = cursorp->pget(cursorp, &key, &pkey, &data, DB_SET_RANGE);
+    }
+
+    *next = CNID_INVALID;
+
+    while (ret == 0) {
+        memcpy(&mtime, key.data, sizeof(mtime));
+        mtime = ntohl(mtime);
+        if (mtime > to)
+            break;
+        if (count == DBD_MAX_SRCH_RSLTS) {
+            *from = mtime;
+            memcpy(next, pkey.data, sizeof(cnid_t));
+            break;
+        }
+        memcpy(&cnid, pkey.data, sizeof(cnid_t));
+        if (ntohl(cnid) >= CNID_START) {
+            memcpy(resbuf + count * sizeof(cnid_t), &cnid, sizeof(cnid_t));
+            count++;
+            LOG(log_debug, logtype_cnid, "match: CNID %" PRIu32, ntohl(cnid));
+        }
+        ret = cursorp->pget(cursorp, &key, &pkey, &data, DB_NEXT);
+    }
+
+    if (ret != 0 && ret != DB_NOTFOUND) {
+        LOG(log_error, logtype_cnid, "dbif_search_mtime: %s", db_strerror(ret));
+        count = -1;
+    }
+
+    cursorp->close(cursorp);
+    return count;
+}
+
 int dbif_txn_begin(DBD *dbd)
 {
     int ret;
@@ -57,12 +57,15 @@
 #include <atalk/adouble.h>
 #include "db_param.h"
 
-#define DBIF_DB_CNT 4
+#define DBIF_DB_CNT 7
  
 #define DBIF_CNID          0
 #define DBIF_IDX_DEVINO    1
 #define DBIF_IDX_DIDNAME   2
 #define DBIF_IDX_NAME      3
+#define DBIF_IDX_TRIGRAM   4
+#define DBIF_ATTR          5
+#define DBIF_IDX_MTIME     6
 
 #define LOCKFILENAME  "lock"
 #define LOCK_FREE          0
@@ -102,6 +105,8 @@ extern int dbif_put(DBD *, const int, DBT *, DBT *, u_int32_t);
 extern int dbif_del(DBD *, const int, DBT *, u_int32_t);
 extern int dbif_count(DBD *, const int, u_int32_t *);
 extern int dbif_search(DBD *dbd, DBT *key, char *resbuf);
+extern int dbif_search_substr(DBD *dbd, const char *name, size_t namelen, cnid_t *next, char *resbuf);
+extern int dbif_search_mtime(DBD *dbd, uint32_t *from, uint32_t to, cnid_t *next, char *resbuf);
 extern int dbif_copy_rootinfokey(DBD *srcdbd, DBD *destdbd);
 extern int dbif_txn_begin(DBD *);
 extern int dbif_txn_commit(DBD *);
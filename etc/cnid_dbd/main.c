@@ -372,6 +372,12 @@ static int loop(struct db_param *dbp)
             case CNID_DBD_OP_SEARCH:
                 ret = dbd_search(dbd, &rqst, &rply);
                 break;
+            case CNID_DBD_OP_SEARCH_SUBSTR:
+                ret = dbd_search_substr(dbd, &rqst, &rply);
+                break;
+            case CNID_DBD_OP_SEARCH_MTIME:
+                ret = dbd_search_mtime(dbd, &rqst, &rply);
+                break;
             case CNID_DBD_OP_WIPE:
                 ret = reinit_db();
                 break;
@@ -381,6 +387,26 @@ static int loop(struct db_param *dbp)
                 break;
             }
 
+            /* Keep the attribute database current, if we can't the request fails and is rolled back */
+            if (ret > 0 && rply.result == CNID_DBD_RES_OK) {
+                switch (rqst.op) {
+                case CNID_DBD_OP_ADD:
+                case CNID_DBD_OP_LOOKUP:
+                case CNID_DBD_OP_REBUILD_ADD:
+                    if (dbd_setattr(dbd, &rqst, rply.cnid) < 0)
+                        ret = 0;
+                    break;
+                case CNID_DBD_OP_UPDATE:
+                    if (dbd_setattr(dbd, &rqst, rqst.cnid) < 0)
+                        ret = 0;
+                    break;
+                }
+                if (ret == 0) {
+                    rply.result = CNID_DBD_RES_ERR_DB;
+                    rply.cnid = CNID_INVALID;
+                }
+            }
+
             if ((cret = comm_snd(&rply)) < 0 || ret < 0) {
                 dbif_txn_abort(dbd);
                 return -1;
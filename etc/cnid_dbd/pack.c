@@ -10,6 +10,8 @@
 
 #include <arpa/inet.h>
 
+#include <stdlib.h>
+#include <errno.h>
 #include <string.h>
 #include <inttypes.h>
 #include <sys/param.h>
@@ -73,26 +75,101 @@ int devino(DB *dbp _U_, const DBT *pkey _U_,  const DBT *pdata, DBT *skey)
     return (0);
 }
 
-/* --------------- */
-int idxname(DB *dbp _U_, const DBT *pkey _U_,  const DBT *pdata, DBT *skey)
+/*!
+ * Case-fold a name the way the name indexes store it
+ *
+ * @param name   (r) nul terminated name in volume charset
+ * @param buf    (w) buffer of at least MAXPATHLEN + 2 bytes
+ *
+ * @returns length of the folded name in buf
+ */
+size_t pack_foldname(const char *name, char *buf)
 {
-    static char buffer[MAXPATHLEN +2];
     uint16_t flags = CONV_TOLOWER;
-    memset(skey, 0, sizeof(DBT));
 
+    buf[0] = 0;
     if (convert_charset(volume->v_volcharset,
                         volume->v_volcharset,
                         volume->v_maccharset,
-                        (char *)pdata->data + CNID_NAME_OFS,
-                        strlen((char *)pdata->data + CNID_NAME_OFS),
-                        buffer,
+                        name,
+                        strlen(name),
+                        buf,
                         MAXPATHLEN,
                         &flags) == (size_t)-1) {
-        LOG(log_error, logtype_cnid, "idxname: conversion error");
+        LOG(log_error, logtype_cnid, "pack_foldname: conversion error");
     }
 
+    return strlen(buf);
+}
+
+/* --------------- */
+int idxname(DB *dbp _U_, const DBT *pkey _U_,  const DBT *pdata, DBT *skey)
+{
+    static char buffer[MAXPATHLEN +2];
+    memset(skey, 0, sizeof(DBT));
+
     skey->data = buffer;
-    skey->size = strlen(skey->data);
+    skey->size = pack_foldname((char *)pdata->data + CNID_NAME_OFS, buffer);
+    return (0);
+}
+
+static int trigram_cmp(const void *a, const void *b)
+{
+    return memcmp(a, b, TRIGRAM_LEN);
+}
+
+/* --------------- */
+/*
+ * Trigram index: every distinct sequence of TRIGRAM_LEN bytes of the case-folded
+ * name is a secondary key. We return them all at once as DB_DBT_MULTIPLE, with the
+ * DBT array and the trigrams in one malloced chunk that BerkeleyDB frees for us.
+ */
+int idxtrigram(DB *dbp _U_, const DBT *pkey _U_,  const DBT *pdata, DBT *skey)
+{
+    char name[MAXPATHLEN + 2];
+    char *trigrams;
+    DBT *keys;
+    size_t len, ntri, i, n;
+
+    memset(skey, 0, sizeof(DBT));
+
+    len = pack_foldname((char *)pdata->data + CNID_NAME_OFS, name);
+    if (len < TRIGRAM_LEN)
+        return DB_DONOTINDEX;
+    ntri = len - TRIGRAM_LEN + 1;
+
+    if ((keys = malloc(ntri * (sizeof(DBT) + TRIGRAM_LEN))) == NULL) {
+        LOG(log_error, logtype_cnid, "idxtrigram: out of memory");
+        return ENOMEM;
+    }
+    trigrams = (char *)(keys + ntri);
+
+    for (i = 0; i < ntri; i++)
+        memcpy(trigrams + i * TRIGRAM_LEN, name + i, TRIGRAM_LEN);
+
+    /* BerkeleyDB doesn't want the same secondary key twice for one record */
+    qsort(trigrams, ntri, TRIGRAM_LEN, trigram_cmp);
+    for (i = 0, n = 0; i < ntri; i++) {
+        if (n > 0 && memcmp(keys[n - 1].data, trigrams + i * TRIGRAM_LEN, TRIGRAM_LEN) == 0)
+            continue;
+        memset(&keys[n], 0, sizeof(DBT));
+        keys[n].data = trigrams + i * TRIGRAM_LEN;
+        keys[n].size = TRIGRAM_LEN;
+        n++;
+    }
+
+    skey->data = keys;
+    skey->size = n;
+    skey->flags = DB_DBT_MULTIPLE | DB_DBT_APPMALLOC;
+    return (0);
+}
+
+/* --------------- */
+int idxmtime(DB *dbp _U_, const DBT *pkey _U_,  const DBT *pdata, DBT *skey)
+{
+    memset(skey, 0, sizeof(DBT));
+    skey->data = (char *)pdata->data + ATTR_MTIME_OFS;
+    skey->size = ATTR_MTIME_LEN;
     return (0);
 }
 
@@ -10,9 +10,20 @@
 #include <db.h>
 #include <atalk/cnid_bdb_private.h>
 
+/* Length of the keys in the trigram index */
+#define TRIGRAM_LEN 3
+
+/* Records of the attribute database, keyed by CNID. Modification date in network byte order. */
+#define ATTR_MTIME_OFS 0
+#define ATTR_MTIME_LEN 4
+#define ATTR_DATALEN   (ATTR_MTIME_OFS + ATTR_MTIME_LEN)
+
 extern unsigned char *pack_cnid_data(struct cnid_dbd_rqst *);
 extern int didname(DB *dbp, const DBT *pkey, const DBT *pdata, DBT *skey);
 extern int devino(DB *dbp, const DBT *pkey, const DBT *pdata, DBT *skey);
 extern int idxname(DB *dbp, const DBT *pkey, const DBT *pdata, DBT *skey);
+extern int idxtrigram(DB *dbp, const DBT *pkey, const DBT *pdata, DBT *skey);
+extern int idxmtime(DB *dbp, const DBT *pkey, const DBT *pdata, DBT *skey);
+extern size_t pack_foldname(const char *name, char *buf);
 extern void pack_setvol(const struct vol *vol);
 #endif /* CNID_DBD_PACK_H */
@@ -360,9 +360,9 @@ static void show_netatalk_version( void )
 
 	printf( "     Spotlight support:\t" );
 #ifdef HAVE_TRACKER
-	puts( "Yes" );
+	puts( "Yes (native, Tracker)" );
 #else
-	puts( "No" );
+	puts( "Yes (native)" );
 #endif
 
 }
@@ -484,7 +484,7 @@ int main(int argc, char **argv)
     sigprocmask(SIG_SETMASK, &blocksigs, NULL);
 
 #ifdef HAVE_TRACKER
-    if (obj.options.flags & OPTION_SPOTLIGHT) {
+    if ((obj.options.flags & OPTION_SPOTLIGHT) && !(obj.options.flags & OPTION_SPOTLIGHT_NATIVE)) {
         setenv("DBUS_SESSION_BUS_ADDRESS", "unix:path=" _PATH_STATEDIR "spotlight.ipc", 1);
         setenv("XDG_DATA_HOME", _PATH_STATEDIR, 0);
         setenv("XDG_CACHE_HOME", _PATH_STATEDIR, 0);
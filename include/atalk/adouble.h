@@ -178,6 +178,8 @@ struct ad_fd {
     int          adf_flags;
     adf_lock_t   *adf_lock;
     int          adf_refcount, adf_lockcount, adf_lockmax;
+    int          adf_nosplice;  /* splice() failed for this fork, recvfile copies */
+    int          adf_dfd;       /* O_DIRECT fd of the same file, -1: none, -2: not available */
 };
 
 /* some header protection */
@@ -226,6 +228,8 @@ struct adouble {
     uint16_t            ad_open_forks;     /* open forks (by others)                  */
     size_t              valid_data_len;	   /* Bytes read into ad_data                 */
     char                ad_data[AD_DATASZ_MAX];
+    size_t              ad_disk_len;       /* Bytes in ad_disk, 0: unknown            */
+    char                ad_disk[AD_DATASZ_MAX]; /* ad_data as last read or written    */
 };
 
 #define ADFLAGS_DF        (1<<0)
@@ -382,6 +386,10 @@ struct adouble {
 
 #define ad_get_syml_opt(ad) (((ad)->ad_options & ADVOL_FOLLO_SYML) ? 0 : O_NOFOLLOW)
 
+/* ad_cache.c */
+extern int ad_cache_init  (int reqsize);
+extern int ad_metadata_st (const char *, int, struct adouble *, const struct stat *);
+
 /* ad_flush.c */
 extern int ad_rebuild_adouble_header_v2(struct adouble *);
 extern int ad_rebuild_adouble_header_ea(struct adouble *);
@@ -463,6 +471,7 @@ extern int ad_readfile_init(const struct adouble *ad, int eid, off_t *off, int e
 #endif
 #ifdef WITH_RECVFILE
 extern ssize_t ad_recvfile(struct adouble *ad, int eid,  int sock, off_t off, size_t len, int);
+extern void ad_recvfile_stat(void);
 #endif
 
 #endif /* _ATALK_ADOUBLE_H */
@@ -45,6 +45,7 @@
 #define CNID_ERR_DB    0x80000003
 #define CNID_ERR_CLOSE 0x80000004   /* the db was not open */
 #define CNID_ERR_MAX   0x80000005
+#define CNID_ERR_INDEX 0x80000006   /* the search index is incomplete */
 
 /*
  * This is instance of CNID database object.
@@ -71,6 +72,10 @@ typedef struct _cnid_db {
     int    (*cnid_find)        (struct _cnid_db *cdb, const char *name, size_t namelen,
                                 void *buffer, size_t buflen);
     int    (*cnid_wipe)        (struct _cnid_db *cdb);
+    int    (*cnid_find_substr) (struct _cnid_db *cdb, const char *name, size_t namelen,
+                                cnid_t *next, void *buffer, size_t buflen);
+    int    (*cnid_find_mtime)  (struct _cnid_db *cdb, time_t *from, time_t to,
+                                cnid_t *next, void *buffer, size_t buflen);
 } cnid_db;
 
 /*
@@ -116,6 +121,10 @@ cnid_t cnid_rebuild_add(struct _cnid_db *cdb, const struct stat *st, const cnid_
                         char *name, const size_t len, cnid_t hint);
 int    cnid_find       (struct _cnid_db *cdb, const char *name, size_t namelen,
                         void *buffer, size_t buflen);
+int    cnid_find_substr(struct _cnid_db *cdb, const char *name, size_t namelen,
+                        cnid_t *next, void *buffer, size_t buflen);
+int    cnid_find_mtime (struct _cnid_db *cdb, time_t *from, time_t to,
+                        cnid_t *next, void *buffer, size_t buflen);
 int    cnid_wipe       (struct _cnid_db *cdb);
 void   cnid_close      (struct _cnid_db *db);
 
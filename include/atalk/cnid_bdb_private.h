@@ -26,6 +26,8 @@
 #define CNID_DBD_OP_REBUILD_ADD 0x0c
 #define CNID_DBD_OP_SEARCH      0x0d
 #define CNID_DBD_OP_WIPE        0x0e
+#define CNID_DBD_OP_SEARCH_SUBSTR 0x0f
+#define CNID_DBD_OP_SEARCH_MTIME  0x10
 
 #define CNID_DBD_RES_OK            0x00
 #define CNID_DBD_RES_NOTFOUND      0x01
@@ -38,13 +40,22 @@
 #define DBD_MAX_SRCH_RSLTS 100
 #define DBD_NUM_OPEN_ARGS 3
 
+/*
+ * Version of struct cnid_dbd_rqst, sent first with every request so that cnid_dbd
+ * can reject clients built with a different layout. Older cnid_dbd read it as
+ * the op, so it must never be a valid op. Bump it when the request changes.
+ */
+#define CNID_DBD_PROTO_VERSION 0x0100
+
 struct cnid_dbd_rqst {
+    uint32_t version;
     int     op;
     cnid_t  cnid;
     dev_t   dev;
     ino_t   ino;
     uint32_t type;
     cnid_t  did;
+    time_t  mtime;     /* for the modification date index */
     const char *name;
     size_t  namelen;
 };
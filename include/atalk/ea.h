@@ -89,7 +89,10 @@ enum {
 /* Names for our Extended Attributes adouble data */
 #define AD_EA_META "org.netatalk.Metadata"
 #define AD_EA_RESO "org.netatalk.ResourceFork"
-#define NOT_NETATALK_EA(a) (strcmp((a), AD_EA_META) != 0) && (strcmp((a), AD_EA_RESO) != 0)
+/* Cached band count of a TimeMachine sparsebundle, see etc/afpd/volume.c */
+#define TM_BANDS_EA "org.netatalk.tm-bands"
+#define NOT_NETATALK_EA(a) (strcmp((a), AD_EA_META) != 0) && (strcmp((a), AD_EA_RESO) != 0) \
+    && (strcmp((a), TM_BANDS_EA) != 0)
 
 /****************************************************************************************
  * Wrappers for native EA functions taken from Samba
@@ -204,6 +207,19 @@ extern int sys_remove_ea(VFS_FUNC_ARGS_EA_REMOVE);
 /* native EA VFSfile/dir cp/mv/rm */
 extern int sys_ea_copyfile(VFS_FUNC_ARGS_COPYFILE);
 
+/* EAs in a per directory tdb */
+#define EA_STORE_NAME ".EAStore"
+
+extern int ea_store_get_easize(VFS_FUNC_ARGS_EA_GETSIZE);
+extern int ea_store_get_eacontent(VFS_FUNC_ARGS_EA_GETCONTENT);
+extern int ea_store_list_eas(VFS_FUNC_ARGS_EA_LIST);
+extern int ea_store_set_ea(VFS_FUNC_ARGS_EA_SET);
+extern int ea_store_remove_ea(VFS_FUNC_ARGS_EA_REMOVE);
+extern int ea_store_deletefile(VFS_FUNC_ARGS_DELETEFILE);
+extern int ea_store_renamefile(VFS_FUNC_ARGS_RENAMEFILE);
+extern int ea_store_copyfile(VFS_FUNC_ARGS_COPYFILE);
+extern int ea_store_chmod_dir(VFS_FUNC_ARGS_SETDIRUNIXMODE);
+
 /* dbd needs access to these */
 extern int ea_open(const struct vol * restrict vol,
                    const char * restrict uname,
@@ -217,4 +233,10 @@ extern int ea_openat(const struct vol * restrict vol,
 extern int ea_close(struct ea * restrict ea);
 extern char *ea_path(const struct ea * restrict ea, const char * restrict eaname, int macname);
 
+/* the EA store needs access to these */
+extern int ea_unpack_header(struct ea * restrict ea);
+extern int ea_pack_header(struct ea * restrict ea);
+extern int ea_addentry(struct ea * restrict ea, const char * restrict attruname, size_t attrsize, int bitmap);
+extern int ea_delentry(struct ea * restrict ea, const char * restrict attruname);
+
 #endif /* ATALK_EA_H */
@@ -44,6 +44,7 @@
 #define MAXUSERLEN 256
 
 #define DEFAULT_MAX_DIRCACHE_SIZE 8192
+#define DEFAULT_MAX_ADCACHE_SIZE 4096
 
 #define OPTION_DEBUG         (1 << 0)
 #define OPTION_CLOSEVOL      (1 << 1)
@@ -62,6 +63,8 @@
 #define OPTION_SPOTLIGHT_VOL (1 << 14) /* whether spotlight shall be enabled by default for volumes */
 #define OPTION_RECVFILE      (1 << 15)
 #define OPTION_SPOTLIGHT_EXPR (1 << 16) /* whether to allow Spotlight logic expressions */
+#define OPTION_SPOTLIGHT_NATIVE (1 << 17) /* whether to use the built-in Spotlight backend instead of Tracker */
+#define OPTION_WRITEBEHIND   (1 << 18) /* receive FPWrite data while the previous chunk is written */
 
 #define PASSWD_NONE     0
 #define PASSWD_SET     (1 << 0)
@@ -91,6 +94,7 @@ struct afp_options {
     int timeout;
     int flags;
     int dircachesize;
+    int adcachesize;
     int sleep;                  /* Maximum time allowed to sleep (in tickles) */
     int disconnected;           /* Maximum time in disconnected state (in tickles) */
     int fce_fmodwait;           /* number of seconds FCE file mod events are put on hold */
@@ -131,6 +135,8 @@ struct afp_options {
     char *adminauthuser;
     char *ignored_attr;
     int  splice_size;
+    int  sync_batch;        /* syncfs() instead of fsync() with that many unsynced forks on a fs */
+    int  catsearch_threads;     /* number of catsearch prefetch threads, 0 disables prefetching */
     char *cnid_mysql_host;
     char *cnid_mysql_user;
     char *cnid_mysql_pw;
@@ -138,6 +144,7 @@ struct afp_options {
     struct afp_volume_name volfile;
     struct afp_volume_name includefile;
     uint64_t sparql_limit;
+    int sl_cache_ttl;
 };
 
 typedef struct AFPObj {
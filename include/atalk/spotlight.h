@@ -25,6 +25,7 @@
 #include <atalk/dalloc.h>
 #include <atalk/globals.h>
 #include <atalk/volume.h>
+#include <atalk/fce_api.h>
 
 #ifdef HAVE_TRACKER
 #include <gio/gio.h>
@@ -66,6 +67,10 @@ typedef struct {
  * Some helper stuff dealing with queries
  ******************************************************************************/
 
+#define MAX_SL_RESULTS 20           /* initial number of results per batch */
+#define SL_MAX_BATCH 256            /* max number of results per batch */
+#define SL_MAX_BATCH_BYTES (32 * 1024) /* max estimated packed size of a batch */
+
 /* query state */
 typedef enum {
 	SLQ_STATE_NEW,            /* Query received from client           */
@@ -81,10 +86,14 @@ typedef enum {
 /* Handle for query results */
 struct sl_rslts {
     int         num_results;
+    size_t      num_bytes;            /* estimated packed size */
     sl_cnids_t *cnids;
     sl_array_t *fm_array;
 };
 
+struct sl_dirnode;
+struct sl_cnidset;
+
 /* Internal query data structure */
 typedef struct _slq_t {
     struct list_head  slq_list;           /* queries are stored in a list     */
@@ -97,15 +106,51 @@ typedef struct _slq_t {
     uint64_t          slq_ctx2;           /* client context 2                 */
     sl_array_t       *slq_reqinfo;        /* array with requested metadata    */
     const char       *slq_qstring;        /* the Spotlight query string       */
-    uint64_t         *slq_cnids;          /* Pointer to array with CNIDs      */
-    size_t            slq_cnids_num;      /* Size of slq_cnids array          */
+    struct sl_cnidset *slq_cnids;         /* CNIDs results are restricted to  */
     void             *tracker_cursor;     /* Tracker SPARQL cursor            */
+    void             *slq_backend_data;   /* private data of the backend      */
+    struct sl_dirnode *slq_dirtree;       /* CNIDs of result directories      */
+    char            **slq_pending;        /* result paths not yet resolved    */
+    int               slq_pending_num;    /* number of slq_pending paths      */
     bool              slq_allow_expr;     /* Whether to allow expressions     */
     uint64_t          slq_result_limit;   /* Whether to LIMIT SPARQL results  */
     struct sl_rslts  *query_results;      /* query results                    */
+    struct sl_rslts  *slq_ready;          /* complete batch not yet fetched   */
+    int               slq_batch;          /* current number of results per batch */
+    time_t            slq_fetch_time;     /* last fetch by the client         */
+    const struct sl_backend *slq_backend; /* backend running the query    */
+    char             *slq_cache_key;      /* query cache key, see spotlight_cache.c */
+    cnid_t           *slq_cache_cnids;    /* results recorded for the cache   */
+    int               slq_cache_num;
 } slq_t;
 
+/*
+ * Search backend
+ *
+ * A backend runs the queries and adds results to slq->query_results with
+ * sl_add_result(), updating slq->slq_state as the Tracker backend always did:
+ * SLQ_STATE_RUNNING or SLQ_STATE_RESULTS while searching, SLQ_STATE_FULL when
+ * a batch of results (see sl_results_full()) is waiting to be fetched by the
+ * client and SLQ_STATE_DONE at the end. Backends that search asynchronously
+ * may call sl_results_prefetch() when a batch is full to go on with the next
+ * one while the client fetches the first. Backends that only know the paths of results
+ * queue them with sl_queue_result() and have them resolved to CNIDs in one go
+ * with sl_flush_results(). Backends must drop results that are not in
+ * slq->slq_cnids, if the client restricted the query to a set of CNIDs, as
+ * early as they can. Optional functions may be NULL.
+ */
+struct sl_backend {
+    const char *sb_name;
+    int  (*sb_init)(AFPObj *obj);           /* called once per process            */
+    void (*sb_dispatch)(AFPObj *obj);       /* optional, called before every RPC  */
+    int  (*sb_open_query)(slq_t *slq);      /* start a query, 0 on success        */
+    void (*sb_fetch_more)(slq_t *slq);      /* results have been sent to client   */
+    void (*sb_cancel)(slq_t *slq);          /* optional, client closed the query  */
+    void (*sb_free)(slq_t *slq);            /* optional, query is being freed     */
+};
+
 struct sl_ctx {
+    const struct sl_backend *sl_backend;
 #ifdef HAVE_TRACKER
     TrackerSparqlConnection *tracker_con;
     GCancellable *cancellable;
@@ -124,5 +169,28 @@ extern int afp_spotlight_rpc(AFPObj *obj, char *ibuf, size_t ibuflen _U_,
 extern int sl_pack(DALLOC_CTX *query, char *buf);
 extern int sl_unpack(DALLOC_CTX *query, const char *buf);
 extern void configure_spotlight_attributes(const char *attributes);
+extern bool sl_add_result(slq_t *slq, cnid_t id, const char *path, const struct stat *sp);
+extern bool sl_results_full(const slq_t *slq);
+extern bool sl_results_prefetch(slq_t *slq);
+extern bool sl_queue_result(slq_t *slq, const char *path);
+extern bool sl_flush_results(slq_t *slq);
+extern struct sl_cnidset *sl_cnidset_new(TALLOC_CTX *ctx);
+extern int sl_cnidset_add(struct sl_cnidset *set, uint32_t cnid);
+extern bool sl_cnidset_contains(const struct sl_cnidset *set, uint32_t cnid);
+extern size_t sl_cnidset_count(const struct sl_cnidset *set);
+extern bool sl_cnidset_next(const struct sl_cnidset *set, uint32_t *cnid);
+
+/* Query cache, spotlight_cache.c */
+extern bool sl_cache_lookup(slq_t *slq);
+extern void sl_cache_add(slq_t *slq, cnid_t id);
+extern void sl_cache_store(slq_t *slq);
+extern void sl_cache_invalidate(const AFPObj *obj, const struct vol *vol);
+
+/* Built-in backend, spotlight_native.c */
+extern const struct sl_backend sl_native_backend;
+extern void sl_index_event(const AFPObj *obj, fce_ev_t event, const char *path);
+extern void sl_index_flush(const AFPObj *obj);
+extern int sl_native_eval(const struct vol *vol, const char *query,
+                          const char *name, const struct stat *st, int *nsrc);
 
 #endif /* SPOTLIGHT_H */
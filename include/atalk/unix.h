@@ -45,6 +45,8 @@ extern int dir_rx_set(mode_t mode);
 extern int unix_rename(int sfd, const char *oldpath, int dfd, const char *newpath);
 extern int copy_file(int sfd, const char *src, const char *dst, mode_t mode);
 extern int copy_file_fd(int sfd, int dfd);
+extern int copy_fd_offload(int sfd, off_t *soff, int dfd, off_t *doff);
+extern int copy_fd_range(int sfd, off_t soff, int dfd, off_t doff, char *buf, size_t buflen);
 extern int copy_ea(const char *ea, int sfd, const char *src, const char *dst, mode_t mode);
 
 extern void become_root(void);
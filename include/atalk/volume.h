@@ -20,6 +20,8 @@
 
 typedef uint64_t VolSpace;
 
+struct tm_bundle;
+
 /* This should belong in a file.h */
 struct extmap {
     char		*em_ext;
@@ -50,6 +52,7 @@ struct vol {
     struct _cnid_db *v_cdb;
     char            v_stamp[ADEDLEN_PRIVSYN];
     VolSpace        v_limitsize; /* Size limit, if any, in MiB */
+    off_t           v_directio;  /* direct I/O for data forks after that many bytes, -1: never */
     mode_t          v_umask;
     mode_t          v_dperm; /* default directories permission value OR with requested perm*/
     mode_t          v_fperm; /* default files permission value OR with requested perm*/
@@ -73,6 +76,8 @@ struct vol {
     VolSpace        v_tm_used;  /* used bytes on a TM volume */
     time_t          v_tm_cachetime; /* time at which v_tm_used was calculated last */
     VolSpace        v_appended; /* amount of data appended to files */
+    struct tm_bundle *v_tm_bundles; /* sparsebundles on a TM volume, afpd/volume.c */
+    int             v_tm_ifd;   /* inotify fd watching their bands, -1: not opened, -2: unavailable */
     
     /* only when opening/closing volumes or in error */
     int             v_casefold;
@@ -140,12 +145,15 @@ typedef enum {
 #define AFPVOL_NONETIDS  (1 << 26)   /* signal the client it shall do privelege mapping */
 #define AFPVOL_FOLLOWSYM (1 << 27)   /* follow symlinks on the server, default is not to */
 #define AFPVOL_DELVETO   (1 << 28)   /* delete veto files and dirs */
+#define AFPVOL_SPARSEREAD (1 << 29)  /* send zeroes for FPReads of holes without reading */
+#define AFPVOL_PREALLOC  (1 << 30)   /* fallocate() growing data forks */
 
 /* Extended Attributes vfs indirection  */
 #define AFPVOL_EA_NONE           0   /* No EAs */
 #define AFPVOL_EA_AUTO           1   /* try sys, fallback to ad (default) */
 #define AFPVOL_EA_SYS            2   /* Store them in native EAs */
 #define AFPVOL_EA_AD             3   /* Store them in adouble files */
+#define AFPVOL_EA_TDB            4   /* Store them in a tdb per directory */
 
 /* FPGetSrvrParms options */
 #define AFPSRVR_CONFIGINFO     (1 << 0)
@@ -0,0 +1,193 @@
+/*
+  Copyright (c) 2026 Netatalk Team
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+*/
+
+/*!
+ * @file
+ * Cache of parsed adouble:ea metadata
+ *
+ * Enumerating a directory reads and parses the metadata EA of every file,
+ * although usually nothing has changed since the last enumeration. We cache
+ * parsed headers per process, keyed by device and inode of the file.
+ *
+ * Writing the metadata EA changes the ctime of the file, so an entry is valid
+ * as long as the ctime is unchanged. ctime has a resolution of a second here,
+ * so we only cache headers of files whose ctime is in the past, otherwise
+ * another change in the same second would go unnoticed. That files have no
+ * metadata EA is cached too.
+ *
+ * Only adouble:ea headers opened read-only are cached. adouble:v2 headers are
+ * in a separate file whose changes don't show in the ctime of the file. Unless
+ * the resource fork is an EA too (HAVE_EAFD), its size is not cached either,
+ * as it's the size of the separate ._ file.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <atalk/logger.h>
+#include <atalk/adouble.h>
+
+#define AD_CACHE_MAX 131072
+
+struct ad_cache_entry {
+    dev_t           ace_dev;
+    ino_t           ace_ino;                /* 0: unused entry */
+    time_t          ace_ctime;
+    int             ace_dir;                /* ADFLAGS_DIR */
+    int             ace_noent;              /* there is no metadata EA */
+    off_t           ace_rlen;
+    size_t          ace_len;                /* valid bytes of ace_data */
+    struct ad_entry ace_eid[ADEID_MAX];
+    char            ace_data[AD_DATASZ_EA];
+};
+
+static struct ad_cache_entry *ad_cache;
+static unsigned int ad_cache_mask;
+
+/*!
+ * Allocate the metadata cache of the process
+ *
+ * @param reqsize  (r) number of entries, rounded up to a power of 2, 0 disables the cache
+ *
+ * @returns 0 on success, -1 on error
+ */
+int ad_cache_init(int reqsize)
+{
+    unsigned int size = 1;
+
+    if (reqsize <= 0)
+        return 0;
+    if (reqsize > AD_CACHE_MAX)
+        reqsize = AD_CACHE_MAX;
+    while (size < (unsigned int)reqsize)
+        size <<= 1;
+
+    if ((ad_cache = calloc(size, sizeof(struct ad_cache_entry))) == NULL) {
+        LOG(log_error, logtype_ad, "ad_cache_init: out of memory");
+        return -1;
+    }
+    ad_cache_mask = size - 1;
+
+    LOG(log_debug, logtype_ad, "ad_cache_init: %u entries", size);
+    return 0;
+}
+
+static struct ad_cache_entry *ad_cache_slot(const struct stat *st)
+{
+    uint64_t h = ((uint64_t)st->st_dev << 32) ^ (uint64_t)st->st_ino;
+
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+    return &ad_cache[h & ad_cache_mask];
+}
+
+/* Set up adp as ad_open() would have done for a read-only metadata open */
+static void ad_cache_fill(const struct ad_cache_entry *ace, const char *name,
+                          int flags, struct adouble *adp)
+{
+    adp->ad_adflags = (flags & ADFLAGS_DIR) | ADFLAGS_HF | ADFLAGS_RDONLY;
+    adp->ad_inited = AD_INITED;
+    adp->ad_meta_refcount++;
+    adp->ad_magic = AD_MAGIC;
+    adp->ad_version = AD_VERSION2;
+    memcpy(adp->ad_eid, ace->ace_eid, sizeof(adp->ad_eid));
+    memcpy(adp->ad_data, ace->ace_data, ace->ace_len);
+    adp->valid_data_len = ace->ace_len;
+    memcpy(adp->ad_disk, ace->ace_data, ace->ace_len);
+    adp->ad_disk_len = ace->ace_len;
+#ifdef HAVE_EAFD
+    adp->ad_rlen = ace->ace_rlen;
+#else
+    adp->ad_rlen = ad_reso_size(name, flags, adp);
+#endif
+}
+
+static void ad_cache_store(struct ad_cache_entry *ace, const struct stat *st,
+                           int flags, const struct adouble *adp)
+{
+    if (adp && adp->valid_data_len > sizeof(ace->ace_data)) {
+        ace->ace_ino = 0;
+        return;
+    }
+
+    ace->ace_dev = st->st_dev;
+    ace->ace_ino = st->st_ino;
+    ace->ace_ctime = st->st_ctime;
+    ace->ace_dir = flags & ADFLAGS_DIR;
+    ace->ace_noent = (adp == NULL);
+    if (adp) {
+        ace->ace_rlen = adp->ad_rlen;
+        ace->ace_len = adp->valid_data_len;
+        memcpy(ace->ace_eid, adp->ad_eid, sizeof(ace->ace_eid));
+        memcpy(ace->ace_data, adp->ad_data, adp->valid_data_len);
+    }
+}
+
+/*!
+ * @brief ad_metadata() for callers that have already stat'ed the file
+ *
+ * Serves the metadata from the cache of the process if the file hasn't changed
+ * since we've last read it.
+ *
+ * @param name  (r)  name of file/dir
+ * @param flags (r)  like ad_metadata()
+ * @param adp   (rw) pointer to struct adouble
+ * @param st    (r)  stat of name, may be NULL
+ */
+int ad_metadata_st(const char *name, int flags, struct adouble *adp, const struct stat *st)
+{
+    struct ad_cache_entry *ace;
+    int ret;
+
+    if (ad_cache == NULL
+        || st == NULL
+        || adp->ad_vers != AD_VERSION_EA
+        || adp->ad_inited == AD_INITED
+        || (flags & ADFLAGS_CHECK_OF))
+        return ad_metadata(name, flags, adp);
+
+    ace = ad_cache_slot(st);
+    if (ace->ace_ino == st->st_ino
+        && ace->ace_dev == st->st_dev
+        && ace->ace_ctime == st->st_ctime
+        && ace->ace_dir == (flags & ADFLAGS_DIR)) {
+        if (ace->ace_noent) {
+            errno = ENOENT;
+            return -1;
+        }
+        ad_cache_fill(ace, name, flags, adp);
+        return 0;
+    }
+
+    ret = ad_metadata(name, flags, adp);
+
+    if (st->st_ctime < time(NULL)) {
+        if (ret == 0)
+            ad_cache_store(ace, st, flags, adp);
+        else if (errno == ENOENT)
+            ad_cache_store(ace, st, flags, NULL);
+    }
+
+    return ret;
+}
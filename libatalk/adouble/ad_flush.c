@@ -242,10 +242,43 @@ int ad_copy_header(struct adouble *add, struct adouble *ads)
     return 0;
 }
 
+/*!
+ * Find the bytes of the rebuilt header that differ from what's on disk
+ *
+ * Entries are modified in place via ad_entry(), so instead of tracking
+ * changes we compare against the copy of the header we've last read or
+ * written.
+ *
+ * @param ad    (r) adouble handle with rebuilt header
+ * @param len   (r) length of the header
+ * @param off   (w) offset of the first changed byte
+ *
+ * @returns number of bytes from off that must be written, 0 if none
+ */
+static int ad_header_changed(const struct adouble *ad, int len, int *off)
+{
+    int end;
+
+    *off = 0;
+    if (ad->ad_disk_len < (size_t)len)
+        return len;
+
+    while (*off < len && ad->ad_data[*off] == ad->ad_disk[*off])
+        (*off)++;
+    if (*off == len)
+        return 0;
+
+    end = len;
+    while (ad->ad_data[end - 1] == ad->ad_disk[end - 1])
+        end--;
+
+    return end - *off;
+}
+
 static int ad_flush_hf(struct adouble *ad)
 {
     EC_INIT;
-    int len;
+    int len, off, wlen;
     int cwd = -1;
 
     LOG(log_debug, logtype_ad, "ad_flush_hf(%s)", adflags2logstr(ad->ad_adflags));
@@ -274,13 +307,20 @@ static int ad_flush_hf(struct adouble *ad)
         }
         len = ad->ad_ops->ad_rebuild_header(ad);
 
+        if ((wlen = ad_header_changed(ad, len, &off)) == 0) {
+            LOG(log_debug, logtype_ad, "ad_flush_hf: header unchanged");
+            return 0;
+        }
+
         switch (ad->ad_vers) {
         case AD_VERSION2:
-            if (adf_pwrite(ad->ad_mdp, ad->ad_data, len, 0) != len) {
+            if (adf_pwrite(ad->ad_mdp, ad->ad_data + off, wlen, off) != wlen) {
                 if (errno == 0)
                     errno = EIO;
                 return( -1 );
             }
+            memcpy(ad->ad_disk, ad->ad_data, len);
+            ad->ad_disk_len = len;
             break;
         case AD_VERSION_EA:
             if (AD_META_OPEN(ad)) {
@@ -320,6 +360,8 @@ static int ad_flush_hf(struct adouble *ad)
                 } else {
                     EC_ZERO_LOG( sys_fsetxattr(ad_data_fileno(ad), AD_EA_META, ad->ad_data, AD_DATASZ_EA, 0) );
                 }
+                memcpy(ad->ad_disk, ad->ad_data, len);
+                ad->ad_disk_len = len;
             }
             break;
         default:
@@ -388,6 +430,18 @@ EC_CLEANUP:
     EC_EXIT;
 }
 
+/*
+ * The O_DIRECT fd is another fd of the file, closing it would drop the fcntl
+ * locks of the process on the file, so it lives as long as the fd it was
+ * opened for.
+ */
+static void adf_close_direct(struct ad_fd *adf)
+{
+    if (adf->adf_dfd >= 0)
+        close(adf->adf_dfd);
+    adf->adf_dfd = -1;
+}
+
 static int ad_data_closefd(struct adouble *ad)
 {
     int ret = 0;
@@ -398,6 +452,7 @@ static int ad_data_closefd(struct adouble *ad)
     } else {
         if (close(ad_data_fileno(ad)) < 0)
             ret = -1;
+        adf_close_direct(&ad->ad_data_fork);
     }
     ad_data_fileno(ad) = -1;
     return ret;
@@ -448,6 +503,7 @@ int ad_close(struct adouble *ad, int adflags)
             if (close( ad_meta_fileno(ad)) < 0)
                 err = -1;
             ad_meta_fileno(ad) = -1;
+            adf_close_direct(ad->ad_mdp);
         }
     }
 
@@ -460,6 +516,7 @@ int ad_close(struct adouble *ad, int adflags)
                 if (close( ad_meta_fileno(ad)) < 0)
                     err = -1;
                 ad_meta_fileno(ad) = -1;
+                adf_close_direct(ad->ad_mdp);
             }
         }
 
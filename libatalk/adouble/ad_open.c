@@ -329,6 +329,7 @@ int ad_init_offsets(struct adouble *ad)
     }
 
     memset(ad->ad_data, 0, sizeof(ad->ad_data));
+    ad->ad_disk_len = 0;
 
     if (ad->ad_vers == AD_VERSION2)
         eid = entry_order2;
@@ -363,6 +364,9 @@ static int new_ad_header(struct adouble *ad, const char *path, struct stat *stp,
 
     LOG(log_debug, logtype_ad, "new_ad_header(\"%s\")", path);
 
+    /* nothing on disk we could update in place */
+    ad->ad_disk_len = 0;
+
     if (ad_init_offsets(ad) != 0)
         return -1;
 
@@ -500,6 +504,9 @@ static int ad_header_read(const char *path, struct adouble *ad, const struct sta
         return -1;
     }
 
+    memcpy(ad->ad_disk, buf, header_len);
+    ad->ad_disk_len = header_len;
+
     if (hst == NULL) {
         hst = &st;
         if (fstat(ad->ad_mdp->adf_fd, &st) < 0) {
@@ -796,6 +803,9 @@ static int ad_header_read_ea(const char *path, struct adouble *ad, const struct
         EC_FAIL;
     }
 
+    memcpy(ad->ad_disk, buf, header_len);
+    ad->ad_disk_len = header_len;
+
     /*
      * Ensure the resource fork offset is always set
      */
@@ -1871,6 +1881,8 @@ static void ad_init_func(struct adouble *ad)
     ad_data_fileno(ad) = -1;
     ad_reso_fileno(ad) = -1;
     ad_meta_fileno(ad) = -1;
+    ad->ad_data_fork.adf_dfd = -1;
+    ad->ad_resource_fork.adf_dfd = -1;
     ad->ad_refcount = 1;
     ad->ad_rlen = 0;
     return;
@@ -27,25 +27,64 @@
 #include <sys/socket.h>
 #include <sys/uio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <sys/select.h>
 
 #include <atalk/adouble.h>
 #include <atalk/logger.h>
 #include <atalk/util.h>
 
-static int ad_recvfile_init(const struct adouble *ad, int eid, off_t *off)
+/*
+ * recvfile engine of the process, i.e. of the AFP session. The pipe is kept
+ * for the lifetime of the process and enlarged to the splice size, so that a
+ * whole chunk fits into it.
+ */
+static struct {
+    int                pipefd[2];
+    size_t             pipesize;    /* capacity of the pipe */
+    size_t             pipewant;    /* capacity we've asked for */
+    unsigned long long spliced;     /* bytes received with splice() */
+    unsigned long long copied;      /* bytes received with read() and pwrite() */
+    unsigned long long failures;    /* splice() failures that fell back to copying */
+} rf = {
+    .pipefd = { -1, -1 }
+};
+
+static struct ad_fd *ad_recvfile_init(struct adouble *ad, int eid, off_t *off)
 {
-    int fd;
+    if (eid == ADEID_DFORK)
+        return &ad->ad_data_fork;
+
+    *off += ad_getentryoff(ad, eid);
+    return ad->ad_rfp;
+}
 
-    if (eid == ADEID_DFORK) {
-        fd = ad_data_fileno(ad);
-    } else {
-        *off += ad_getentryoff(ad, eid);
-        fd = ad_reso_fileno(ad);
+static int waitfordata(int socket)
+{
+    fd_set readfds;
+    int maxfd = socket + 1;
+    int ret;
+
+    FD_ZERO(&readfds);
+
+    while (1) {
+        FD_ZERO(&readfds);
+        FD_SET(socket, &readfds);
+        if ((ret = select(maxfd, &readfds, NULL, NULL, NULL)) <= 0) {
+            if (ret == -1 && errno == EINTR)
+                continue;
+            LOG(log_error, logtype_dsi, "waitfordata: unexpected select return: %d %s",
+                ret, ret < 0 ? strerror(errno) : "");
+            return -1;
+        }
+        if (FD_ISSET(socket, &readfds))
+            return 0;
+        return -1;
     }
 
-    return fd;
 }
 
 /*
@@ -87,8 +126,10 @@ static ssize_t default_sys_recvfile(int fromfd,
         ssize_t read_ret;
         size_t toread = MIN(bufsize,count - total);
 
-        /* Read from socket - ignore EINTR. */
+        /* Read from socket - ignore EINTR, the socket is non-blocking. */
         read_ret = read(fromfd, buffer, toread);
+        if (read_ret == -1 && (errno == EINTR || (errno == EAGAIN && waitfordata(fromfd) == 0)))
+            continue;
         if (read_ret <= 0) {
             /* EOF or socket error. */
             free(buffer);
@@ -104,7 +145,7 @@ static ssize_t default_sys_recvfile(int fromfd,
                 write_ret = read_ret;
             } else {
                 /* Write to file - ignore EINTR. */
-                write_ret = pwrite(tofd, buffer + num_written, read_ret - num_written, offset);
+                write_ret = pwrite(tofd, buffer + num_written, read_ret - num_written, offset + total + num_written);
                 if (write_ret <= 0) {
                     /* write error - stop writing. */
                     tofd = -1;
@@ -119,6 +160,7 @@ static ssize_t default_sys_recvfile(int fromfd,
     }
 
     free(buffer);
+    rf.copied += total;
     if (saved_errno) {
         /* Return the correct write error. */
         errno = saved_errno;
@@ -127,29 +169,81 @@ static ssize_t default_sys_recvfile(int fromfd,
 }
 
 #ifdef HAVE_SPLICE
-static int waitfordata(int socket)
+/* Create the pipe or try to enlarge it to size */
+static int rf_pipe(size_t size)
 {
-    fd_set readfds;
-    int maxfd = socket + 1;
-    int ret;
+    if (rf.pipefd[0] == -1) {
+        if (pipe(rf.pipefd) == -1) {
+            LOG(log_error, logtype_dsi, "recvfile: pipe: %s", strerror(errno));
+            return -1;
+        }
+        rf.pipesize = 64 * 1024;
+        rf.pipewant = 0;
+    }
 
-    FD_ZERO(&readfds);
+#ifdef F_SETPIPE_SZ
+    if (size > rf.pipewant) {
+        int cap;
+        /* may fail above /proc/sys/fs/pipe-max-size, keep what we have then */
+        rf.pipewant = size;
+        if ((cap = fcntl(rf.pipefd[1], F_SETPIPE_SZ, (int)MIN(size, INT_MAX))) == -1)
+            LOG(log_debug, logtype_dsi, "recvfile: F_SETPIPE_SZ(%zu): %s", size, strerror(errno));
+        else
+            rf.pipesize = cap;
+    }
+#endif
 
-    while (1) {
-        FD_ZERO(&readfds);
-        FD_SET(socket, &readfds);
-        if ((ret = select(maxfd, &readfds, NULL, NULL, NULL)) <= 0) {
-            if (ret == -1 && errno == EINTR)
+    return 0;
+}
+
+static void rf_pipe_close(void)
+{
+    close(rf.pipefd[0]);
+    close(rf.pipefd[1]);
+    rf.pipefd[0] = rf.pipefd[1] = -1;
+    rf.pipesize = rf.pipewant = 0;
+}
+
+/*
+ * Write len bytes sitting in the pipe to tofd with read() and pwrite(), so
+ * that the pipe is empty afterwards. Returns 0, or -1 with errno set if
+ * writing failed.
+ */
+static int rf_pipe_copy(int tofd, off_t offset, size_t len)
+{
+    char buf[8192];
+    ssize_t cc, wc;
+    int err = 0;
+
+    while (len > 0) {
+        if ((cc = read(rf.pipefd[0], buf, MIN(sizeof(buf), len))) <= 0) {
+            if (cc == -1 && errno == EINTR)
                 continue;
-            LOG(log_error, logtype_dsi, "waitfordata: unexpected select return: %d %s",
-                ret, ret < 0 ? strerror(errno) : "");
+            /* can't tell what's left in the pipe */
+            rf_pipe_close();
             return -1;
         }
-        if (FD_ISSET(socket, &readfds))
-            return 0;
-        return -1;
+        len -= cc;
+        rf.copied += cc;
+
+        for (wc = 0; !err && wc < cc; ) {
+            ssize_t n = pwrite(tofd, buf + wc, cc - wc, offset + wc);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                err = errno;
+                break;
+            }
+            wc += n;
+        }
+        offset += cc;
     }
 
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
 }
 
 /*
@@ -158,13 +252,19 @@ static int waitfordata(int socket)
  * failed. Else we return the number of bytes
  * actually written. We always read count bytes
  * from the network in the case of return != -1.
+ *
+ * If splice() doesn't work for the socket or the file, the rest is copied
+ * with read() and pwrite() and nosplice is set, so that further calls for the
+ * same file don't try again.
  */
-static ssize_t sys_recvfile(int fromfd, int tofd, off_t offset, size_t count, int splice_size)
+static ssize_t sys_recvfile(int fromfd, int tofd, off_t offset, size_t count,
+                            int splice_size, int *nosplice)
 {
-    static int pipefd[2] = { -1, -1 };
-    static bool try_splice_call = true;
     size_t total_written = 0;
+    size_t chunk;
     loff_t splice_offset = offset;
+    ssize_t nread, thistime, cc;
+    int err;
 
     LOG(log_debug, logtype_dsi, "sys_recvfile: from = %d, to = %d, offset = %.0f, count = %lu",
         fromfd, tofd, (double)offset, (unsigned long)count);
@@ -172,28 +272,13 @@ static ssize_t sys_recvfile(int fromfd, int tofd, off_t offset, size_t count, in
     if (count == 0)
         return 0;
 
-    /*
-     * Older Linux kernels have splice for sendfile,
-     * but it fails for recvfile. Ensure we only try
-     * this once and always fall back to the userspace
-     * implementation if recvfile splice fails. JRA.
-     */
+    if (*nosplice || rf_pipe(splice_size) != 0)
+        return default_sys_recvfile(fromfd, tofd, offset, count);
 
-    if (!try_splice_call) {
-        errno = ENOSYS;
-        return -1;
-    }
-
-    if ((pipefd[0] == -1) && (pipe(pipefd) == -1)) {
-        try_splice_call = false;
-        errno = ENOSYS;
-        return -1;
-    }
+    chunk = MIN((size_t)splice_size, rf.pipesize);
 
     while (count > 0) {
-        int nread, to_write;
-
-        nread = splice(fromfd, NULL, pipefd[1], NULL, MIN(count, splice_size), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        nread = splice(fromfd, NULL, rf.pipefd[1], NULL, MIN(count, chunk), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
 
         if (nread == -1) {
             if (errno == EINTR)
@@ -203,32 +288,60 @@ static ssize_t sys_recvfile(int fromfd, int tofd, off_t offset, size_t count, in
                     continue;
                 return -1;
             }
-            if (total_written == 0 && (errno == EBADF || errno == EINVAL)) {
-                LOG(log_warning, logtype_dsi, "splice() doesn't work for recvfile");
-                try_splice_call = false;
-                errno = ENOSYS;
-                return -1;
+            if (errno == EBADF || errno == EINVAL || errno == ENOSYS) {
+                /* Older Linux kernels can't splice from a socket */
+                LOG(log_info, logtype_dsi, "sys_recvfile: splice from socket: %s, copying", strerror(errno));
+                goto copy;
             }
-            break;
+            return -1;
         }
-
-        to_write = nread;
-        while (to_write > 0) {
-            int thistime;
-            thistime = splice(pipefd[0], NULL, tofd, &splice_offset, to_write, SPLICE_F_MOVE);
-            if (thistime == -1)
-                return -1;
-            to_write -= thistime;
+        if (nread == 0) {
+            /* EOF */
+            errno = ECONNRESET;
+            return -1;
         }
 
-        total_written += nread;
-        count -= nread;
+        while (nread > 0) {
+            thistime = splice(rf.pipefd[0], NULL, tofd, &splice_offset, nread, SPLICE_F_MOVE);
+            if (thistime == -1) {
+                if (errno == EINTR)
+                    continue;
+                err = errno;
+                LOG(log_info, logtype_dsi, "sys_recvfile: splice to file: %s, copying", strerror(err));
+
+                /* the data is in the pipe now, pass it on the slow way */
+                if (rf_pipe_copy(tofd, splice_offset, nread) != 0) {
+                    if (rf.pipefd[0] == -1)
+                        return -1;
+                    /* the file can't take any data, discard the rest */
+                    err = errno;
+                    if (default_sys_recvfile(fromfd, -1, 0, count - nread) == -1)
+                        return -1;
+                    errno = err;
+                    return total_written;
+                }
+                splice_offset += nread;
+                total_written += nread;
+                count -= nread;
+                goto copy;
+            }
+            nread -= thistime;
+            total_written += thistime;
+            count -= thistime;
+            rf.spliced += thistime;
+        }
     }
 
-done:
     LOG(log_maxdebug, logtype_dsi, "sys_recvfile: total_written: %zu", total_written);
 
     return total_written;
+
+copy:
+    *nosplice = 1;
+    rf.failures++;
+    if ((cc = default_sys_recvfile(fromfd, tofd, splice_offset, count)) == -1)
+        return -1;
+    return total_written + cc;
 }
 #else
 
@@ -236,7 +349,8 @@ done:
  No recvfile system call - use the default 128 chunk implementation.
 *****************************************************************/
 
-ssize_t sys_recvfile(int fromfd, int tofd, off_t offset, size_t count)
+static ssize_t sys_recvfile(int fromfd, int tofd, off_t offset, size_t count,
+                            int splice_size _U_, int *nosplice _U_)
 {
     return default_sys_recvfile(fromfd, tofd, offset, count);
 }
@@ -246,11 +360,11 @@ ssize_t sys_recvfile(int fromfd, int tofd, off_t offset, size_t count)
 ssize_t ad_recvfile(struct adouble *ad, int eid, int sock, off_t off, size_t len, int splice_size)
 {
     ssize_t cc;
-    int fd;
+    struct ad_fd *adf;
     off_t off_fork = off;
 
-    fd = ad_recvfile_init(ad, eid, &off_fork);
-    if ((cc = sys_recvfile(sock, fd, off_fork, len, splice_size)) != len)
+    adf = ad_recvfile_init(ad, eid, &off_fork);
+    if ((cc = sys_recvfile(sock, adf->adf_fd, off_fork, len, splice_size, &adf->adf_nosplice)) != len)
         return -1;
 
     if ((eid != ADEID_DFORK) && (off > ad_getentrylen(ad, eid)))
@@ -258,4 +372,11 @@ ssize_t ad_recvfile(struct adouble *ad, int eid, int sock, off_t off, size_t len
 
     return cc;
 }
+
+/* log the recvfile statistics of the session */
+void ad_recvfile_stat(void)
+{
+    LOG(log_info, logtype_dsi, "recvfile statistics: spliced: %llu, copied: %llu, splice failures: %llu",
+        rf.spliced, rf.copied, rf.failures);
+}
 #endif
@@ -18,6 +18,7 @@
 #include <atalk/bstradd.h>
 #include <atalk/logger.h>
 #include <atalk/util.h>
+#include <atalk/unix.h>
 #include <atalk/errchk.h>
 
 /* XXX: locking has to be checked before each stream of consecutive
@@ -193,45 +194,14 @@ int ad_dtruncate(struct adouble *ad, const off_t size)
     return 0;
 }
 
-/* ----------------------- */
-static int copy_all(const int dfd, const void *buf,
-                               size_t buflen)
-{
-    ssize_t cc;
-
-    while (buflen > 0) {
-        if ((cc = write(dfd, buf, buflen)) < 0) {
-            switch (errno) {
-            case EINTR:
-                continue;
-            default:
-                return -1;
-            }
-        }
-        buflen -= cc;
-    }
-
-    return 0;
-}
-
 /* -------------------------- 
- * copy only the fork data stream
+ * copy only the fork data stream, reflinked or copied by the
+ * filesystem where possible
 */
 int copy_fork(int eid, struct adouble *add, struct adouble *ads, char *buf, size_t buflen)
 {
-    ssize_t cc;
-    int     err = 0;
-    char    fixedbuf[8192];
-    char    *filebuf;
     int     sfd, dfd;
 
-    if (buf != NULL && buflen > sizeof(fixedbuf)) {
-        filebuf = buf;
-    } else {
-        filebuf = fixedbuf;
-        buflen = sizeof(fixedbuf);
-    }
-
     if (eid == ADEID_DFORK) {
         sfd = ad_data_fileno(ads);
         dfd = ad_data_fileno(add);
@@ -241,52 +211,5 @@ int copy_fork(int eid, struct adouble *add, struct adouble *ads, char *buf, size
         dfd = ad_reso_fileno(add);
     }        
 
-    if ((off_t)-1 == lseek(sfd, ad_getentryoff(ads, eid), SEEK_SET))
-    	return -1;
-
-    if ((off_t)-1 == lseek(dfd, ad_getentryoff(add, eid), SEEK_SET))
-    	return -1;
-    	
-#if 0 /* ifdef SENDFILE_FLAVOR_LINUX */
-    /* doesn't work With 2.6 FIXME, only check for EBADFD ? */
-    off_t   offset = 0;
-    size_t  size;
-    struct stat         st;
-    #define BUF 128*1024*1024
-
-    if (fstat(sfd, &st) == 0) {
-        
-        while (1) {
-            if ( offset >= st.st_size) {
-               return 0;
-            }
-            size = (st.st_size -offset > BUF)?BUF:st.st_size -offset;
-            if ((cc = sys_sendfile(dfd, sfd, &offset, size)) < 0) {
-                switch (errno) {
-                case ENOSYS:
-                case EINVAL:  /* there's no guarantee that all fs support sendfile */
-                    goto no_sendfile;
-                default:
-                    return -1;
-                }
-            }
-        }
-    }
-    no_sendfile:
-    lseek(sfd, offset, SEEK_SET);
-#endif 
-
-    while (1) {
-        if ((cc = read(sfd, filebuf, buflen)) < 0) {
-            if (errno == EINTR)
-                continue;
-            err = -1;
-            break;
-        }
-
-        if (!cc || ((err = copy_all(dfd, filebuf, cc)) < 0)) {
-            break;
-        }
-    }
-    return err;
+    return copy_fd_range(sfd, ad_getentryoff(ads, eid), dfd, ad_getentryoff(add, eid), buf, buflen);
 }
@@ -303,6 +303,40 @@ int cnid_find(struct _cnid_db *cdb, const char *name, size_t namelen, void *buff
     return ret;
 }
 
+/* --------------- */
+int cnid_find_substr(struct _cnid_db *cdb, const char *name, size_t namelen,
+                     cnid_t *next, void *buffer, size_t buflen)
+{
+    int ret;
+
+    if (cdb->cnid_find_substr == NULL) {
+        LOG(log_error, logtype_cnid, "cnid_find_substr not supported by CNID backend");
+        return -1;
+    }
+
+    block_signal(cdb->cnid_db_flags);
+    ret = cdb->cnid_find_substr(cdb, name, namelen, next, buffer, buflen);
+    unblock_signal(cdb->cnid_db_flags);
+    return ret;
+}
+
+/* --------------- */
+int cnid_find_mtime(struct _cnid_db *cdb, time_t *from, time_t to,
+                    cnid_t *next, void *buffer, size_t buflen)
+{
+    int ret;
+
+    if (cdb->cnid_find_mtime == NULL) {
+        LOG(log_error, logtype_cnid, "cnid_find_mtime not supported by CNID backend");
+        return -1;
+    }
+
+    block_signal(cdb->cnid_db_flags);
+    ret = cdb->cnid_find_mtime(cdb, from, to, next, buffer, buflen);
+    unblock_signal(cdb->cnid_db_flags);
+    return ret;
+}
+
 /* --------------- */
 char *cnid_resolve(struct _cnid_db *cdb, cnid_t *id, void *buffer, size_t len)
 {
@@ -285,6 +285,8 @@ static int send_packet(CNID_bdb_private *db, struct cnid_dbd_rqst *rqst)
     size_t towrite;
     int vecs;
 
+    rqst->version = CNID_DBD_PROTO_VERSION;
+
     iov[0].iov_base = rqst;
     iov[0].iov_len  = sizeof(struct cnid_dbd_rqst);
     towrite = sizeof(struct cnid_dbd_rqst);
@@ -439,6 +441,8 @@ static struct _cnid_db *cnid_dbd_new(struct vol *vol)
     cdb->cnid_get = cnid_dbd_get;
     cdb->cnid_lookup = cnid_dbd_lookup;
     cdb->cnid_find = cnid_dbd_find;
+    cdb->cnid_find_substr = cnid_dbd_find_substr;
+    cdb->cnid_find_mtime = cnid_dbd_find_mtime;
     cdb->cnid_nextid = NULL;
     cdb->cnid_resolve = cnid_dbd_resolve;
     cdb->cnid_getstamp = cnid_dbd_getstamp;
@@ -563,6 +567,7 @@ cnid_t cnid_dbd_add(struct _cnid_db *cdb, const struct stat *st,
 
     rqst.ino = st->st_ino;
     rqst.type = S_ISDIR(st->st_mode)?1:0;
+    rqst.mtime = st->st_mtime;
     rqst.cnid = hint;
     rqst.did = did;
     rqst.name = name;
@@ -756,6 +761,7 @@ cnid_t cnid_dbd_lookup(struct _cnid_db *cdb, const struct stat *st, cnid_t did,
 
     rqst.ino = st->st_ino;
     rqst.type = S_ISDIR(st->st_mode)?1:0;
+    rqst.mtime = st->st_mtime;
     rqst.did = did;
     rqst.name = name;
     rqst.namelen = len;
@@ -843,6 +849,139 @@ int cnid_dbd_find(struct _cnid_db *cdb, const char *name, size_t namelen, void *
     return count;
 }
 
+/* ----------------------
+ * Search for names containing name, which must be case-folded like in cnid_dbd_find().
+ * This is a streaming search: start with *next set to CNID_INVALID, on return *next is
+ * where to continue, CNID_INVALID when all matches have been returned.
+ */
+int cnid_dbd_find_substr(struct _cnid_db *cdb, const char *name, size_t namelen,
+                         cnid_t *next, void *buffer, size_t buflen)
+{
+    CNID_bdb_private *db;
+    struct cnid_dbd_rqst rqst;
+    struct cnid_dbd_rply rply;
+    int count;
+
+    if (!cdb || !(db = cdb->cnid_db_private) || !name || !next) {
+        LOG(log_error, logtype_cnid, "cnid_find_substr: Parameter error");
+        errno = CNID_ERR_PARAM;
+        return -1;
+    }
+
+    if (namelen > MAXPATHLEN) {
+        LOG(log_error, logtype_cnid, "cnid_find_substr: Path name is too long");
+        errno = CNID_ERR_PATH;
+        return -1;
+    }
+
+    LOG(log_debug, logtype_cnid, "cnid_find_substr(\"%s\", next: %u)", name, ntohl(*next));
+
+    RQST_RESET(&rqst);
+    rqst.op = CNID_DBD_OP_SEARCH_SUBSTR;
+    rqst.cnid = *next;
+
+    rqst.name = name;
+    rqst.namelen = namelen;
+
+    rply.name = buffer;
+    rply.namelen = buflen;
+
+    if (transmit(db, &rqst, &rply) < 0) {
+        errno = CNID_ERR_DB;
+        return -1;
+    }
+
+    switch (rply.result) {
+    case CNID_DBD_RES_SRCH_CNT:
+    case CNID_DBD_RES_SRCH_DONE:
+        count = rply.namelen / sizeof(cnid_t);
+        *next = rply.result == CNID_DBD_RES_SRCH_CNT ? rply.cnid : CNID_INVALID;
+        LOG(log_debug, logtype_cnid, "cnid_find_substr: got %d matches, next: %u", count, ntohl(*next));
+        break;
+    case CNID_DBD_RES_ERR_DB:
+        errno = CNID_ERR_DB;
+        count = -1;
+        break;
+    default:
+        abort();
+    }
+
+    return count;
+}
+
+/* ----------------------
+ * Search for CNIDs with a modification date in [*from, to]. This is a streaming search
+ * like cnid_dbd_find_substr(), start with *next set to CNID_INVALID, on return *from
+ * and *next are where to continue, *next is CNID_INVALID when all matches have been returned.
+ * Fails with errno CNID_ERR_INDEX if the index doesn't know all files yet.
+ */
+int cnid_dbd_find_mtime(struct _cnid_db *cdb, time_t *from, time_t to,
+                        cnid_t *next, void *buffer, size_t buflen)
+{
+    CNID_bdb_private *db;
+    struct cnid_dbd_rqst rqst;
+    struct cnid_dbd_rply rply;
+    uint32_t range[2];
+    int count;
+
+    if (!cdb || !(db = cdb->cnid_db_private) || !from || !next) {
+        LOG(log_error, logtype_cnid, "cnid_find_mtime: Parameter error");
+        errno = CNID_ERR_PARAM;
+        return -1;
+    }
+
+    if (to < 0 || *from > to) {
+        *next = CNID_INVALID;
+        return 0;
+    }
+
+    LOG(log_debug, logtype_cnid, "cnid_find_mtime(%ld - %ld, next: %u)", (long)*from, (long)to, ntohl(*next));
+
+    range[0] = htonl(*from < 0 ? 0 : *from > UINT32_MAX ? UINT32_MAX : *from);
+    range[1] = htonl(to > UINT32_MAX ? UINT32_MAX : to);
+
+    RQST_RESET(&rqst);
+    rqst.op = CNID_DBD_OP_SEARCH_MTIME;
+    rqst.cnid = *next;
+
+    rqst.name = (const char *)range;
+    rqst.namelen = sizeof(range);
+
+    rply.name = buffer;
+    rply.namelen = buflen;
+
+    if (transmit(db, &rqst, &rply) < 0) {
+        errno = CNID_ERR_DB;
+        return -1;
+    }
+
+    switch (rply.result) {
+    case CNID_DBD_RES_SRCH_CNT:
+    case CNID_DBD_RES_SRCH_DONE:
+        count = rply.namelen / sizeof(cnid_t);
+        if (rply.result == CNID_DBD_RES_SRCH_CNT) {
+            *from = ntohl(rply.did);
+            *next = rply.cnid;
+        } else {
+            *next = CNID_INVALID;
+        }
+        LOG(log_debug, logtype_cnid, "cnid_find_mtime: got %d matches", count);
+        break;
+    case CNID_DBD_RES_NOTFOUND:
+        errno = CNID_ERR_INDEX;
+        count = -1;
+        break;
+    case CNID_DBD_RES_ERR_DB:
+        errno = CNID_ERR_DB;
+        count = -1;
+        break;
+    default:
+        abort();
+    }
+
+    return count;
+}
+
 /* ---------------------- */
 int cnid_dbd_update(struct _cnid_db *cdb, cnid_t id, const struct stat *st,
                     cnid_t did, const char *name, size_t len)
@@ -871,6 +1010,7 @@ int cnid_dbd_update(struct _cnid_db *cdb, cnid_t id, const struct stat *st,
     }
     rqst.ino = st->st_ino;
     rqst.type = S_ISDIR(st->st_mode)?1:0;
+    rqst.mtime = st->st_mtime;
     rqst.did = did;
     rqst.name = name;
     rqst.namelen = len;
@@ -927,6 +1067,7 @@ cnid_t cnid_dbd_rebuild_add(struct _cnid_db *cdb, const struct stat *st,
 
     rqst.ino = st->st_ino;
     rqst.type = S_ISDIR(st->st_mode)?1:0;
+    rqst.mtime = st->st_mtime;
     rqst.did = did;
     rqst.name = name;
     rqst.namelen = len;
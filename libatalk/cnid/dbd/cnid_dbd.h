@@ -27,6 +27,10 @@ extern cnid_t cnid_dbd_lookup     (struct _cnid_db *, const struct stat *, cnid_
                                    const char *, size_t);
 extern int    cnid_dbd_find       (struct _cnid_db *cdb, const char *name, size_t namelen,
                                    void *buffer, size_t buflen);
+extern int    cnid_dbd_find_substr(struct _cnid_db *cdb, const char *name, size_t namelen,
+                                   cnid_t *next, void *buffer, size_t buflen);
+extern int    cnid_dbd_find_mtime (struct _cnid_db *cdb, time_t *from, time_t to,
+                                   cnid_t *next, void *buffer, size_t buflen);
 extern int    cnid_dbd_update     (struct _cnid_db *, cnid_t, const struct stat *,
                                    cnid_t, const char *, size_t);
 extern int    cnid_dbd_delete     (struct _cnid_db *, const cnid_t);
@@ -128,32 +128,43 @@
 /* Use dalloc_add_copy() macro, not this function */
 int dalloc_add_talloc_chunk(DALLOC_CTX *dd, void *talloc_chunk, void *obj, size_t size)
 {
+    void **array;
+    int size_now;
+
+    if (size && talloc_chunk == NULL)
+        /* Called from dalloc_add_copy() macro and talloc() failed */
+        return -1;
+
+    /* Grow geometrically, adding elements one by one is the common case */
+    size_now = talloc_array_length(dd->dd_talloc_array);
+    if (dd->dd_count == size_now) {
+        array = talloc_realloc(dd, dd->dd_talloc_array, void *, size_now ? 2 * size_now : 4);
+        if (array == NULL)
+            return -1;
+        dd->dd_talloc_array = array;
+    }
+
     if (talloc_chunk) {
         /* Called from dalloc_add_copy() macro */
-        dd->dd_talloc_array = talloc_realloc(dd,
-                                             dd->dd_talloc_array,
-                                             void *,
-                                             talloc_array_length(dd->dd_talloc_array) + 1);
         memcpy(talloc_chunk, obj, size);
-        dd->dd_talloc_array[talloc_array_length(dd->dd_talloc_array) - 1] = talloc_chunk;
+        dd->dd_talloc_array[dd->dd_count++] = talloc_chunk;
     } else {
         /* Called from dalloc_add() macro */
-        dd->dd_talloc_array = talloc_realloc(dd,
-                                             dd->dd_talloc_array,
-                                             void *,
-                                             talloc_array_length(dd->dd_talloc_array) + 1);
-        dd->dd_talloc_array[talloc_array_length(dd->dd_talloc_array) - 1] = obj;
-
+        dd->dd_talloc_array[dd->dd_count++] = obj;
     }
+
+    if (dd->dd_keyhash)
+        TALLOC_FREE(dd->dd_keyhash);
+
     return 0;
 }
 
 /* Get number of elements, returns 0 if the structure is empty or not initialized */
-int dalloc_size(DALLOC_CTX *d)
+int dalloc_size(const DALLOC_CTX *d)
 {
     if (!d || !d->dd_talloc_array)
         return 0;
-    return talloc_array_length(d->dd_talloc_array);
+    return d->dd_count;
 }
 
 /*
@@ -177,9 +188,9 @@ void *dalloc_get(const DALLOC_CTX *d, ...)
 
     while (STRCMP(type, ==, "DALLOC_CTX")) {
         elem = va_arg(args, int);
-        if (elem >= talloc_array_length(d->dd_talloc_array)) {
+        if (elem >= dalloc_size(d)) {
             LOG(log_error, logtype_sl, "dalloc_get(%s): bound check error: %d >= %d",
-                type, elem >= talloc_array_length(d->dd_talloc_array));
+                type, elem, dalloc_size(d));
             EC_FAIL;
         }
         d = d->dd_talloc_array[elem];
@@ -187,9 +198,9 @@ void *dalloc_get(const DALLOC_CTX *d, ...)
     }
 
     elem = va_arg(args, int);
-    if (elem >= talloc_array_length(d->dd_talloc_array)) {
+    if (elem >= dalloc_size(d)) {
         LOG(log_error, logtype_sl, "dalloc_get(%s): bound check error: %d >= %d",
-            type, elem,  talloc_array_length(d->dd_talloc_array));
+            type, elem, dalloc_size(d));
         EC_FAIL;
     }
 
@@ -206,6 +217,57 @@ EC_CLEANUP:
     return p;
 }
 
+/* FNV-1a */
+static unsigned int dalloc_hash_key(const char *key)
+{
+    unsigned int h = 2166136261U;
+
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/*
+ * Build the hash index of a dictionary
+ *
+ * The index is an open addressing hash table with the positions of keys plus
+ * one, so 0 marks an empty slot. Returns NULL if a key is not a string, the
+ * caller falls back to a linear search then.
+ */
+static int *dalloc_build_keyhash(DALLOC_CTX *d)
+{
+    int *hash;
+    unsigned int size, mask, slot;
+    int elem, other;
+
+    for (size = 16; size < (unsigned int)d->dd_count; size *= 2)
+        ;
+    mask = size - 1;
+
+    if ((hash = talloc_zero_array(d, int, size)) == NULL)
+        return NULL;
+
+    for (elem = 0; elem + 1 < d->dd_count; elem += 2) {
+        if (STRCMP(talloc_get_name(d->dd_talloc_array[elem]), !=, "char *")) {
+            talloc_free(hash);
+            return NULL;
+        }
+        for (slot = dalloc_hash_key(d->dd_talloc_array[elem]) & mask;
+             (other = hash[slot]) != 0;
+             slot = (slot + 1) & mask) {
+            /* For duplicate keys the first one wins, just like in a linear search */
+            if (STRCMP((char *)d->dd_talloc_array[other - 1], ==, d->dd_talloc_array[elem]))
+                break;
+        }
+        if (other == 0)
+            hash[slot] = elem + 1;
+    }
+
+    return hash;
+}
+
 void *dalloc_value_for_key(const DALLOC_CTX *d, ...)
 {
     EC_INIT;
@@ -213,20 +275,35 @@ void *dalloc_value_for_key(const DALLOC_CTX *d, ...)
     va_list args;
     const char *type;
     int elem;
-    const char *elemtype;
-    char *s;
+    unsigned int mask, slot;
 
     va_start(args, d);
     type = va_arg(args, const char *);
 
     while (STRCMP(type, ==, "DALLOC_CTX")) {
         elem = va_arg(args, int);
-        AFP_ASSERT(elem < talloc_array_length(d->dd_talloc_array));
+        AFP_ASSERT(elem < dalloc_size(d));
         d = d->dd_talloc_array[elem];
         type = va_arg(args, const char *);
     }
 
-    for (elem = 0; elem + 1 < talloc_array_length(d->dd_talloc_array); elem += 2) {
+    /* Large dictionaries get a hash index, it's a cache and thus built on a const object */
+    if (d->dd_keyhash == NULL && d->dd_count / 2 >= DALLOC_HASH_MIN)
+        ((DALLOC_CTX *)d)->dd_keyhash = dalloc_build_keyhash((DALLOC_CTX *)d);
+
+    if (d->dd_keyhash) {
+        mask = talloc_array_length(d->dd_keyhash) - 1;
+        for (slot = dalloc_hash_key(type) & mask; d->dd_keyhash[slot]; slot = (slot + 1) & mask) {
+            elem = d->dd_keyhash[slot] - 1;
+            if (STRCMP((char *)d->dd_talloc_array[elem], ==, type)) {
+                p = d->dd_talloc_array[elem + 1];
+                break;
+            }
+        }
+        goto EC_CLEANUP;
+    }
+
+    for (elem = 0; elem + 1 < dalloc_size(d); elem += 2) {
         if (STRCMP(talloc_get_name(d->dd_talloc_array[elem]), !=, "char *")) {
             LOG(log_error, logtype_default, "dalloc_value_for_key: key not a string: %s",
                 talloc_get_name(d->dd_talloc_array[elem]));
@@ -237,9 +314,9 @@ void *dalloc_value_for_key(const DALLOC_CTX *d, ...)
             break;
         }            
     }
-    va_end(args);
 
 EC_CLEANUP:
+    va_end(args);
     if (ret != 0)
         p = NULL;
     return p;
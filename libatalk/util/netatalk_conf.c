@@ -835,6 +835,19 @@ static struct vol *creatvol(AFPObj *obj,
     if ((val = getoption(obj->iniconfig, section, "vol size limit", preset, NULL)))
         volume->v_limitsize = (uint32_t)strtoul(val, NULL, 10);
 
+    volume->v_directio = -1;
+    if ((val = getoption(obj->iniconfig, section, "direct io", preset, NULL))) {
+        char *end;
+        unsigned long long mib;
+
+        errno = 0;
+        mib = strtoull(val, &end, 10);
+        if (errno || *end || !isdigit((unsigned char)*val) || mib > (INT64_MAX >> 20))
+            LOG(log_error, logtype_afpd, "volume \"%s\": invalid \"direct io\" value: %s", name, val);
+        else
+            volume->v_directio = (off_t)mib * 1024 * 1024;
+    }
+
     if ((val = getoption(obj->iniconfig, section, "preexec", preset, NULL)))
         EC_NULL( volume->v_preexec = volxlate(obj, NULL, MAXPATHLEN, val, pwd, path, name) );
 
@@ -876,6 +889,8 @@ static struct vol *creatvol(AFPObj *obj,
             volume->v_vfs_ea = AFPVOL_EA_AD;
         else if (strcasecmp(val, "sys") == 0)
             volume->v_vfs_ea = AFPVOL_EA_SYS;
+        else if (strcasecmp(val, "tdb") == 0)
+            volume->v_vfs_ea = AFPVOL_EA_TDB;
         else if (strcasecmp(val, "none") == 0)
             volume->v_vfs_ea = AFPVOL_EA_NONE;
         else if (strcasecmp(val, "samba") == 0) {
@@ -929,6 +944,10 @@ static struct vol *creatvol(AFPObj *obj,
     }
     if (getoption_bool(obj->iniconfig, section, "delete veto files", preset, 0))
         volume->v_flags |= AFPVOL_DELVETO;
+    if (getoption_bool(obj->iniconfig, section, "sparse reads", preset, 0))
+        volume->v_flags |= AFPVOL_SPARSEREAD;
+    if (getoption_bool(obj->iniconfig, section, "preallocate", preset, 0))
+        volume->v_flags |= AFPVOL_PREALLOC;
 
     if (getoption_bool(obj->iniconfig, section, "preexec close", preset, 0))
         volume->v_preexec_close = 1;
@@ -1097,6 +1116,7 @@ static struct vol *creatvol(AFPObj *obj,
 #ifdef __svr4__
     volume->v_qfd = -1;
 #endif /* __svr4__ */
+    volume->v_tm_ifd = -1;
 
     /* os X start at 1 and use network order ie. 1 2 3 */
     lastvid++;
@@ -1119,6 +1139,12 @@ static struct vol *creatvol(AFPObj *obj,
     /* Check EA support on volume */
     if (volume->v_vfs_ea == AFPVOL_EA_AUTO || volume->v_adouble == AD_VERSION_EA)
         check_ea_support(volume);
+    /* The EA store lives in the .AppleDouble folders */
+    if (volume->v_vfs_ea == AFPVOL_EA_TDB && volume->v_adouble != AD_VERSION2) {
+        LOG(log_warning, logtype_afpd, "volume \"%s\": \"ea = tdb\" requires \"appledouble = v2\", using \"ea = ad\"",
+            volume->v_localname);
+        volume->v_vfs_ea = AFPVOL_EA_AD;
+    }
     initvol_vfs(volume);
 
     /* get/store uuid from file in afpd master*/
@@ -2027,6 +2053,8 @@ int afp_config_parse(AFPObj *AFPObj, char *processname)
         options->flags |= OPTION_SERVERNOTIF;
     if (!atalk_iniparser_getboolean(config, INISEC_GLOBAL, "use sendfile", 1))
         options->flags |= OPTION_NOSENDFILE;
+    if (atalk_iniparser_getboolean(config, INISEC_GLOBAL, "write behind", 0))
+        options->flags |= OPTION_WRITEBEHIND;
     if (atalk_iniparser_getboolean(config, INISEC_GLOBAL, "recvfile", 0))
         options->flags |= OPTION_RECVFILE;
     if (atalk_iniparser_getboolean(config, INISEC_GLOBAL, "solaris share reservations", 1))
@@ -2078,13 +2106,34 @@ int afp_config_parse(AFPObj *AFPObj, char *processname)
     options->server_quantum = atalk_iniparser_getint   (config, INISEC_GLOBAL, "server quantum", DSI_SERVQUANT_DEF);
     options->volnamelen     = atalk_iniparser_getint   (config, INISEC_GLOBAL, "volnamelen",     80);
     options->dircachesize   = atalk_iniparser_getint   (config, INISEC_GLOBAL, "dircachesize",   DEFAULT_MAX_DIRCACHE_SIZE);
+    options->adcachesize    = atalk_iniparser_getint   (config, INISEC_GLOBAL, "metadata cache size", DEFAULT_MAX_ADCACHE_SIZE);
     options->tcp_sndbuf     = atalk_iniparser_getint   (config, INISEC_GLOBAL, "tcpsndbuf",      0);
     options->tcp_rcvbuf     = atalk_iniparser_getint   (config, INISEC_GLOBAL, "tcprcvbuf",      0);
     options->fce_fmodwait   = atalk_iniparser_getint   (config, INISEC_GLOBAL, "fce holdfmod",   60);
     options->sleep          = atalk_iniparser_getint   (config, INISEC_GLOBAL, "sleep time",     10);
     options->disconnected   = atalk_iniparser_getint   (config, INISEC_GLOBAL, "disconnect time",24);
-    options->splice_size    = atalk_iniparser_getint   (config, INISEC_GLOBAL, "splice size",    64*1024);
+    options->splice_size    = atalk_iniparser_getint   (config, INISEC_GLOBAL, "splice size",    options->server_quantum);
+    options->catsearch_threads = atalk_iniparser_getint(config, INISEC_GLOBAL, "catsearch threads", 0);
+    options->sync_batch     = atalk_iniparser_getint   (config, INISEC_GLOBAL, "sync batch",     0);
     options->sparql_limit   = atalk_iniparser_getint   (config, INISEC_GLOBAL, "sparql results limit", 0);
+    options->sl_cache_ttl   = atalk_iniparser_getint   (config, INISEC_GLOBAL, "spotlight cache ttl", 60);
+
+#ifdef HAVE_TRACKER
+    p = atalk_iniparser_getstring(config, INISEC_GLOBAL, "spotlight backend", "tracker");
+#else
+    p = atalk_iniparser_getstring(config, INISEC_GLOBAL, "spotlight backend", "native");
+#endif
+    if (STRCMP(p, ==, "native")) {
+        options->flags |= OPTION_SPOTLIGHT_NATIVE;
+    } else {
+#ifdef HAVE_TRACKER
+        if (STRCMP(p, !=, "tracker"))
+            LOG(log_error, logtype_afpd, "bad Spotlight backend: %s, defaulting to 'tracker'", p);
+#else
+        LOG(log_error, logtype_afpd, "Spotlight backend not available: %s, using 'native'", p);
+        options->flags |= OPTION_SPOTLIGHT_NATIVE;
+#endif
+    }
 
     p = atalk_iniparser_getstring(config, INISEC_GLOBAL, "map acls", "rights");
     if (STRCMP(p, ==, "rights"))
@@ -106,7 +106,7 @@ static char *mtoupath(const struct vol *vol, const char *mpath)
 
 
 /*
- * Function: unpack_header
+ * Function: ea_unpack_header
  *
  * Purpose: unpack and verify header file data buffer at ea->ea_data into struct ea
  *
@@ -120,7 +120,7 @@ static char *mtoupath(const struct vol *vol, const char *mpath)
  *
  * Verifies magic and version.
  */
-static int unpack_header(struct ea * restrict ea)
+int ea_unpack_header(struct ea * restrict ea)
 {
     int ret = 0;
     unsigned int count = 0;
@@ -132,14 +132,14 @@ static int unpack_header(struct ea * restrict ea)
     buf = ea->ea_data;
     memcpy(&uint32, buf, sizeof(uint32_t));
     if (uint32 != htonl(EA_MAGIC)) {
-        LOG(log_error, logtype_afpd, "unpack_header: wrong magic 0x%08x", uint32);
+        LOG(log_error, logtype_afpd, "ea_unpack_header: wrong magic 0x%08x", uint32);
         ret = -1;
         goto exit;
     }
     buf += 4;
     memcpy(&uint16, buf, sizeof(uint16_t));
     if (uint16 != htons(EA_VERSION)) {
-        LOG(log_error, logtype_afpd, "unpack_header: wrong version 0x%04x", uint16);
+        LOG(log_error, logtype_afpd, "ea_unpack_header: wrong version 0x%04x", uint16);
         ret = -1;
         goto exit;
     }
@@ -148,7 +148,7 @@ static int unpack_header(struct ea * restrict ea)
     /* Get EA count */
     memcpy(&uint16, buf, sizeof(uint16_t));
     ea->ea_count = ntohs(uint16);
-    LOG(log_debug, logtype_afpd, "unpack_header: number of EAs: %u", ea->ea_count);
+    LOG(log_debug, logtype_afpd, "ea_unpack_header: number of EAs: %u", ea->ea_count);
     buf += 2;
 
     if (ea->ea_count == 0)
@@ -157,7 +157,7 @@ static int unpack_header(struct ea * restrict ea)
     /* Allocate storage for the ea_entries array */
     ea->ea_entries = malloc(sizeof(struct ea_entry) * ea->ea_count);
     if ( ! ea->ea_entries) {
-        LOG(log_error, logtype_afpd, "unpack_header: OOM");
+        LOG(log_error, logtype_afpd, "ea_unpack_header: OOM");
         ret = -1;
         goto exit;
     }
@@ -169,14 +169,14 @@ static int unpack_header(struct ea * restrict ea)
         (*(ea->ea_entries))[count].ea_size = ntohl(uint32);
         (*(ea->ea_entries))[count].ea_name = strdup(buf);
         if (! (*(ea->ea_entries))[count].ea_name) {
-            LOG(log_error, logtype_afpd, "unpack_header: OOM");
+            LOG(log_error, logtype_afpd, "ea_unpack_header: OOM");
             ret = -1;
             goto exit;
         }
         (*(ea->ea_entries))[count].ea_namelen = strlen((*(ea->ea_entries))[count].ea_name);
         buf += (*(ea->ea_entries))[count].ea_namelen + 1;
 
-        LOG(log_maxdebug, logtype_afpd, "unpack_header: entry no:%u,\"%s\", size: %u, namelen: %u", count,
+        LOG(log_maxdebug, logtype_afpd, "ea_unpack_header: entry no:%u,\"%s\", size: %u, namelen: %u", count,
             (*(ea->ea_entries))[count].ea_name,
             (*(ea->ea_entries))[count].ea_size,
             (*(ea->ea_entries))[count].ea_namelen);
@@ -189,7 +189,7 @@ exit:
 }
 
 /*
- * Function: pack_header
+ * Function: ea_pack_header
  *
  * Purpose: pack everything from struct ea into buffer at ea->ea_data
  *
@@ -203,7 +203,7 @@ exit:
  *
  * adjust ea->ea_count in case an ea entry deletetion is detected
  */
-static int pack_header(struct ea * restrict ea)
+int ea_pack_header(struct ea * restrict ea)
 {
     unsigned int count = 0, eacount = 0;
     uint16_t uint16;
@@ -212,7 +212,7 @@ static int pack_header(struct ea * restrict ea)
 
     char *buf = ea->ea_data + EA_HEADER_SIZE;
 
-    LOG(log_debug, logtype_afpd, "pack_header('%s'): ea_count: %u, ea_size: %u",
+    LOG(log_debug, logtype_afpd, "ea_pack_header('%s'): ea_count: %u, ea_size: %u",
         ea->filename, ea->ea_count, ea->ea_size);
 
     if (ea->ea_count == 0)
@@ -235,7 +235,7 @@ static int pack_header(struct ea * restrict ea)
     if (bufsize > ea->ea_size) {
         /* we must realloc */
         if ( ! (buf = realloc(ea->ea_data, bufsize)) ) {
-            LOG(log_error, logtype_afpd, "pack_header: OOM");
+            LOG(log_error, logtype_afpd, "ea_pack_header: OOM");
             return -1;
         }
         ea->ea_data = buf;
@@ -264,7 +264,7 @@ static int pack_header(struct ea * restrict ea)
         strcpy(buf, (*(ea->ea_entries))[count].ea_name);
         buf += (*(ea->ea_entries))[count].ea_namelen + 1;
 
-        LOG(log_maxdebug, logtype_afpd, "pack_header: entry no:%u,\"%s\", size: %u, namelen: %u", count,
+        LOG(log_maxdebug, logtype_afpd, "ea_pack_header: entry no:%u,\"%s\", size: %u, namelen: %u", count,
             (*(ea->ea_entries))[count].ea_name,
             (*(ea->ea_entries))[count].ea_size,
             (*(ea->ea_entries))[count].ea_namelen);
@@ -274,7 +274,7 @@ static int pack_header(struct ea * restrict ea)
 
     ea->ea_count = eacount;
 
-    LOG(log_debug, logtype_afpd, "pack_header('%s'): ea_count: %u, ea_size: %u",
+    LOG(log_debug, logtype_afpd, "ea_pack_header('%s'): ea_count: %u, ea_size: %u",
         ea->filename, ea->ea_count, ea->ea_size);
     
     return 0;
@@ -299,10 +299,10 @@ static int pack_header(struct ea * restrict ea)
  * Grow array ea->ea_entries[]. If ea->ea_entries is still NULL, start allocating.
  * Otherwise realloc and put entry at the end. Increments ea->ea_count.
  */
-static int ea_addentry(struct ea * restrict ea,
-                       const char * restrict attruname,
-                       size_t attrsize,
-                       int bitmap)
+int ea_addentry(struct ea * restrict ea,
+                const char * restrict attruname,
+                size_t attrsize,
+                int bitmap)
 {
     int ea_existed = 0;
     unsigned int count = 0;
@@ -520,7 +520,7 @@ exit:
  * Marks it as unused just by freeing name and setting it to NULL.
  * ea_close and pack_buffer must honor this.
  */
-static int ea_delentry(struct ea * restrict ea, const char * restrict attruname)
+int ea_delentry(struct ea * restrict ea, const char * restrict attruname)
 {
     int ret = 0;
     unsigned int count = 0;
@@ -776,7 +776,7 @@ int ea_open(const struct vol * restrict vol,
         goto exit;
     }
 
-    if ((unpack_header(ea)) != 0) {
+    if ((ea_unpack_header(ea)) != 0) {
         LOG(log_error, logtype_afpd, "ea_open: error unpacking header for: %s", eaname);
         ret = -1;
         goto exit;
@@ -899,7 +899,7 @@ int ea_close(struct ea * restrict ea)
 
     /* pack header and write it to disk if it was opened EA_RDWR*/
     if (ea->ea_flags & EA_RDWR) {
-        if ((pack_header(ea)) != 0) {
+        if ((ea_pack_header(ea)) != 0) {
             LOG(log_error, logtype_afpd, "ea_close: pack header");
             ret = -1;
         } else {
@@ -21,6 +21,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -37,6 +38,180 @@
 #include <atalk/unix.h>
 #include <atalk/compat.h>
 
+/**********************************************************************************
+ * EA snapshot
+ *
+ * Clients usually list the EAs of a file and then fetch size and content of each
+ * of them, eg the Finder when copying files. When listing, we read all EAs of the
+ * file at once and serve size and content requests from this snapshot as long as
+ * the ctime of the file is unchanged, which it wouldn't be if an EA had been set
+ * or removed. ctime has a resolution of a second here, so files whose ctime is not
+ * in the past yet are not snapshotted.
+ **********************************************************************************/
+
+/* larger EAs can't be sent to the client anyway, so we only remember their size */
+#define EA_SNAP_MAXSIZE (MAX_EA_SIZE + 1)
+
+struct ea_snap_entry {
+    const char *name;           /* points into ea_snap.names */
+    ssize_t    size;
+    char       *value;          /* NULL if size > EA_SNAP_MAXSIZE */
+};
+
+static struct {
+    int                  valid;
+    dev_t                dev;
+    ino_t                ino;
+    time_t               ctime;
+    int                  nofollow;
+    char                 *names;
+    ssize_t              nameslen;
+    int                  count;
+    struct ea_snap_entry *entries;
+} ea_snap;
+
+static void ea_snap_drop(void)
+{
+    int i;
+
+    if (ea_snap.entries) {
+        for (i = 0; i < ea_snap.count; i++)
+            free(ea_snap.entries[i].value);
+        free(ea_snap.entries);
+        ea_snap.entries = NULL;
+    }
+    free(ea_snap.names);
+    ea_snap.names = NULL;
+    ea_snap.count = 0;
+    ea_snap.valid = 0;
+}
+
+static int ea_snap_stat(const char *uname, int oflag, int fd, struct stat *st)
+{
+    if (fd != -1)
+        return fstat(fd, st);
+    if (oflag & O_NOFOLLOW)
+        return lstat(uname, st);
+    return stat(uname, st);
+}
+
+/*
+ * Check whether we have a snapshot of the file, st is filled with the stat of the
+ * file, st_ino is 0 if it couldn't be stat'ed
+ */
+static int ea_snap_valid(const char *uname, int oflag, int fd, struct stat *st)
+{
+    if (ea_snap_stat(uname, oflag, fd, st) != 0) {
+        st->st_ino = 0;
+        return 0;
+    }
+    return ea_snap.valid
+        && ea_snap.ino == st->st_ino
+        && ea_snap.dev == st->st_dev
+        && ea_snap.ctime == st->st_ctime
+        && ea_snap.nofollow == ((oflag & O_NOFOLLOW) && fd == -1);
+}
+
+/*
+ * Take a snapshot of the EAs of a file
+ *
+ * names and nameslen are the result of listxattr(), st the stat of the file from
+ * before calling listxattr()
+ */
+static void ea_snap_take(const char *uname, int oflag, int fd, const char *names,
+                         ssize_t nameslen, const struct stat *st)
+{
+    char buf[EA_SNAP_MAXSIZE];
+    struct ea_snap_entry *e;
+    const char *ptr;
+    ssize_t ret;
+    int count = 0;
+
+    ea_snap_drop();
+
+    if (st->st_ino == 0 || st->st_ctime >= time(NULL))
+        return;
+
+    for (ptr = names; ptr < names + nameslen; ptr += strlen(ptr) + 1)
+        count++;
+
+    if ((ea_snap.names = malloc(nameslen ? nameslen : 1)) == NULL
+        || (count && (ea_snap.entries = calloc(count, sizeof(struct ea_snap_entry))) == NULL)) {
+        ea_snap_drop();
+        return;
+    }
+    memcpy(ea_snap.names, names, nameslen);
+    ea_snap.nameslen = nameslen;
+
+    for (ptr = ea_snap.names; ptr < ea_snap.names + nameslen; ptr += strlen(ptr) + 1) {
+        e = &ea_snap.entries[ea_snap.count++];
+        e->name = ptr;
+
+        /* Read with a buffer of the largest size we need, only ask for the size if it's too small */
+        if (fd != -1)
+            ret = sys_fgetxattr(fd, ptr, buf, sizeof(buf));
+        else if (oflag & O_NOFOLLOW)
+            ret = sys_lgetxattr(uname, ptr, buf, sizeof(buf));
+        else
+            ret = sys_getxattr(uname, ptr, buf, sizeof(buf));
+
+        if (ret == -1 && errno == ERANGE) {
+            if (fd != -1)
+                ret = sys_fgetxattr(fd, ptr, NULL, 0);
+            else if (oflag & O_NOFOLLOW)
+                ret = sys_lgetxattr(uname, ptr, NULL, 0);
+            else
+                ret = sys_getxattr(uname, ptr, NULL, 0);
+            if (ret != -1 && ret <= EA_SNAP_MAXSIZE) {
+                /* it shrunk in the meantime */
+                ea_snap_drop();
+                return;
+            }
+        } else if (ret != -1) {
+            if ((e->value = malloc(ret ? ret : 1)) == NULL) {
+                ea_snap_drop();
+                return;
+            }
+            memcpy(e->value, buf, ret);
+        }
+        if (ret == -1) {
+            ea_snap_drop();
+            return;
+        }
+        e->size = ret;
+    }
+
+    ea_snap.dev = st->st_dev;
+    ea_snap.ino = st->st_ino;
+    ea_snap.ctime = st->st_ctime;
+    ea_snap.nofollow = (oflag & O_NOFOLLOW) && fd == -1;
+    ea_snap.valid = 1;
+
+    LOG(log_debug, logtype_afpd, "ea_snap_take(%s): %d EAs", uname, ea_snap.count);
+}
+
+/* getxattr() from the snapshot */
+static ssize_t ea_snap_getxattr(const char *attruname, void *value, size_t size)
+{
+    int i;
+
+    for (i = 0; i < ea_snap.count; i++) {
+        if (strcmp(ea_snap.entries[i].name, attruname) != 0)
+            continue;
+        if (size == 0)
+            return ea_snap.entries[i].size;
+        if ((size_t)ea_snap.entries[i].size > size) {
+            errno = ERANGE;
+            return -1;
+        }
+        memcpy(value, ea_snap.entries[i].value, ea_snap.entries[i].size);
+        return ea_snap.entries[i].size;
+    }
+
+    errno = ENOATTR;
+    return -1;
+}
+
 /**********************************************************************************
  * EA VFS funcs for storing EAs in nativa filesystem EAs
  **********************************************************************************/
@@ -65,9 +240,13 @@ int sys_get_easize(VFS_FUNC_ARGS_EA_GETSIZE)
 {
     ssize_t   ret;
     uint32_t  attrsize;
+    struct stat st;
 
     LOG(log_debug7, logtype_afpd, "sys_getextattr_size(%s): attribute: \"%s\"", uname, attruname);
 
+    if (ea_snap_valid(uname, oflag, fd, &st)) {
+        ret = ea_snap_getxattr(attruname, rbuf +4, 0);
+    } else
     /* PBaranski fix */
     if (fd != -1) {
 	LOG(log_debug, logtype_afpd, "sys_get_easize(%s): file is already opened", uname);
@@ -159,6 +338,7 @@ int sys_get_eacontent(VFS_FUNC_ARGS_EA_GETCONTENT)
     ssize_t   ret;
     uint32_t  attrsize;
     size_t    extra = 0;
+    struct stat st;
 
 #ifdef SOLARIS
     /* Protect special attributes set by NFS server */
@@ -192,6 +372,9 @@ int sys_get_eacontent(VFS_FUNC_ARGS_EA_GETCONTENT)
         extra = 1;
     }
 
+    if (ea_snap_valid(uname, oflag, fd, &st)) {
+        ret = ea_snap_getxattr(attruname, rbuf +4, maxreply + extra);
+    } else
     /* PBaranski fix */
     if (fd != -1) {
 	LOG(log_debug, logtype_afpd, "sys_get_eacontent(%s): file is already opened", uname);
@@ -277,15 +460,20 @@ int sys_get_eacontent(VFS_FUNC_ARGS_EA_GETCONTENT)
 int sys_list_eas(VFS_FUNC_ARGS_EA_LIST)
 {
     ssize_t attrbuflen = *buflen;
-    int     ret, len, nlen;
+    int     ret, len, nlen, snap;
     char    *buf;
     char    *ptr;
+    struct stat st;
     struct adouble ad, *adp;
 
     buf = malloc(ATTRNAMEBUFSIZ);
     if (!buf)
         return AFPERR_MISC;
 
+    if ((snap = ea_snap_valid(uname, oflag, fd, &st))) {
+        memcpy(buf, ea_snap.names, ea_snap.nameslen);
+        ret = ea_snap.nameslen;
+    } else
     /* PBaranski fix */
     if ( fd != -1) {
 	LOG(log_debug, logtype_afpd, "sys_list_eas(%s): file is already opened", uname);
@@ -300,6 +488,9 @@ int sys_list_eas(VFS_FUNC_ARGS_EA_LIST)
     }
     /* PBaranski fix */
 
+    if (ret != -1 && !snap)
+        ea_snap_take(uname, oflag, fd, buf, ret, &st);
+
     if (ret == -1) switch(errno) {
         case OPEN_NOFOLLOW_ERRNO:
             /* its a symlink and client requested O_NOFOLLOW, we pretend 0 EAs */
@@ -392,6 +583,8 @@ int sys_set_ea(VFS_FUNC_ARGS_EA_SET)
     memcpy(eabuf, ibuf, attrsize);
     eabuf[attrsize] = 0;
 
+    ea_snap_drop();
+
     attr_flag = 0;
     if ((oflag & O_CREAT) ) 
         attr_flag |= XATTR_CREATE;
@@ -479,6 +672,8 @@ int sys_remove_ea(VFS_FUNC_ARGS_EA_REMOVE)
         return AFPERR_ACCESS;
 #endif
 
+    ea_snap_drop();
+
     /* PBaranski fix */
     if ( fd != -1) {
 	LOG(log_debug, logtype_afpd, "sys_remove_ea(%s): file is already opened", uname);
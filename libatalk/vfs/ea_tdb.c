@@ -0,0 +1,1063 @@
+/*
+  Copyright (c) 2026 Netatalk Team
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+*/
+
+/*
+ * Store Extended Attributes of all files of a directory in one tdb inside the
+ * .AppleDouble folder of the directory, ".AppleDouble/.EAStore":
+ *
+ * filename "fileWithEAs" with EAs "testEA1" and "testEA2"
+ *
+ * - key "fileWithEAs" holds a header with the same format as the "::EA" header
+ *   files of ea_ad.c, a directory uses the name of its AppleDouble file ".Parent"
+ * - keys "fileWithEAs\0testEA1" and "fileWithEAs\0testEA2" hold the EAs
+ *
+ * All changes to the EAs of a file are done in one tdb transaction. As we don't
+ * sync the rest of the AppleDouble data either, the store is opened with
+ * TDB_NOSYNC.
+ *
+ * EAs still stored in files by ea_ad.c are moved into the store the first time
+ * they're accessed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include <atalk/adouble.h>
+#include <atalk/ea.h>
+#include <atalk/afp.h>
+#include <atalk/logger.h>
+#include <atalk/volume.h>
+#include <atalk/vfs.h>
+#include <atalk/util.h>
+#include <atalk/unix.h>
+#include <atalk/compat.h>
+#include <atalk/tdb.h>
+
+#define ES_RDWR   (1 << 0)      /* we're going to write */
+#define ES_CREATE (1 << 1)      /* create the store if it doesn't exist */
+
+struct ea_store {
+    const struct vol   *es_vol;
+    struct tdb_context *es_tdb;
+    int                 es_cached;                /* es_tdb is the cached handle */
+    int                 es_dir;                   /* store for EAs of a directory */
+    char                es_adname[MAXPATHLEN + 1]; /* AppleDouble file of the file */
+    char                es_path[MAXPATHLEN + 1];   /* path of the store */
+    const char          *es_name;                 /* key of the header, in es_adname */
+};
+
+/*
+ * Enumerating a directory usually accesses the EAs of all its files, so we keep
+ * the store we've used last open.
+ */
+static struct {
+    struct tdb_context *tdb;
+    dev_t              dev;
+    ino_t              ino;
+    int                rdwr;
+    int                inuse;
+} es_cache;
+
+/* Same as ea_header_mode() of ea_ad.c */
+static mode_t es_mode(mode_t mode)
+{
+    mode &= ~(S_IXUSR | S_IXGRP | S_IXOTH);
+    mode |= S_IRUSR | S_IWUSR;
+    return mode;
+}
+
+/************************************************************************************
+ * Store handling
+ ************************************************************************************/
+
+static int es_init(const struct vol *vol, const char *uname, struct ea_store *es)
+{
+    struct stat st;
+    char *p;
+
+    memset(es, 0, sizeof(struct ea_store));
+    es->es_vol = vol;
+
+    /* Dont care for errors, eg when removing the file is already gone */
+    if (!stat(uname, &st) && S_ISDIR(st.st_mode))
+        es->es_dir = 1;
+
+    strlcpy(es->es_adname, vol->ad_path(uname, es->es_dir ? ADFLAGS_DIR : 0), MAXPATHLEN + 1);
+    if ((p = strrchr(es->es_adname, '/')) == NULL) {
+        LOG(log_error, logtype_afpd, "es_init('%s'): no AppleDouble dir", uname);
+        errno = EINVAL;
+        return -1;
+    }
+    es->es_name = p + 1;
+
+    if ((size_t)(p + 1 - es->es_adname) + strlen(EA_STORE_NAME) > MAXPATHLEN) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(es->es_path, es->es_adname, p + 1 - es->es_adname);
+    strcpy(es->es_path + (p + 1 - es->es_adname), EA_STORE_NAME);
+
+    return 0;
+}
+
+static void es_close(struct ea_store *es)
+{
+    if (es->es_tdb == NULL)
+        return;
+    if (es->es_cached)
+        es_cache.inuse--;
+    else
+        tdb_close(es->es_tdb);
+    es->es_tdb = NULL;
+    es->es_cached = 0;
+}
+
+static struct tdb_context *es_tdb_open(const char *path, int flags, mode_t mode, int *rdwr)
+{
+    struct tdb_context *tdb;
+
+    *rdwr = 1;
+    tdb = tdb_open(path, 0, TDB_NOSYNC, (flags & ES_CREATE) ? O_RDWR | O_CREAT : O_RDWR, mode);
+    if (tdb == NULL && errno == EACCES && !(flags & ES_RDWR)) {
+        *rdwr = 0;
+        tdb = tdb_open(path, 0, TDB_NOSYNC, O_RDONLY, 0);
+    }
+
+    return tdb;
+}
+
+/*
+ * Open the store, the handle of the store we've used last is reused if possible
+ *
+ * Returns 0 on success, -1 on error with errno set, ENOENT if it doesn't exist and
+ * ES_CREATE wasn't requested
+ */
+static int es_open(struct ea_store *es, int flags)
+{
+    struct stat st;
+    mode_t mode = 0;
+    int created = 0, rdwr;
+    char *p;
+
+    if (stat(es->es_path, &st) != 0) {
+        if (errno != ENOENT || !(flags & ES_CREATE))
+            return -1;
+
+        /* The store is shared by all files of the directory, so it gets the mode of the AppleDouble dir */
+        p = strrchr(es->es_path, '/');
+        *p = 0;
+        if (stat(es->es_path, &st) == 0)
+            mode = es_mode(st.st_mode & 0777);
+        *p = '/';
+        if (mode == 0)
+            mode = es_mode(0666 & ~es->es_vol->v_umask);
+        created = 1;
+    } else if (es_cache.tdb
+               && es_cache.dev == st.st_dev
+               && es_cache.ino == st.st_ino) {
+        if (es_cache.rdwr || !(flags & ES_RDWR)) {
+            es_cache.inuse++;
+            es->es_tdb = es_cache.tdb;
+            es->es_cached = 1;
+            return 0;
+        }
+        if (es_cache.inuse) {
+            /* read-only handle still in use, can't open it again */
+            errno = EBUSY;
+            return -1;
+        }
+        tdb_close(es_cache.tdb);
+        es_cache.tdb = NULL;
+    }
+
+    if ((es->es_tdb = es_tdb_open(es->es_path, flags, mode, &rdwr)) == NULL) {
+        if (errno != ENOENT)
+            LOG(log_error, logtype_afpd, "es_open('%s'): %s", es->es_path, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(tdb_fd(es->es_tdb), &st) != 0) {
+        es_close(es);
+        return -1;
+    }
+    if (created)
+        /* the process umask may have masked the mode */
+        fchmod(tdb_fd(es->es_tdb), mode);
+
+    if (es_cache.inuse == 0) {
+        if (es_cache.tdb)
+            tdb_close(es_cache.tdb);
+        es_cache.tdb = es->es_tdb;
+        es_cache.dev = st.st_dev;
+        es_cache.ino = st.st_ino;
+        es_cache.rdwr = rdwr;
+        es_cache.inuse = 1;
+        es->es_cached = 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Key of the header if eaname is NULL, else key of the EA
+ */
+static TDB_DATA es_key(const struct ea_store *es, const char *eaname, char *buf, size_t bufsize)
+{
+    TDB_DATA key = { NULL, 0 };
+    size_t namelen = strlen(es->es_name);
+
+    if (eaname == NULL) {
+        key.dptr = (unsigned char *)es->es_name;
+        key.dsize = namelen;
+        return key;
+    }
+
+    if (namelen + 1 + strlen(eaname) > bufsize) {
+        LOG(log_error, logtype_afpd, "es_key('%s'): EA name too long", eaname);
+        return key;
+    }
+    memcpy(buf, es->es_name, namelen);
+    buf[namelen] = 0;
+    memcpy(buf + namelen + 1, eaname, strlen(eaname));
+
+    key.dptr = (unsigned char *)buf;
+    key.dsize = namelen + 1 + strlen(eaname);
+    return key;
+}
+
+/*
+ * Read and unpack the header of the file into ea, an empty one if the file has no EAs
+ */
+static int es_read_header(const struct ea_store *es, struct ea *ea)
+{
+    TDB_DATA data;
+    uint32_t uint32;
+    uint16_t uint16;
+
+    memset(ea, 0, sizeof(struct ea));
+    ea->vol = es->es_vol;
+    ea->dirfd = -1;
+    ea->filename = (char *)es->es_name;
+    ea->ea_fd = -1;
+
+    data = tdb_fetch(es->es_tdb, es_key(es, NULL, NULL, 0));
+    if (data.dptr == NULL) {
+        if (tdb_error(es->es_tdb) != TDB_ERR_NOEXIST) {
+            LOG(log_error, logtype_afpd, "es_read_header('%s'): %s",
+                es->es_name, tdb_errorstr(es->es_tdb));
+            return -1;
+        }
+        if ((ea->ea_data = malloc(EA_HEADER_SIZE)) == NULL) {
+            LOG(log_error, logtype_afpd, "es_read_header: OOM");
+            return -1;
+        }
+        uint32 = htonl(EA_MAGIC);
+        memcpy(ea->ea_data + EA_MAGIC_OFF, &uint32, EA_MAGIC_LEN);
+        uint16 = htons(EA_VERSION);
+        memcpy(ea->ea_data + EA_VERSION_OFF, &uint16, EA_VERSION_LEN);
+        uint16 = 0;
+        memcpy(ea->ea_data + EA_COUNT_OFF, &uint16, EA_COUNT_LEN);
+        ea->ea_size = EA_HEADER_SIZE;
+        return 0;
+    }
+
+    ea->ea_data = (char *)data.dptr;
+    ea->ea_size = data.dsize;
+
+    if (ea->ea_size < EA_HEADER_SIZE || ea_unpack_header(ea) != 0) {
+        LOG(log_error, logtype_afpd, "es_read_header('%s'): corrupt header", es->es_name);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void es_free_header(struct ea *ea)
+{
+    unsigned int count;
+
+    if (ea->ea_entries) {
+        for (count = 0; count < ea->ea_count; count++)
+            free((*ea->ea_entries)[count].ea_name);
+        free(ea->ea_entries);
+        ea->ea_entries = NULL;
+    }
+    free(ea->ea_data);
+    ea->ea_data = NULL;
+}
+
+/*
+ * Pack and store the header of the file, deletes it if the file has no EAs left
+ */
+static int es_write_header(const struct ea_store *es, struct ea *ea)
+{
+    TDB_DATA key, data;
+
+    if (ea_pack_header(ea) != 0)
+        return -1;
+
+    key = es_key(es, NULL, NULL, 0);
+
+    if (ea->ea_count == 0) {
+        if (tdb_delete(es->es_tdb, key) != 0 && tdb_error(es->es_tdb) != TDB_ERR_NOEXIST)
+            return -1;
+        return 0;
+    }
+
+    data.dptr = (unsigned char *)ea->ea_data;
+    data.dsize = ea->ea_size;
+    return tdb_store(es->es_tdb, key, data, TDB_REPLACE);
+}
+
+/*
+ * Delete header and EAs of the file, must be called within a transaction
+ */
+static int es_delete_all(const struct ea_store *es)
+{
+    char keybuf[2 * MAXPATHLEN];
+    unsigned int count;
+    struct ea ea;
+    int ret = 0;
+
+    if (es_read_header(es, &ea) != 0) {
+        es_free_header(&ea);
+        return -1;
+    }
+
+    for (count = 0; count < ea.ea_count; count++) {
+        if (tdb_delete(es->es_tdb, es_key(es, (*ea.ea_entries)[count].ea_name, keybuf, sizeof(keybuf))) != 0
+            && tdb_error(es->es_tdb) != TDB_ERR_NOEXIST)
+            ret = -1;
+    }
+    if (ea.ea_count > 0
+        && tdb_delete(es->es_tdb, es_key(es, NULL, NULL, 0)) != 0
+        && tdb_error(es->es_tdb) != TDB_ERR_NOEXIST)
+        ret = -1;
+
+    es_free_header(&ea);
+    return ret;
+}
+
+/************************************************************************************
+ * Migration of EAs stored by ea_ad.c
+ ************************************************************************************/
+
+/* Whether there's an ea_ad.c header file for the file */
+static int es_legacy(const struct ea_store *es)
+{
+    char path[MAXPATHLEN + 1];
+    struct stat st;
+
+    strlcpy(path, es->es_adname, sizeof(path));
+    if (strlcat(path, "::EA", sizeof(path)) >= sizeof(path))
+        return 0;
+    return stat(path, &st) == 0;
+}
+
+static int es_import_ea(const struct ea_store *es, struct ea *legacy, unsigned int count)
+{
+    char keybuf[2 * MAXPATHLEN];
+    const char *eaname = (*legacy->ea_entries)[count].ea_name;
+    size_t easize = (*legacy->ea_entries)[count].ea_size;
+    TDB_DATA data;
+    char *path;
+    int fd, ret = -1;
+
+    if ((path = ea_path(legacy, eaname, 1)) == NULL)
+        return -1;
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        LOG(log_error, logtype_afpd, "es_import_ea('%s'): %s", path, strerror(errno));
+        return -1;
+    }
+    if ((data.dptr = malloc(easize ? easize : 1)) == NULL)
+        goto exit;
+    if (read(fd, data.dptr, easize) != (ssize_t)easize) {
+        LOG(log_error, logtype_afpd, "es_import_ea('%s'): short read", path);
+        goto exit;
+    }
+    data.dsize = easize;
+
+    ret = tdb_store(es->es_tdb, es_key(es, eaname, keybuf, sizeof(keybuf)), data, TDB_REPLACE);
+
+exit:
+    free(data.dptr);
+    close(fd);
+    return ret;
+}
+
+/*
+ * Move the EAs of the file from the files of ea_ad.c into the store
+ *
+ * Returns 0 on success or if there's nothing to do, -1 on error
+ */
+static int es_import(struct ea_store *es, const char *uname)
+{
+    unsigned int count;
+    struct ea legacy;
+    TDB_DATA data;
+    int ret = -1;
+
+    if (!es_legacy(es))
+        return 0;
+
+    if (tdb_exists(es->es_tdb, es_key(es, NULL, NULL, 0)))
+        /* Already imported, but the files couldn't be removed */
+        goto remove;
+
+    if (ea_open(es->es_vol, uname, EA_RDONLY, &legacy) != 0)
+        return errno == ENOENT ? 0 : -1;
+
+    if (tdb_transaction_start(es->es_tdb) != 0) {
+        ea_close(&legacy);
+        return -1;
+    }
+
+    /* Another process might have been quicker */
+    if (!tdb_exists(es->es_tdb, es_key(es, NULL, NULL, 0))) {
+        for (count = 0; count < legacy.ea_count; count++) {
+            if (es_import_ea(es, &legacy, count) != 0)
+                goto exit;
+        }
+        data.dptr = (unsigned char *)legacy.ea_data;
+        data.dsize = legacy.ea_size;
+        if (legacy.ea_count > 0
+            && tdb_store(es->es_tdb, es_key(es, NULL, NULL, 0), data, TDB_REPLACE) != 0)
+            goto exit;
+    }
+
+    if (tdb_transaction_commit(es->es_tdb) != 0)
+        goto exit;
+    ret = 0;
+    LOG(log_debug, logtype_afpd, "es_import('%s'): imported %u EAs", uname, legacy.ea_count);
+
+exit:
+    if (ret != 0) {
+        LOG(log_error, logtype_afpd, "es_import('%s'): failed", uname);
+        tdb_transaction_cancel(es->es_tdb);
+    }
+    ea_close(&legacy);
+    if (ret != 0)
+        return ret;
+
+remove:
+    ea_deletefile(es->es_vol, -1, uname);
+    return 0;
+}
+
+/*
+ * Open the store of uname for reading
+ *
+ * Returns 0 on success with es->es_tdb NULL if the file has no EAs, 1 if the EAs of
+ * the file are still in ea_ad.c files that can't be moved into the store, -1 on error
+ */
+static int es_open_read(const struct vol *vol, const char *uname, struct ea_store *es)
+{
+    int legacy;
+
+    if (es_init(vol, uname, es) != 0)
+        return -1;
+
+    legacy = es_legacy(es);
+
+    if (es_open(es, legacy ? ES_RDWR | ES_CREATE : 0) != 0) {
+        if (legacy)
+            return 1;
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    if (legacy && es_import(es, uname) != 0) {
+        es_close(es);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Open the store of uname for writing
+ */
+static int es_open_write(const struct vol *vol, const char *uname, int flags, struct ea_store *es)
+{
+    struct adouble ad;
+    int legacy;
+
+    if (es_init(vol, uname, es) != 0)
+        return -1;
+
+    legacy = es_legacy(es);
+    if (legacy)
+        flags |= ES_CREATE;
+
+    if (es_open(es, ES_RDWR | flags) != 0) {
+        if (errno != ENOENT || !(flags & ES_CREATE))
+            return -1;
+        /* Possibly the .AppleDouble folder didn't exist, we create it and try again */
+        ad_init(&ad, vol);
+        if (ad_open(&ad, uname, ADFLAGS_HF | ADFLAGS_RDWR | ADFLAGS_CREATE | (es->es_dir ? ADFLAGS_DIR : 0), 0666) != 0) {
+            LOG(log_error, logtype_afpd, "es_open_write('%s'): ad_open error", uname);
+            return -1;
+        }
+        ad_close(&ad, ADFLAGS_HF);
+        if (es_open(es, ES_RDWR | flags) != 0)
+            return -1;
+    }
+
+    if (legacy && es_import(es, uname) != 0) {
+        es_close(es);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Change to dirfd for *at semantics, cf ea_deletefile */
+static int es_chdir(int dirfd, int *cwd)
+{
+    *cwd = -1;
+    if (dirfd == -1)
+        return 0;
+    if ((*cwd = open(".", O_RDONLY)) == -1)
+        return -1;
+    if (fchdir(dirfd) != 0) {
+        close(*cwd);
+        *cwd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void es_chdir_back(int *cwd)
+{
+    if (*cwd == -1)
+        return;
+    if (fchdir(*cwd) != 0) {
+        LOG(log_error, logtype_afpd, "es_chdir_back: cant chdir back. exit!");
+        exit(EXITERR_SYS);
+    }
+    close(*cwd);
+    *cwd = -1;
+}
+
+/*
+ * Copy or move the EAs from src to dst, replacing any EAs of dst
+ */
+static int es_transfer(const struct vol *vol, int dirfd, const char *src, const char *dst, int move)
+{
+    char keybuf[2 * MAXPATHLEN];
+    struct ea_store srces, dstes;
+    struct stat srcst, dstst;
+    unsigned int count;
+    struct ea ea;
+    TDB_DATA data;
+    int ret = AFPERR_MISC, same = 0, cwd, err;
+
+    memset(&dstes, 0, sizeof(dstes));
+    memset(&ea, 0, sizeof(ea));
+
+    if (es_chdir(dirfd, &cwd) != 0)
+        return AFPERR_MISC;
+    if (es_open_write(vol, src, 0, &srces) != 0) {
+        err = errno;
+        if (err == EACCES && !move && (err = es_open_read(vol, src, &srces)) == 1) {
+            /* the EAs are still in ea_ad.c files */
+            es_chdir_back(&cwd);
+            return ea_copyfile(vol, dirfd, src, dst);
+        }
+        es_chdir_back(&cwd);
+        if (err == ENOENT)
+            /* no EAs, nothing to do */
+            return AFP_OK;
+        if (err != 0)
+            return AFPERR_MISC;
+    } else {
+        es_chdir_back(&cwd);
+    }
+
+    if (srces.es_tdb == NULL)
+        return AFP_OK;
+
+    if (es_read_header(&srces, &ea) != 0)
+        goto exit;
+    if (ea.ea_count == 0) {
+        ret = AFP_OK;
+        goto exit;
+    }
+
+    if (es_init(vol, dst, &dstes) != 0)
+        goto exit;
+    if (stat(dstes.es_path, &dstst) == 0
+        && fstat(tdb_fd(srces.es_tdb), &srcst) == 0
+        && srcst.st_dev == dstst.st_dev
+        && srcst.st_ino == dstst.st_ino)
+        same = 1;
+
+    if (same)
+        dstes.es_tdb = srces.es_tdb;
+    else if (es_open_write(vol, dst, ES_CREATE, &dstes) != 0)
+        goto exit;
+
+    if (tdb_transaction_start(dstes.es_tdb) != 0)
+        goto exit;
+
+    if (es_delete_all(&dstes) != 0)
+        goto cancel;
+
+    for (count = 0; count < ea.ea_count; count++) {
+        data = tdb_fetch(srces.es_tdb, es_key(&srces, (*ea.ea_entries)[count].ea_name, keybuf, sizeof(keybuf)));
+        if (data.dptr == NULL)
+            goto cancel;
+        err = tdb_store(dstes.es_tdb,
+                        es_key(&dstes, (*ea.ea_entries)[count].ea_name, keybuf, sizeof(keybuf)),
+                        data, TDB_REPLACE);
+        free(data.dptr);
+        if (err != 0)
+            goto cancel;
+    }
+    data.dptr = (unsigned char *)ea.ea_data;
+    data.dsize = ea.ea_size;
+    if (tdb_store(dstes.es_tdb, es_key(&dstes, NULL, NULL, 0), data, TDB_REPLACE) != 0)
+        goto cancel;
+
+    if (move && same && es_delete_all(&srces) != 0)
+        goto cancel;
+
+    if (tdb_transaction_commit(dstes.es_tdb) != 0)
+        goto exit;
+
+    if (move && !same) {
+        if (tdb_transaction_start(srces.es_tdb) != 0)
+            goto exit;
+        if (es_delete_all(&srces) != 0 || tdb_transaction_commit(srces.es_tdb) != 0) {
+            tdb_transaction_cancel(srces.es_tdb);
+            goto exit;
+        }
+    }
+
+    ret = AFP_OK;
+    goto exit;
+
+cancel:
+    tdb_transaction_cancel(dstes.es_tdb);
+
+exit:
+    if (ret != AFP_OK)
+        LOG(log_error, logtype_afpd, "es_transfer('%s'/'%s'): error", src, dst);
+    es_free_header(&ea);
+    if (!same)
+        es_close(&dstes);
+    es_close(&srces);
+    return ret;
+}
+
+/************************************************************************************
+ * VFS funcs called from afp_ea* funcs
+ ************************************************************************************/
+
+/*
+ * Function: ea_store_get_easize
+ *
+ * Purpose: get size of an EA, cf get_easize
+ */
+int ea_store_get_easize(VFS_FUNC_ARGS_EA_GETSIZE)
+{
+    int ret = AFPERR_MISC;
+    unsigned int count;
+    uint32_t uint32;
+    struct ea_store es;
+    struct ea ea;
+
+    LOG(log_debug, logtype_afpd, "ea_store_get_easize: file: %s", uname);
+
+    switch (es_open_read(vol, uname, &es)) {
+    case 0:
+        if (es.es_tdb)
+            break;
+        /* fall through */
+    case -1:
+        memset(rbuf, 0, 4);
+        *rbuflen += 4;
+        return ret;
+    default:
+        return get_easize(vol, rbuf, rbuflen, uname, oflag, attruname, fd);
+    }
+
+    if (es_read_header(&es, &ea) != 0) {
+        LOG(log_error, logtype_afpd, "ea_store_get_easize: error reading EAs of file: %s", uname);
+        memset(rbuf, 0, 4);
+        *rbuflen += 4;
+        goto exit;
+    }
+
+    for (count = 0; count < ea.ea_count; count++) {
+        if (strcmp(attruname, (*ea.ea_entries)[count].ea_name) == 0) {
+            uint32 = htonl((*ea.ea_entries)[count].ea_size);
+            memcpy(rbuf, &uint32, 4);
+            *rbuflen += 4;
+            ret = AFP_OK;
+
+            LOG(log_debug, logtype_afpd, "ea_store_get_easize(\"%s\"): size: %u",
+                attruname, (*ea.ea_entries)[count].ea_size);
+            break;
+        }
+    }
+
+exit:
+    es_free_header(&ea);
+    es_close(&es);
+    return ret;
+}
+
+/*
+ * Function: ea_store_get_eacontent
+ *
+ * Purpose: copy EA into rbuf, cf get_eacontent
+ */
+int ea_store_get_eacontent(VFS_FUNC_ARGS_EA_GETCONTENT)
+{
+    char keybuf[2 * MAXPATHLEN];
+    int ret = AFPERR_MISC;
+    unsigned int count;
+    uint32_t uint32;
+    size_t toread;
+    struct ea_store es;
+    struct ea ea;
+    TDB_DATA data;
+
+    LOG(log_debug, logtype_afpd, "ea_store_get_eacontent('%s/%s')", uname, attruname);
+
+    switch (es_open_read(vol, uname, &es)) {
+    case 0:
+        if (es.es_tdb)
+            break;
+        /* fall through */
+    case -1:
+        memset(rbuf, 0, 4);
+        *rbuflen += 4;
+        return ret;
+    default:
+        return get_eacontent(vol, rbuf, rbuflen, uname, oflag, attruname, maxreply, fd);
+    }
+
+    if (es_read_header(&es, &ea) != 0) {
+        LOG(log_error, logtype_afpd, "ea_store_get_eacontent('%s'): error reading EAs", uname);
+        memset(rbuf, 0, 4);
+        *rbuflen += 4;
+        goto exit;
+    }
+
+    for (count = 0; count < ea.ea_count; count++) {
+        if (strcmp(attruname, (*ea.ea_entries)[count].ea_name) != 0)
+            continue;
+
+        data = tdb_fetch(es.es_tdb, es_key(&es, attruname, keybuf, sizeof(keybuf)));
+        if (data.dptr == NULL) {
+            LOG(log_error, logtype_afpd, "ea_store_get_eacontent('%s/%s'): missing EA", uname, attruname);
+            break;
+        }
+
+        /* Check how much the client wants, give him what we think is right */
+        maxreply -= MAX_REPLY_EXTRA_BYTES;
+        if (maxreply > MAX_EA_SIZE)
+            maxreply = MAX_EA_SIZE;
+        toread = (maxreply < data.dsize) ? maxreply : data.dsize;
+        LOG(log_debug, logtype_afpd, "ea_store_get_eacontent('%s'): sending %u bytes", attruname, toread);
+
+        /* Put length of EA data in reply buffer */
+        uint32 = htonl(toread);
+        memcpy(rbuf, &uint32, 4);
+        rbuf += 4;
+        *rbuflen += 4;
+
+        memcpy(rbuf, data.dptr, toread);
+        *rbuflen += toread;
+        free(data.dptr);
+
+        ret = AFP_OK;
+        break;
+    }
+
+exit:
+    es_free_header(&ea);
+    es_close(&es);
+    return ret;
+}
+
+/*
+ * Function: ea_store_list_eas
+ *
+ * Purpose: copy names of EAs into attrnamebuf, cf list_eas
+ */
+int ea_store_list_eas(VFS_FUNC_ARGS_EA_LIST)
+{
+    unsigned int count;
+    int attrbuflen = *buflen, ret = AFP_OK, len;
+    char *buf = attrnamebuf;
+    struct ea_store es;
+    struct ea ea;
+
+    LOG(log_debug, logtype_afpd, "ea_store_list_eas: file: %s", uname);
+
+    switch (es_open_read(vol, uname, &es)) {
+    case 0:
+        if (es.es_tdb)
+            break;
+        return AFP_OK;
+    case -1:
+        return AFPERR_MISC;
+    default:
+        return list_eas(vol, attrnamebuf, buflen, uname, oflag, fd);
+    }
+
+    if (es_read_header(&es, &ea) != 0) {
+        LOG(log_error, logtype_afpd, "ea_store_list_eas: error reading EAs of file: %s", uname);
+        ret = AFPERR_MISC;
+        goto exit;
+    }
+
+    for (count = 0; count < ea.ea_count; count++) {
+        /* Convert name to CH_UTF8_MAC and directly store in in the reply buffer */
+        if ((len = convert_string(vol->v_volcharset,
+                                  CH_UTF8_MAC,
+                                  (*ea.ea_entries)[count].ea_name,
+                                  (*ea.ea_entries)[count].ea_namelen,
+                                  buf + attrbuflen,
+                                  255)) <= 0) {
+            ret = AFPERR_MISC;
+            goto exit;
+        }
+        if (len == 255)
+            /* convert_string didn't 0-terminate */
+            attrnamebuf[attrbuflen + 255] = 0;
+
+        LOG(log_debug7, logtype_afpd, "ea_store_list_eas(%s): EA: %s",
+            uname, (*ea.ea_entries)[count].ea_name);
+
+        attrbuflen += len + 1;
+        if (attrbuflen > (ATTRNAMEBUFSIZ - 256)) {
+            /* Next EA name could overflow, so bail out with error */
+            LOG(log_warning, logtype_afpd, "ea_store_list_eas(%s): running out of buffer for EA names", uname);
+            ret = AFPERR_MISC;
+            goto exit;
+        }
+    }
+
+exit:
+    *buflen = attrbuflen;
+    es_free_header(&ea);
+    es_close(&es);
+    return ret;
+}
+
+/*
+ * Function: ea_store_set_ea
+ *
+ * Purpose: set an EA, cf set_ea
+ */
+int ea_store_set_ea(VFS_FUNC_ARGS_EA_SET)
+{
+    char keybuf[2 * MAXPATHLEN];
+    int ret = AFPERR_MISC;
+    struct ea_store es;
+    struct ea ea;
+    TDB_DATA data;
+
+    LOG(log_debug, logtype_afpd, "ea_store_set_ea: file: %s", uname);
+
+    if (es_open_write(vol, uname, ES_CREATE, &es) != 0) {
+        LOG(log_error, logtype_afpd, "ea_store_set_ea('%s'): error opening EA store", uname);
+        return AFPERR_MISC;
+    }
+
+    memset(&ea, 0, sizeof(ea));
+    if (tdb_transaction_start(es.es_tdb) != 0)
+        goto exit;
+
+    if (es_read_header(&es, &ea) != 0)
+        goto cancel;
+
+    if ((ea_addentry(&ea, attruname, attrsize, oflag)) == -1) {
+        LOG(log_error, logtype_afpd, "ea_store_set_ea('%s'): ea_addentry error", uname);
+        goto cancel;
+    }
+
+    data.dptr = (unsigned char *)ibuf;
+    data.dsize = attrsize;
+    if (tdb_store(es.es_tdb, es_key(&es, attruname, keybuf, sizeof(keybuf)), data, TDB_REPLACE) != 0
+        || es_write_header(&es, &ea) != 0) {
+        LOG(log_error, logtype_afpd, "ea_store_set_ea('%s'): %s", uname, tdb_errorstr(es.es_tdb));
+        goto cancel;
+    }
+
+    if (tdb_transaction_commit(es.es_tdb) == 0)
+        ret = AFP_OK;
+    goto exit;
+
+cancel:
+    tdb_transaction_cancel(es.es_tdb);
+exit:
+    es_free_header(&ea);
+    es_close(&es);
+    return ret;
+}
+
+/*
+ * Function: ea_store_remove_ea
+ *
+ * Purpose: remove an EA from a file, cf remove_ea
+ */
+int ea_store_remove_ea(VFS_FUNC_ARGS_EA_REMOVE)
+{
+    char keybuf[2 * MAXPATHLEN];
+    int ret = AFPERR_MISC;
+    struct ea_store es;
+    struct ea ea;
+
+    LOG(log_debug, logtype_afpd, "ea_store_remove_ea('%s/%s')", uname, attruname);
+
+    if (es_open_write(vol, uname, 0, &es) != 0) {
+        LOG(log_error, logtype_afpd, "ea_store_remove_ea('%s'): error opening EA store", uname);
+        return AFPERR_MISC;
+    }
+
+    memset(&ea, 0, sizeof(ea));
+    if (tdb_transaction_start(es.es_tdb) != 0)
+        goto exit;
+
+    if (es_read_header(&es, &ea) != 0)
+        goto cancel;
+
+    if ((ea_delentry(&ea, attruname)) == -1) {
+        LOG(log_error, logtype_afpd, "ea_store_remove_ea('%s'): ea_delentry error", uname);
+        goto cancel;
+    }
+
+    if ((tdb_delete(es.es_tdb, es_key(&es, attruname, keybuf, sizeof(keybuf))) != 0
+         && tdb_error(es.es_tdb) != TDB_ERR_NOEXIST)
+        || es_write_header(&es, &ea) != 0) {
+        LOG(log_error, logtype_afpd, "ea_store_remove_ea('%s'): %s", uname, tdb_errorstr(es.es_tdb));
+        goto cancel;
+    }
+
+    if (tdb_transaction_commit(es.es_tdb) == 0)
+        ret = AFP_OK;
+    goto exit;
+
+cancel:
+    tdb_transaction_cancel(es.es_tdb);
+exit:
+    es_free_header(&ea);
+    es_close(&es);
+    return ret;
+}
+
+/******************************************************************************************
+ * EA VFS funcs that deal with file/dir cp/mv/rm
+ ******************************************************************************************/
+
+int ea_store_deletefile(VFS_FUNC_ARGS_DELETEFILE)
+{
+    int ret, cwd;
+    struct ea_store es;
+
+    LOG(log_debug, logtype_afpd, "ea_store_deletefile('%s')", file);
+
+    /* EAs that haven't been moved into the store yet */
+    ret = ea_deletefile(vol, dirfd, file);
+
+    if (es_chdir(dirfd, &cwd) != 0)
+        return AFPERR_MISC;
+
+    if (es_init(vol, file, &es) != 0 || es_open(&es, ES_RDWR) != 0) {
+        if (errno != ENOENT)
+            ret = AFPERR_MISC;
+        goto exit;
+    }
+
+    if (tdb_transaction_start(es.es_tdb) != 0) {
+        ret = AFPERR_MISC;
+        goto exit;
+    }
+    if (es_delete_all(&es) != 0 || tdb_transaction_commit(es.es_tdb) != 0) {
+        LOG(log_error, logtype_afpd, "ea_store_deletefile('%s'): %s", file, tdb_errorstr(es.es_tdb));
+        tdb_transaction_cancel(es.es_tdb);
+        ret = AFPERR_MISC;
+    }
+
+exit:
+    es_close(&es);
+    es_chdir_back(&cwd);
+    return ret;
+}
+
+int ea_store_renamefile(VFS_FUNC_ARGS_RENAMEFILE)
+{
+    LOG(log_debug, logtype_afpd, "ea_store_renamefile('%s'/'%s')", src, dst);
+
+    return es_transfer(vol, dirfd, src, dst, 1);
+}
+
+int ea_store_copyfile(VFS_FUNC_ARGS_COPYFILE)
+{
+    LOG(log_debug, logtype_afpd, "ea_store_copyfile('%s'/'%s')", src, dst);
+
+    return es_transfer(vol, sfd, src, dst, 0);
+}
+
+/*
+ * The store of a directory holds the EAs of all its files, so it follows the
+ * mode of the directory
+ */
+int ea_store_chmod_dir(VFS_FUNC_ARGS_SETDIRUNIXMODE)
+{
+    int ret;
+    struct ea_store es;
+
+    LOG(log_debug, logtype_afpd, "ea_store_chmod_dir('%s')", name);
+
+    /* EAs that haven't been moved into the store yet */
+    ret = ea_chmod_dir(vol, name, mode, st);
+
+    if (es_init(vol, name, &es) != 0)
+        return AFPERR_MISC;
+
+    /* .AppleDouble already might be inaccesible, so we must run as id 0 */
+    become_root();
+    if (setfilmode(vol, es.es_path, es_mode(mode), NULL) != 0 && errno != ENOENT) {
+        LOG(log_error, logtype_afpd, "ea_store_chmod_dir('%s'): %s", es.es_path, strerror(errno));
+        switch (errno) {
+        case EPERM:
+        case EACCES:
+            ret = AFPERR_ACCESS;
+            break;
+        default:
+            ret = AFPERR_MISC;
+            break;
+        }
+    }
+    unbecome_root();
+
+    return ret;
+}
@@ -13,7 +13,12 @@
 #include <sys/param.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <string.h>
+#include <fcntl.h>
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
 
 #include <atalk/afp.h>
 #include <atalk/util.h>
@@ -131,36 +136,279 @@ int netatalk_unlink(const char *name)
  * *at semnatics support functions (like openat, renameat standard funcs)
  **************************************************************************/
 
-/* Copy all file data from one file fd to another */
-int copy_file_fd(int sfd, int dfd)
+/* copy_file_range() chunk size, the kernel caps a single call anyway */
+#define COPY_RANGE_CHUNK (1024 * 1024 * 1024)
+
+/* Errors that just mean the filesystem can't do it */
+static int copy_offload_unsupported(int err)
 {
-    EC_INIT;
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == ENOTTY
+        || err == EOPNOTSUPP || err == ENOTSUP || err == EBADF || err == ETXTBSY;
+}
+
+/*
+ * Find the next data region of fd at or after off. Without SEEK_DATA support
+ * everything up to size is data.
+ *
+ * @returns start of the data region, size if there is no more data, *end is
+ *          set to the end of the region
+ */
+static off_t copy_next_data(int fd, off_t off, off_t size, off_t *end)
+{
+#ifdef SEEK_DATA
+    off_t data, hole;
+
+    if ((data = lseek(fd, off, SEEK_DATA)) == -1) {
+        *end = size;
+        /* ENXIO: only a hole up to EOF */
+        return errno == ENXIO ? size : off;
+    }
+    if (data >= size) {
+        *end = size;
+        return size;
+    }
+    if ((hole = lseek(fd, data, SEEK_HOLE)) == -1 || hole > size)
+        hole = size;
+    *end = hole;
+    return data;
+#else
+    *end = size;
+    return off;
+#endif
+}
+
+/*
+ * Make [off, end) of the destination read as zeroes. Beyond dsize, the size of
+ * the destination before the copy, it's a hole already, below we punch one.
+ */
+static int copy_hole(int fd, off_t off, off_t end, off_t dsize)
+{
+    char    zeroes[8192];
     ssize_t cc;
-    size_t  buflen;
-    char   filebuf[NETATALK_DIOSZ_STACK];
 
-    while ((cc = read(sfd, filebuf, sizeof(filebuf)))) {
-        if (cc < 0) {
+    end = MIN(end, dsize);
+    if (off >= end)
+        return 0;
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, end - off) == 0)
+        return 0;
+#endif
+
+    memset(zeroes, 0, sizeof(zeroes));
+    while (off < end) {
+        if ((cc = pwrite(fd, zeroes, MIN(sizeof(zeroes), end - off), off)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        off += cc;
+    }
+    return 0;
+}
+
+/*
+ * Copy [soff, end) of a data region, with copy_file_range() if buf is NULL,
+ * through buf otherwise.
+ *
+ * @returns 0 when done, 1 if copy_file_range() can't do it, -1 on error
+ */
+static int copy_region(int sfd, off_t *soff, off_t end, int dfd, off_t *doff,
+                       char *buf, size_t buflen)
+{
+    ssize_t cc, wc;
+    char    *p;
+
+    while (*soff < end) {
+        if (buf == NULL) {
+#ifdef HAVE_COPY_FILE_RANGE
+            cc = copy_file_range(sfd, soff, dfd, doff, MIN(end - *soff, COPY_RANGE_CHUNK), 0);
+            if (cc < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (copy_offload_unsupported(errno))
+                    return 1;
+                return -1;
+            }
+            if (cc == 0)
+                /* some pseudo filesystems claim EOF right away */
+                return 1;
+            continue;
+#else
+            return 1;
+#endif
+        }
+
+        if ((cc = pread(sfd, buf, MIN(buflen, end - *soff), *soff)) < 0) {
             if (errno == EINTR)
                 continue;
-            LOG(log_error, logtype_afpd, "copy_file_fd: %s", strerror(errno));
-            EC_FAIL;
+            return -1;
         }
+        if (cc == 0)
+            /* file shrunk */
+            break;
+        *soff += cc;
 
-        buflen = cc;
-        while (buflen > 0) {
-            if ((cc = write(dfd, filebuf, buflen)) < 0) {
+        for (p = buf; cc > 0; ) {
+            if ((wc = pwrite(dfd, p, cc, *doff)) < 0) {
                 if (errno == EINTR)
                     continue;
-                LOG(log_error, logtype_afpd, "copy_file_fd: %s", strerror(errno));
-                EC_FAIL;
+                return -1;
             }
-            buflen -= cc;
+            p += wc;
+            cc -= wc;
+            *doff += wc;
         }
     }
+    return 0;
+}
 
-EC_CLEANUP:
-    EC_EXIT;
+/*
+ * Copy from soff to the end of sfd region by region, holes in the source
+ * become holes in the destination.
+ *
+ * @returns 0 when done, 1 if copy_file_range() can't do it (buf == NULL),
+ *          -1 on error
+ */
+static int copy_sparse(int sfd, off_t *soff, off_t size, int dfd, off_t *doff,
+                       char *buf, size_t buflen)
+{
+    struct stat st;
+    off_t   data, end, pos;
+    int     ret = 0;
+
+    if (fstat(dfd, &st) != 0)
+        return -1;
+
+    /* SEEK_DATA moves the file offset */
+    pos = lseek(sfd, 0, SEEK_CUR);
+
+    while (*soff < size) {
+        data = copy_next_data(sfd, *soff, size, &end);
+        if (data > *soff) {
+            if (copy_hole(dfd, *doff, *doff + (data - *soff), st.st_size) != 0) {
+                ret = -1;
+                break;
+            }
+            *doff += data - *soff;
+            *soff = data;
+        }
+        if (*soff >= size)
+            break;
+        if ((ret = copy_region(sfd, soff, end, dfd, doff, buf, buflen)) != 0)
+            break;
+        if (*soff < end)
+            /* file shrunk */
+            break;
+    }
+
+    if (pos != -1)
+        lseek(sfd, pos, SEEK_SET);
+    if (ret != 0)
+        return ret;
+
+    /* a trailing hole */
+    if (fstat(dfd, &st) != 0)
+        return -1;
+    if (st.st_size < *doff && ftruncate(dfd, *doff) != 0)
+        return -1;
+
+    return 0;
+}
+
+/*!
+ * Let the filesystem copy file data without passing it through userspace
+ *
+ * Tries to reflink the data (FICLONE, FICLONERANGE), then copy_file_range().
+ * Copies from soff to the end of sfd, holes are preserved. The file offsets of
+ * the fds are not changed.
+ *
+ * @param sfd   (r)  source fd
+ * @param soff  (rw) in: source offset, out: where the caller has to continue
+ * @param dfd   (r)  destination fd
+ * @param doff  (rw) in: destination offset, out: where the caller has to continue
+ *
+ * @returns 0 if all data has been copied, 1 if the caller has to copy the
+ *          rest itself, -1 on error
+ */
+int copy_fd_offload(int sfd, off_t *soff, int dfd, off_t *doff)
+{
+    struct stat st;
+#ifdef FICLONERANGE
+    struct file_clone_range fcr;
+#endif
+    int ret;
+
+    if (fstat(sfd, &st) != 0 || !S_ISREG(st.st_mode))
+        return 1;
+    if (*soff >= st.st_size)
+        return 0;
+
+#ifdef FICLONE
+    if (*soff == 0 && *doff == 0) {
+        if (ioctl(dfd, FICLONE, sfd) == 0) {
+            *soff = *doff = st.st_size;
+            return 0;
+        }
+    } else {
+        fcr.src_fd = sfd;
+        fcr.src_offset = *soff;
+        fcr.src_length = 0;     /* up to EOF */
+        fcr.dest_offset = *doff;
+        if (ioctl(dfd, FICLONERANGE, &fcr) == 0) {
+            *doff += st.st_size - *soff;
+            *soff = st.st_size;
+            return 0;
+        }
+    }
+#endif
+
+    if ((ret = copy_sparse(sfd, soff, st.st_size, dfd, doff, NULL, 0)) < 0)
+        LOG(log_error, logtype_afpd, "copy_fd_offload: %s", strerror(errno));
+    return ret;
+}
+
+/*!
+ * Copy file data from one fd to another from the given offsets to the end of sfd
+ *
+ * Offloads the copy to the filesystem if possible, see copy_fd_offload(),
+ * otherwise copies the data through buf. Holes in sfd are preserved. The file
+ * offsets of the fds are not changed.
+ *
+ * @param sfd    (r) source fd
+ * @param soff   (r) source offset
+ * @param dfd    (r) destination fd
+ * @param doff   (r) destination offset
+ * @param buf    (r) buffer for copying, may be NULL
+ * @param buflen (r) size of buf
+ *
+ * @returns 0 on success, -1 on error
+ */
+int copy_fd_range(int sfd, off_t soff, int dfd, off_t doff, char *buf, size_t buflen)
+{
+    struct stat st;
+    char    fixedbuf[NETATALK_DIOSZ_STACK];
+    int     ret;
+
+    if ((ret = copy_fd_offload(sfd, &soff, dfd, &doff)) != 1)
+        return ret;
+
+    if (buf == NULL || buflen < sizeof(fixedbuf)) {
+        buf = fixedbuf;
+        buflen = sizeof(fixedbuf);
+    }
+
+    if (fstat(sfd, &st) != 0 || (ret = copy_sparse(sfd, &soff, st.st_size, dfd, &doff, buf, buflen)) != 0) {
+        LOG(log_error, logtype_afpd, "copy_fd_range: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Copy all file data from one file fd to another */
+int copy_file_fd(int sfd, int dfd)
+{
+    return copy_fd_range(sfd, 0, dfd, 0, NULL, 0);
 }
 
 /* 
@@ -103,7 +103,11 @@ static int validupath_adouble(VFS_FUNC_ARGS_VALIDUPATH)
     if (name[0] != '.')
         return 1;
     
-    return netatalk_name(name) && strcmp(name,".AppleDouble") && strcasecmp(name,".Parent");
+    if (!netatalk_name(name) || !strcmp(name,".AppleDouble") || !strcasecmp(name,".Parent"))
+        return 0;
+
+    /* the AppleDouble file of ".EAStore" would be the "ea = tdb" store */
+    return vol->v_vfs_ea != AFPVOL_EA_TDB || strcmp(name, EA_STORE_NAME);
 }                                           
 
 /* ----------------- */
@@ -780,6 +784,29 @@ static struct vfs_ops netatalk_ea_adouble = {
     /* vfs_remove         */ remove_ea
 };
 
+static struct vfs_ops netatalk_ea_tdb = {
+    /* vfs_validupath:    */ NULL,
+    /* vfs_chown:         */ ea_chown,
+    /* vfs_renamedir:     */ NULL, /* ok */
+    /* vfs_deletecurdir:  */ NULL, /* ok */
+    /* vfs_setfilmode:    */ ea_chmod_file,
+    /* vfs_setdirmode:    */ NULL, /* ok */
+    /* vfs_setdirunixmode:*/ ea_store_chmod_dir,
+    /* vfs_setdirowner:   */ NULL, /* ok */
+    /* vfs_deletefile:    */ ea_store_deletefile,
+    /* vfs_renamefile:    */ ea_store_renamefile,
+    /* vfs_copyfile       */ ea_store_copyfile,
+#ifdef HAVE_ACLS
+    /* vfs_acl:           */ NULL,
+    /* vfs_remove_acl     */ NULL,
+#endif
+    /* vfs_getsize        */ ea_store_get_easize,
+    /* vfs_getcontent     */ ea_store_get_eacontent,
+    /* vfs_list           */ ea_store_list_eas,
+    /* vfs_set            */ ea_store_set_ea,
+    /* vfs_remove         */ ea_store_remove_ea
+};
+
 static struct vfs_ops netatalk_ea_sys = {
     /* validupath:        */ NULL,
     /* rf_chown:          */ NULL,
@@ -870,6 +897,9 @@ void initvol_vfs(struct vol *vol)
     } else if (vol->v_vfs_ea == AFPVOL_EA_AD) {
         LOG(log_debug, logtype_afpd, "initvol_vfs: enabling EA support with adouble files");
         vol->vfs_modules[1] = &netatalk_ea_adouble;
+    } else if (vol->v_vfs_ea == AFPVOL_EA_TDB) {
+        LOG(log_debug, logtype_afpd, "initvol_vfs: enabling EA support with a tdb per directory");
+        vol->vfs_modules[1] = &netatalk_ea_tdb;
     } else {
         LOG(log_debug, logtype_afpd, "initvol_vfs: volume without EA support");
     }
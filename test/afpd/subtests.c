@@ -20,6 +20,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <atalk/util.h>
 #include <atalk/cnid.h>
@@ -29,12 +32,15 @@
 #include <atalk/queue.h>
 #include <atalk/bstrlib.h>
 #include <atalk/globals.h>
+#include <atalk/spotlight.h>
+#include <atalk/adouble.h>
 
 #include "directory.h"
 #include "dircache.h"
 #include "hash.h"
 #include "afp_config.h"
 #include "volume.h"
+#include "fork.h"
 
 #include "test.h"
 #include "subtests.h"
@@ -68,3 +74,77 @@ int test002_rem_x_dirs(const struct vol *vol, cnid_t start, cnid_t end)
 
     return 0;
 }
+
+/* Check a file against a native Spotlight query, -2 if the query doesn't use nsrc index searches */
+int test003_sl_query(const struct vol *vol, const char *query, const char *name,
+                     mode_t mode, off_t size, time_t mtime, int nsrc)
+{
+    struct stat st;
+    int ret, n = 0;
+
+    memset(&st, 0, sizeof(st));
+    st.st_mode = mode;
+    st.st_size = size;
+    st.st_mtime = mtime;
+
+    if ((ret = sl_native_eval(vol, query, name, &st, &n)) >= 0 && n != nsrc)
+        return -2;
+    return ret;
+}
+
+/*
+ * Open a data fork for writing, write to it with space preallocated past the end
+ * and close it. Returns 0 if the preallocated space has been released, 1 if not.
+ */
+int test004_prealloc_trim(const AFPObj *obj, struct vol *vol)
+{
+#ifdef HAVE_FALLOCATE
+    char name[] = "prealloc.test";
+    char path[MAXPATHLEN + 1];
+    char buf[4096];
+    struct ofork *of;
+    struct dir *dir;
+    struct stat st;
+    uint16_t refnum;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", vol->v_path, name);
+    unlink(path);
+    if ((fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0666)) == -1)
+        return -1;
+    fstat(fd, &st);
+    close(fd);
+
+    if ((dir = dirlookup(vol, DIRDID_ROOT)) == NULL)
+        return -1;
+    if ((of = of_alloc(vol, dir, name, &refnum, ADEID_DFORK, NULL, &st)) == NULL)
+        return -1;
+    if (ad_open(of->of_ad, path, ADFLAGS_DF | ADFLAGS_RDWR | ADFLAGS_SETSHRMD, 0666) != 0)
+        return -1;
+    /* the open mode lock afp_openfork() sets for write access */
+    if (ad_lock(of->of_ad, ADEID_DFORK, ADLOCK_RD | ADLOCK_FILELOCK, AD_FILELOCK_OPEN_WR, 1, refnum) != 0)
+        return -1;
+
+    fd = ad_data_fileno(of->of_ad);
+    memset(buf, 0, sizeof(buf));
+    if (pwrite(fd, buf, sizeof(buf), 0) != sizeof(buf))
+        return -1;
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, sizeof(buf), 1024 * 1024) != 0) {
+        /* not supported by the filesystem, nothing to test */
+        of_closefork(obj, of);
+        unlink(path);
+        return 0;
+    }
+    of->of_pa_end = sizeof(buf) + 1024 * 1024;
+
+    if (of_closefork(obj, of) != 0)
+        return -1;
+    if (stat(path, &st) != 0)
+        return -1;
+    unlink(path);
+
+    if (st.st_size != sizeof(buf) || st.st_blocks * 512 >= 1024 * 1024)
+        return 1;
+#endif
+    return 0;
+}
@@ -41,4 +41,7 @@
 
 extern int test001_add_x_dirs(const struct vol *vol, cnid_t start, cnid_t end);
 extern int test002_rem_x_dirs(const struct vol *vol, cnid_t start, cnid_t end);
+extern int test003_sl_query(const struct vol *vol, const char *query, const char *name,
+                            mode_t mode, off_t size, time_t mtime, int nsrc);
+extern int test004_prealloc_trim(const AFPObj *obj, struct vol *vol);
 #endif  /* SUBTESTS_H */
@@ -113,4 +113,27 @@ int main(int argc, char **argv)
 
     /* test enumerate.c stuff */
     TEST_int(enumerate(&obj, vid, DIRDID_ROOT), 0);
+
+    /* test ofork.c stuff, preallocated space is released on close */
+    TEST_int(test004_prealloc_trim(&obj, vol), 0);
+
+    /* test spotlight_native.c query translation, $time.iso() dates are UTC in any timezone */
+    TEST(setenv("TZ", "EST5EDT", 1); tzset());
+    TEST_int(test003_sl_query(vol, "kMDItemFSName==\"*report*\"cd", "Annual Report.pdf", S_IFREG, 1000, 0, 1), 1);
+    TEST_int(test003_sl_query(vol, "kMDItemFSName==\"*budget*\"cd", "Annual Report.pdf", S_IFREG, 1000, 0, 1), 0);
+    TEST_int(test003_sl_query(vol, "kMDItemDisplayName==\"rep*\"cdw", "Annual Report.pdf", S_IFREG, 1000, 0, 1), 1);
+    TEST_int(test003_sl_query(vol, "kMDItemDisplayName==\"rep*\"cdw", "Unreported.pdf", S_IFREG, 1000, 0, 1), 0);
+    TEST_int(test003_sl_query(vol, "kMDItemTextContent==\"*annual*\"cd", "Annual Report.pdf", S_IFREG, 1000, 0, 1), 1);
+    TEST_int(test003_sl_query(vol, "InRange(kMDItemFSContentChangeDate,$time.iso(2024-01-01T00:00:00Z),$time.iso(2024-01-01T23:59:59Z))",
+                              "Annual Report.pdf", S_IFREG, 1000, 1704067200, 1), 1);
+    TEST_int(test003_sl_query(vol, "InRange(kMDItemFSContentChangeDate,$time.iso(2024-01-01T00:00:00Z),$time.iso(2024-01-01T23:59:59Z))",
+                              "Annual Report.pdf", S_IFREG, 1000, 1704067199, 1), 0);
+    TEST_int(test003_sl_query(vol, "kMDItemFSContentChangeDate>725760000", "Annual Report.pdf", S_IFREG, 1000, 1704067201, 1), 1);
+    TEST_int(test003_sl_query(vol, "kMDItemFSSize>500", "Annual Report.pdf", S_IFREG, 1000, 0, -1), 1);
+    TEST_int(test003_sl_query(vol, "kMDItemFSSize>500", "Annual Report.pdf", S_IFDIR, 0, 0, -1), 0);
+    TEST_int(test003_sl_query(vol, "kMDItemContentType==\"com.adobe.pdf\"", "Annual Report.pdf", S_IFREG, 1000, 0, -1), 1);
+    TEST_int(test003_sl_query(vol, "kMDItemFSName==\"*report*\"cd && kMDItemFSSize>500", "Annual Report.pdf", S_IFREG, 1000, 0, 1), 1);
+    TEST_int(test003_sl_query(vol, "kMDItemFSName==\"*report*\"cd || kMDItemFSName==\"*budget*\"cd", "Budget.xls", S_IFREG, 1000, 0, 2), 1);
+    TEST_int(test003_sl_query(vol, "kMDItemFSName==\"*report*\"cd || kMDItemFSSize>500", "Budget.xls", S_IFREG, 1000, 0, -1), 1);
+    TEST_int(test003_sl_query(vol, "kMDItemFSName==", "Annual Report.pdf", S_IFREG, 1000, 0, 1), -1);
 }